@@ -0,0 +1,49 @@
+#!/bin/sh
+# Command log replay throughput: a log of mkdir, cd, touch, ls, pwd, mv, cp
+# and rm lines is replayed line by line and with -b, and the lines per
+# second of each are printed. Run it with make bench-batch, or as
+# ./bench_batch.sh [lines] [sd_fs binary], to compare with another build.
+
+LINES=${1:-1000000}
+BINARY=${2:-./sd_fs}
+LOG=$(mktemp)
+trap 'rm -f "$LOG"' EXIT
+
+# a hundred folders, then groups of ten commands, each in a new folder
+# inside one of them
+awk -v lines="$LINES" 'BEGIN {
+    for (i = 0; i < 100; i++)
+        print "mkdir d" i
+    for (i = 0; i * 10 + 100 < lines; i++) {
+        print "cd d" i % 100
+        print "mkdir e" i
+        print "cd e" i
+        print "touch f" i " text" i
+        print "touch g" i
+        print "ls"
+        print "mv f" i " h" i
+        print "cp h" i " k" i
+        print "rm g" i
+        print "cd ../.."
+    }
+}' > "$LOG"
+
+now() {
+    date +%s%N
+}
+
+# the label, then the sd_fs arguments
+run() {
+    label=$1
+    shift
+    start=$(now)
+    "$BINARY" "$@" < "$LOG" > /dev/null
+    end=$(now)
+    millis=$(( (end - start) / 1000000 ))
+    [ "$millis" -gt 0 ] || millis=1
+    echo "$label: $(wc -l < "$LOG") lines in $millis ms," \
+         "$(( $(wc -l < "$LOG") * 1000 / millis )) lines/s"
+}
+
+run "line by line"
+run "batches" -b
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "tree.h"
+
+/*
+ * A blob is never changed once created, so files can share it: they hold
+ * their bytes in blobs (see filedata.c) and a write swaps the blobs it
+ * changes for new ones. References are counted atomically, blobs are
+ * shared between the threads copying a subtree.
+ *
+ * The blobs we allocate are interned in a content addressed store, keyed
+ * by a 128 bit hash of their data, so identical contents are kept once
+ * whatever file they came from.
+ *
+ * A cold blob can be swapped for a packed one, holding its bytes
+ * compressed with lz.c. Packed blobs are interned too, next to the plain
+ * ones: the codec is deterministic, so equal bytes pack the same way.
+ */
+
+/*
+ * Chained hash table of the interned blobs. A blob whose count dropped to
+ * 0 can't be taken again, it stays in its chain until its releaser gets
+ * the lock and unlinks it.
+ */
+static struct {
+    pthread_mutex_t lock;
+    Blob** buckets;
+    size_t capacity;
+    size_t count;
+    size_t bytes;
+} store = {PTHREAD_MUTEX_INITIALIZER};
+
+// what packing and unpacking cost so far
+static struct {
+    uint64_t packs;
+    uint64_t packNanos;
+    uint64_t unpacks;
+    uint64_t unpackNanos;
+} codec;
+
+// set once grep -t asked for the trigram index, from then on every new
+// blob gets its trigrams right away
+static int signing;
+
+// the data of a blob we allocated follows it, in the same allocation
+static char *blob_inline(Blob *blob)
+{
+    return (char *)(blob + 1);
+}
+
+// the bytes the blob takes in memory
+static size_t blob_stored(Blob *blob)
+{
+    return blob->packed != 0 ? blob->packed : blob->length;
+}
+
+static uint64_t now_nanos()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3, x64 128 bit variant, seeded with 0
+static void blob_hash(const char *data, size_t length, uint64_t hash[2])
+{
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    const unsigned char *tail = (const unsigned char *)data + length / 16 * 16;
+    uint64_t h1 = 0, h2 = 0, k1, k2;
+
+    for (size_t i = 0; i < length / 16; i++)
+    {
+        memcpy(&k1, data + i * 16, 8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    k1 = k2 = 0;
+    switch (length & 15)
+    {
+    case 15: k2 ^= (uint64_t)tail[14] << 48; // fall through
+    case 14: k2 ^= (uint64_t)tail[13] << 40; // fall through
+    case 13: k2 ^= (uint64_t)tail[12] << 32; // fall through
+    case 12: k2 ^= (uint64_t)tail[11] << 24; // fall through
+    case 11: k2 ^= (uint64_t)tail[10] << 16; // fall through
+    case 10: k2 ^= (uint64_t)tail[9] << 8; // fall through
+    case 9:
+        k2 ^= (uint64_t)tail[8];
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        // fall through
+    case 8: k1 ^= (uint64_t)tail[7] << 56; // fall through
+    case 7: k1 ^= (uint64_t)tail[6] << 48; // fall through
+    case 6: k1 ^= (uint64_t)tail[5] << 40; // fall through
+    case 5: k1 ^= (uint64_t)tail[4] << 32; // fall through
+    case 4: k1 ^= (uint64_t)tail[3] << 24; // fall through
+    case 3: k1 ^= (uint64_t)tail[2] << 16; // fall through
+    case 2: k1 ^= (uint64_t)tail[1] << 8; // fall through
+    case 1:
+        k1 ^= (uint64_t)tail[0];
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+static void store_grow()
+{
+    size_t capacity = store.capacity ? store.capacity * 2 : 1024;
+    Blob **buckets = calloc(capacity, sizeof(Blob *));
+    DIE(!buckets, "calloc");
+
+    for (size_t i = 0; i < store.capacity; i++)
+    {
+        Blob *blob = store.buckets[i];
+        while (blob != NULL)
+        {
+            Blob *next = blob->next;
+            Blob **bucket = &buckets[blob->hash[0] & (capacity - 1)];
+            blob->next = *bucket;
+            *bucket = blob;
+            blob = next;
+        }
+    }
+    free(store.buckets);
+    store.buckets = buckets;
+    store.capacity = capacity;
+}
+
+// takes a reference, unless the blob is already on its way out
+static int blob_revive(Blob *blob)
+{
+    unsigned int refs = __atomic_load_n(&blob->refs, __ATOMIC_RELAXED);
+    while (refs != 0)
+    {
+        if (__atomic_compare_exchange_n(&blob->refs, &refs, refs + 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Finds the blob holding these bytes, stored packed in packed bytes or
+ * plain if packed is 0, or adds one. stored are the bytes kept in memory.
+ */
+static Blob *blob_intern(const uint64_t hash[2], size_t length,
+                         const char *stored, size_t packed)
+{
+    size_t size = packed != 0 ? packed : length;
+
+    pthread_mutex_lock(&store.lock);
+    if (store.count >= store.capacity)
+        store_grow();
+    Blob **bucket = &store.buckets[hash[0] & (store.capacity - 1)];
+    for (Blob *blob = *bucket; blob != NULL; blob = blob->next)
+    {
+        // the hash picks the blob, the bytes confirm it
+        if (blob->hash[0] == hash[0] && blob->hash[1] == hash[1] &&
+            blob->length == length && blob->packed == packed &&
+            memcmp(blob->data, stored, size) == 0 && blob_revive(blob))
+        {
+            pthread_mutex_unlock(&store.lock);
+            return blob;
+        }
+    }
+
+    Blob *blob = malloc(sizeof(Blob) + size);
+    DIE(!blob, "malloc");
+    blob->refs = 1;
+    blob->length = length;
+    blob->packed = packed;
+    memcpy(blob_inline(blob), stored, size);
+    blob->data = blob_inline(blob);
+    blob->hash[0] = hash[0];
+    blob->hash[1] = hash[1];
+    blob->trigrams = NULL;
+    blob->next = *bucket;
+    *bucket = blob;
+    store.count++;
+    store.bytes += size;
+    pthread_mutex_unlock(&store.lock);
+    return blob;
+}
+
+// gives the blob the trigrams of its plain bytes, unless it has them
+static const uint64_t *blob_sign(Blob *blob, const char *bytes)
+{
+    uint64_t *trigrams = __atomic_load_n(&blob->trigrams, __ATOMIC_ACQUIRE);
+    if (trigrams != NULL)
+        return trigrams;
+
+    // threads scanning the same blob may race for it, the first one wins
+    trigrams = malloc(TRIGRAM_SIGNATURE_BITS / 8);
+    DIE(!trigrams, "malloc");
+    trigram_sign(bytes, blob->length, trigrams);
+    uint64_t *expected = NULL;
+    if (!__atomic_compare_exchange_n(&blob->trigrams, &expected, trigrams, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        free(trigrams);
+        return expected;
+    }
+    return trigrams;
+}
+
+Blob *blob_create(const char *data, size_t length)
+{
+    uint64_t hash[2];
+
+    // we hash outside the lock
+    blob_hash(data, length, hash);
+    Blob *blob = blob_intern(hash, length, data, 0);
+    if (__atomic_load_n(&signing, __ATOMIC_RELAXED))
+        blob_sign(blob, data);
+    return blob;
+}
+
+Blob *blob_pack(Blob *blob)
+{
+    char packed[CONTENT_CHUNK_SIZE];
+
+    // blobs mapped from an image already live in the page cache
+    if (blob == NULL || blob->packed != 0 || blob->data != blob_inline(blob) ||
+        blob->length > sizeof(packed))
+        return blob;
+
+    // packing has to save an eighth of the bytes to be worth unpacking
+    uint64_t start = now_nanos();
+    size_t size = lz_compress(blob->data, blob->length, packed,
+                              blob->length - blob->length / 8);
+    __atomic_add_fetch(&codec.packs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&codec.packNanos, now_nanos() - start,
+                       __ATOMIC_RELAXED);
+    if (size == 0)
+        return blob;
+
+    Blob *packedBlob = blob_intern(blob->hash, blob->length, packed, size);
+    if (__atomic_load_n(&signing, __ATOMIC_RELAXED))
+        blob_sign(packedBlob, blob->data);
+    blob_release(blob);
+    return packedBlob;
+}
+
+const char *blob_bytes(Blob *blob, char *buffer)
+{
+    if (blob->packed == 0)
+        return blob->data;
+
+    uint64_t start = now_nanos();
+    long length = lz_decompress(blob->data, blob->packed, buffer,
+                                blob->length);
+    DIE(length != (long)blob->length, "lz_decompress");
+    __atomic_add_fetch(&codec.unpacks, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&codec.unpackNanos, now_nanos() - start,
+                       __ATOMIC_RELAXED);
+    return buffer;
+}
+
+const uint64_t *blob_trigrams(Blob *blob)
+{
+    char buffer[CONTENT_CHUNK_SIZE];
+    const uint64_t *trigrams = __atomic_load_n(&blob->trigrams,
+                                               __ATOMIC_ACQUIRE);
+
+    // the blobs made before the index was asked for are signed lazily
+    if (trigrams != NULL)
+        return trigrams;
+    return blob_sign(blob, blob_bytes(blob, buffer));
+}
+
+void blob_index_trigrams()
+{
+    __atomic_store_n(&signing, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t blob_digest(Blob *blob)
+{
+    // a blob mapped from an image is in no store, its hash is only worked
+    // out once something asks for it
+    if (blob->data != blob_inline(blob) && blob->hash[0] == 0 &&
+        blob->hash[1] == 0)
+        blob_hash(blob->data, blob->length, blob->hash);
+    return blob->hash[0];
+}
+
+void blob_map(Blob *blob, const char *data, size_t length)
+{
+    blob->refs = 0;
+    blob->length = length;
+    blob->packed = 0;
+    blob->data = data;
+    blob->hash[0] = blob->hash[1] = 0;
+    blob->next = NULL;
+    blob->trigrams = NULL;
+}
+
+Blob *blob_hold(Blob *blob)
+{
+    if (blob != NULL)
+        __atomic_add_fetch(&blob->refs, 1, __ATOMIC_RELAXED);
+    return blob;
+}
+
+void blob_release(Blob *blob)
+{
+    if (blob == NULL ||
+        __atomic_sub_fetch(&blob->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    free(blob->trigrams);
+    blob->trigrams = NULL;
+    // a blob mapped from an image goes away with the tree's memory
+    if (blob->data != blob_inline(blob))
+        return;
+
+    // nobody can take the blob anymore, we only have to unlink it
+    pthread_mutex_lock(&store.lock);
+    Blob **link = &store.buckets[blob->hash[0] & (store.capacity - 1)];
+    while (*link != blob)
+        link = &(*link)->next;
+    *link = blob->next;
+    store.count--;
+    store.bytes -= blob_stored(blob);
+    pthread_mutex_unlock(&store.lock);
+    free(blob);
+}
+
+void blob_stats(BlobStats *stats)
+{
+    pthread_mutex_lock(&store.lock);
+    stats->blobs = store.count;
+    stats->storedBytes = store.bytes;
+    stats->references = 0;
+    stats->referencedBytes = 0;
+    stats->packedBlobs = 0;
+    stats->packedBytes = 0;
+    stats->unpackedBytes = 0;
+    for (size_t i = 0; i < store.capacity; i++)
+    {
+        for (Blob *blob = store.buckets[i]; blob != NULL; blob = blob->next)
+        {
+            unsigned int refs = __atomic_load_n(&blob->refs,
+                                                __ATOMIC_RELAXED);
+            stats->references += refs;
+            stats->referencedBytes += (uint64_t)refs * blob->length;
+            if (blob->packed != 0)
+            {
+                stats->packedBlobs++;
+                stats->packedBytes += blob->packed;
+                stats->unpackedBytes += blob->length;
+            }
+        }
+    }
+    pthread_mutex_unlock(&store.lock);
+
+    stats->packs = __atomic_load_n(&codec.packs, __ATOMIC_RELAXED);
+    stats->packNanos = __atomic_load_n(&codec.packNanos, __ATOMIC_RELAXED);
+    stats->unpacks = __atomic_load_n(&codec.unpacks, __ATOMIC_RELAXED);
+    stats->unpackNanos = __atomic_load_n(&codec.unpackNanos,
+                                         __ATOMIC_RELAXED);
+}
@@ -0,0 +1,952 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+
+typedef struct DiffSide DiffSide;
+typedef struct DiffFrame DiffFrame;
+typedef struct DiffDigest DiffDigest;
+typedef struct DiffItem DiffItem;
+typedef struct DiffList DiffList;
+typedef struct DiffPair DiffPair;
+typedef struct DiffName DiffName;
+typedef struct DiffNames DiffNames;
+
+/*
+ * diff compares two trees, the tree and one of its snapshots, or two
+ * snapshots, and writes the commands that turn the first one into the
+ * second: run from the root of a copy of the first, they make it a copy of
+ * the second.
+ *
+ * Every folder keeps a digest of everything inside it, the sum of its
+ * children's digests, each one mixing the child's name with the digest of
+ * its content or of its own inside. A change clears the digests from its
+ * folder up to the root, stopping at the first one it finds cleared, and
+ * the next diff works out again only the ones that were cleared. Folders
+ * with the same digest hold the same, so diff never goes inside them, and
+ * it costs what changed, not what the trees hold.
+ *
+ * A snapshot sees a folder nothing changed inside of since it was taken as
+ * the tree has it, digest included. The other ones it saw change are
+ * summed from what it saved, and kept for the length of the diff.
+ *
+ * A node that left a folder and one with the same content that showed up
+ * under a new name are taken for a move, and written as a mv. Symlinks
+ * are compared by their targets. A file the commands give several names
+ * is written under the first one and linked under the others, and a file
+ * that had several is written whole again, a write would reach its other
+ * names. Contents
+ * come from command tokens and hold no spaces, the gaps writes left are
+ * the only zeros in them, and they are written again by writes that skip
+ * the gaps.
+ */
+
+// one of the trees compared, as a snapshot saw it or as it is
+struct DiffSide {
+    TreeNode* root;
+    // NULL for the tree as it is
+    Snapshot* snapshot;
+    // set if the tree was loaded from an image for the diff
+    int loaded;
+    FileTree image;
+    // the digests of the folders the snapshot saw change, by folder
+    DiffDigest* digests;
+    size_t digestCount;
+    size_t digestCapacity;
+    // the folders being summed, their children kept from one sum to the
+    // next
+    DiffFrame* frames;
+    size_t frameCapacity;
+};
+
+struct DiffFrame {
+    TreeNode* folder;
+    SnapEntry* entries;
+    size_t count;
+    size_t capacity;
+    size_t at;
+    uint64_t sum;
+};
+
+struct DiffDigest {
+    TreeNode* folder;
+    uint64_t digest;
+};
+
+// a node one side has and the other hasn't, or a file both have with
+// different contents
+struct DiffItem {
+    char* path;
+    SnapEntry entry;
+    // of its content, whatever its name
+    uint64_t digest;
+    // what the file held in the first tree
+    FileData* from;
+    // the file had other names in the first tree, a write would reach them
+    int linked;
+    // the node of the other type that had its name
+    int replaces;
+    // the node it was moved from or to, NULL if none
+    DiffItem* move;
+};
+
+struct DiffList {
+    DiffItem* items;
+    size_t count;
+    size_t capacity;
+};
+
+// two folders with the same path and different insides
+struct DiffPair {
+    TreeNode* from;
+    TreeNode* to;
+    char* path;
+};
+
+// a file with several names, and the path the commands wrote it under
+struct DiffName {
+    FileContent* content;
+    char* path;
+};
+
+// the files with several names written so far, by content, and where
+// to look for the names they keep
+struct DiffNames {
+    DiffName* slots;
+    size_t count;
+    size_t capacity;
+    DiffSide* sides;
+    SnapEntry* entries;
+    size_t entryCapacity;
+    // the names from a node up to the root
+    char** path;
+    size_t pathCapacity;
+};
+
+static uint64_t digest_mix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// FNV-1a
+static uint64_t name_digest(const char *name)
+{
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    while (*name)
+        digest = (digest ^ (unsigned char)*name++) * 0x100000001b3ULL;
+    return digest;
+}
+
+static uint64_t data_digest(FileData *data)
+{
+    // a file without content reads as an empty one
+    if (data == NULL || data->size == 0)
+        return 1;
+    if (data->digest != 0)
+        return data->digest;
+
+    // the chunks of equal contents are the same blobs, the ones mapped
+    // from an image hash the same bytes the same way
+    uint64_t digest = data->size;
+    for (size_t i = 0; i < data->count; i++)
+        digest = digest_mix(digest * 31 + blob_digest(data->chunks[i]));
+    data->digest = digest != 0 ? digest : 1;
+    return data->digest;
+}
+
+// a symlink holds its target, a file its bytes
+static uint64_t leaf_digest(const SnapEntry *entry)
+{
+    if (entry->node->type == SYMLINK_NODE)
+        return name_digest(((FileContent *)entry->node->content)->target);
+    return data_digest(entry->data);
+}
+
+static uint64_t entry_digest(const SnapEntry *entry, uint64_t content)
+{
+    return digest_mix(name_digest(entry->name) ^
+                      content * 0x9e3779b97f4a7c15ULL ^ entry->node->type);
+}
+
+void digest_touch(TreeNode *folderNode)
+{
+    uint64_t generation = snap_generation();
+
+    // a folder cleared in this generation has all its parents cleared
+    for (TreeNode *node = folderNode; node != NULL; node = node->parent)
+    {
+        FolderContent *folder = node->content;
+        if (folder->digest == 0 && folder->changed == generation)
+            break;
+        folder->digest = 0;
+        folder->changed = generation;
+    }
+}
+
+static size_t memo_slot(TreeNode *folderNode, size_t capacity)
+{
+    uintptr_t key = (uintptr_t)folderNode >> 4;
+    return (size_t)(key * 2654435761u) & (capacity - 1);
+}
+
+static void memo_add(DiffSide *side, TreeNode *folderNode, uint64_t digest)
+{
+    // under half full, so probes stay short
+    if ((side->digestCount + 1) * 2 > side->digestCapacity)
+    {
+        DiffDigest *old = side->digests;
+        size_t oldCapacity = side->digestCapacity;
+        side->digestCapacity = oldCapacity ? oldCapacity * 2 : 64;
+        side->digests = calloc(side->digestCapacity, sizeof(DiffDigest));
+        DIE(!side->digests, "calloc");
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (old[i].folder == NULL)
+                continue;
+            size_t slot = memo_slot(old[i].folder, side->digestCapacity);
+            while (side->digests[slot].folder != NULL)
+                slot = (slot + 1) & (side->digestCapacity - 1);
+            side->digests[slot] = old[i];
+        }
+        free(old);
+    }
+
+    size_t slot = memo_slot(folderNode, side->digestCapacity);
+    while (side->digests[slot].folder != NULL)
+        slot = (slot + 1) & (side->digestCapacity - 1);
+    side->digests[slot].folder = folderNode;
+    side->digests[slot].digest = digest;
+    side->digestCount++;
+}
+
+// the digest of the folder as the side sees it, 0 if not worked out yet
+static uint64_t digest_known(DiffSide *side, TreeNode *folderNode)
+{
+    if (side->snapshot == NULL || snap_unchanged(side->snapshot, folderNode))
+        return ((FolderContent *)folderNode->content)->digest;
+    if (side->digestCount == 0)
+        return 0;
+
+    size_t slot = memo_slot(folderNode, side->digestCapacity);
+    while (side->digests[slot].folder != NULL)
+    {
+        if (side->digests[slot].folder == folderNode)
+            return side->digests[slot].digest;
+        slot = (slot + 1) & (side->digestCapacity - 1);
+    }
+    return 0;
+}
+
+static void digest_keep(DiffSide *side, TreeNode *folderNode, uint64_t digest)
+{
+    if (side->snapshot == NULL || snap_unchanged(side->snapshot, folderNode))
+        ((FolderContent *)folderNode->content)->digest = digest;
+    else
+        memo_add(side, folderNode, digest);
+}
+
+static void frame_push(DiffSide *side, size_t *depth, TreeNode *folderNode)
+{
+    if (*depth == side->frameCapacity)
+    {
+        size_t capacity = side->frameCapacity ? side->frameCapacity * 2
+                                              : WALK_INLINE_DEPTH;
+        side->frames = realloc(side->frames, capacity * sizeof(DiffFrame));
+        DIE(!side->frames, "realloc");
+        memset(side->frames + side->frameCapacity, 0,
+               (capacity - side->frameCapacity) * sizeof(DiffFrame));
+        side->frameCapacity = capacity;
+    }
+
+    DiffFrame *frame = &side->frames[(*depth)++];
+    frame->folder = folderNode;
+    frame->count = snap_children(side->snapshot, folderNode, &frame->entries,
+                                 &frame->capacity);
+    frame->at = 0;
+    frame->sum = 0;
+}
+
+// sums the folders below that were cleared, deepest first
+static uint64_t side_digest(DiffSide *side, TreeNode *folderNode)
+{
+    uint64_t digest = digest_known(side, folderNode);
+    size_t depth = 0;
+
+    if (digest != 0)
+        return digest;
+    frame_push(side, &depth, folderNode);
+    while (depth > 0)
+    {
+        DiffFrame *frame = &side->frames[depth - 1];
+        if (frame->at == frame->count)
+        {
+            // an empty folder sums to something too
+            digest = digest_mix(frame->sum ^ frame->count);
+            if (digest == 0)
+                digest = 1;
+            digest_keep(side, frame->folder, digest);
+            if (--depth > 0)
+            {
+                frame = &side->frames[depth - 1];
+                frame->sum += entry_digest(&frame->entries[frame->at++],
+                                           digest);
+            }
+            continue;
+        }
+
+        SnapEntry *entry = &frame->entries[frame->at];
+        if (entry->node->type != FOLDER_NODE)
+            digest = leaf_digest(entry);
+        else if ((digest = digest_known(side, entry->node)) == 0)
+        {
+            frame_push(side, &depth, entry->node);
+            continue;
+        }
+        frame->sum += entry_digest(entry, digest);
+        frame->at++;
+    }
+    // the last folder summed is the one asked for
+    return digest;
+}
+
+static uint64_t content_digest(DiffSide *side, const SnapEntry *entry)
+{
+    if (entry->node->type != FOLDER_NODE)
+        return leaf_digest(entry);
+    return side_digest(side, entry->node);
+}
+
+static int side_open(DiffSide *side, TreeNode *root, const char *arg)
+{
+    memset(side, 0, sizeof(DiffSide));
+    side->root = root;
+
+    // @ is the tree, @name one of its snapshots, anything else an image
+    if (!strcmp(arg, NO_ARG) || !strcmp(arg, "@"))
+        return 0;
+    if (arg[0] == '@')
+    {
+        side->snapshot = snap_named(arg + 1);
+        if (side->snapshot != NULL)
+            return 0;
+        out_printf("diff: '%s': No such snapshot\n", arg + 1);
+        return -1;
+    }
+    if (loadTree(arg, &side->image) < 0)
+    {
+        out_printf("diff: cannot load '%s': %s\n", arg, strerror(errno));
+        return -1;
+    }
+    side->loaded = 1;
+    side->root = side->image.root;
+    return 0;
+}
+
+static void side_close(DiffSide *side)
+{
+    for (size_t i = 0; i < side->frameCapacity; i++)
+        free(side->frames[i].entries);
+    free(side->frames);
+    free(side->digests);
+    if (side->loaded)
+        freeTree(side->image);
+}
+
+static char *child_path(const char *path, const char *name)
+{
+    size_t length = strlen(path);
+    size_t nameLength = strlen(name);
+    char *childPath = malloc(length + nameLength + 2);
+    DIE(!childPath, "malloc");
+
+    // the root's children have their bare names
+    if (length == 0)
+    {
+        memcpy(childPath, name, nameLength + 1);
+        return childPath;
+    }
+    memcpy(childPath, path, length);
+    childPath[length] = '/';
+    memcpy(childPath + length + 1, name, nameLength + 1);
+    return childPath;
+}
+
+static DiffItem *list_add(DiffList *list, const char *path,
+                          const SnapEntry *entry, uint64_t digest)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->items = realloc(list->items, list->capacity * sizeof(DiffItem));
+        DIE(!list->items, "realloc");
+    }
+    DiffItem *item = &list->items[list->count++];
+    item->path = child_path(path, entry->name);
+    item->entry = *entry;
+    item->digest = digest;
+    item->from = NULL;
+    item->linked = 0;
+    item->replaces = 0;
+    item->move = NULL;
+    return item;
+}
+
+static void list_free(DiffList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+        free(list->items[i].path);
+    free(list->items);
+}
+
+static int entry_compare(const void *a, const void *b)
+{
+    return strcmp(((const SnapEntry *)a)->name, ((const SnapEntry *)b)->name);
+}
+
+static int item_compare(const void *a, const void *b)
+{
+    const DiffItem *first = a, *second = b;
+
+    if (first->entry.node->type != second->entry.node->type)
+        return first->entry.node->type < second->entry.node->type ? -1 : 1;
+    if (first->digest != second->digest)
+        return first->digest < second->digest ? -1 : 1;
+    return 0;
+}
+
+// the bytes of a content, in a buffer that grows to hold them
+static size_t data_read(FileData *data, char **buffer, size_t *capacity)
+{
+    char chunk[CONTENT_CHUNK_SIZE];
+    size_t size = data_size(data), offset = 0, length;
+
+    if (size > *capacity)
+    {
+        free(*buffer);
+        *capacity = size;
+        *buffer = malloc(size);
+        DIE(!*buffer, "malloc");
+    }
+    while (offset < size)
+    {
+        const char *bytes = data_bytes(data, offset, chunk, &length);
+        memcpy(*buffer + offset, bytes, length);
+        offset += length;
+    }
+    return size;
+}
+
+// the stretch of bytes without a zero that starts at start
+static size_t run_end(const char *bytes, size_t size, size_t start)
+{
+    const char *zero = memchr(bytes + start, '\0', size - start);
+    return zero != NULL ? (size_t)(zero - bytes) : size;
+}
+
+static void emit_write(const char *path, const char *bytes, size_t start,
+                       size_t end)
+{
+    out_printf("write %s %zu ", path, start);
+    out_write(bytes + start, end - start);
+    out_write("\n", 1);
+}
+
+static void emit_file(const char *path, FileData *data, char **buffer,
+                      size_t *capacity)
+{
+    size_t size = data_read(data, buffer, capacity);
+    const char *bytes = *buffer;
+    size_t start = 0;
+
+    // the first stretch comes with the file, the gaps are left to the
+    // writes after it
+    out_printf("touch %s", path);
+    if (size > 0 && bytes[0] != '\0')
+    {
+        start = run_end(bytes, size, 0);
+        out_write(" ", 1);
+        out_write(bytes, start);
+    }
+    out_write("\n", 1);
+    while (start < size)
+    {
+        if (bytes[start] == '\0')
+        {
+            start++;
+            continue;
+        }
+        size_t end = run_end(bytes, size, start);
+        emit_write(path, bytes, start, end);
+        start = end;
+    }
+}
+
+static void emit_symlink(const char *path, const SnapEntry *entry)
+{
+    out_printf("ln -s %s %s\n", ((FileContent *)entry->node->content)->target,
+               path);
+}
+
+static size_t name_slot(FileContent *content, size_t capacity)
+{
+    uintptr_t key = (uintptr_t)content >> 4;
+    return (size_t)(key * 2654435761u) & (capacity - 1);
+}
+
+// the path a file with several names was written under, NULL if none
+static const char *name_written(DiffNames *names, FileContent *content)
+{
+    if (names->count == 0)
+        return NULL;
+
+    size_t slot = name_slot(content, names->capacity);
+    while (names->slots[slot].content != NULL)
+    {
+        if (names->slots[slot].content == content)
+            return names->slots[slot].path;
+        slot = (slot + 1) & (names->capacity - 1);
+    }
+    return NULL;
+}
+
+static void name_add(DiffNames *names, FileContent *content, const char *path)
+{
+    // under half full, so probes stay short
+    if ((names->count + 1) * 2 > names->capacity)
+    {
+        DiffName *old = names->slots;
+        size_t oldCapacity = names->capacity;
+        names->capacity = oldCapacity ? oldCapacity * 2 : 64;
+        names->slots = calloc(names->capacity, sizeof(DiffName));
+        DIE(!names->slots, "calloc");
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (old[i].content == NULL)
+                continue;
+            size_t slot = name_slot(old[i].content, names->capacity);
+            while (names->slots[slot].content != NULL)
+                slot = (slot + 1) & (names->capacity - 1);
+            names->slots[slot] = old[i];
+        }
+        free(old);
+    }
+
+    size_t slot = name_slot(content, names->capacity);
+    while (names->slots[slot].content != NULL)
+        slot = (slot + 1) & (names->capacity - 1);
+    names->slots[slot].content = content;
+    names->slots[slot].path = strdup(path);
+    DIE(!names->slots[slot].path, "strdup");
+    names->count++;
+}
+
+static void names_free(DiffNames *names)
+{
+    for (size_t i = 0; i < names->capacity; i++)
+        free(names->slots[i].path);
+    free(names->slots);
+    free(names->entries);
+    free(names->path);
+}
+
+// the path a side sees a node under, NULL if it doesn't see it where the
+// tree has it now
+static char *side_path(DiffNames *names, DiffSide *side, TreeNode *treeNode)
+{
+    size_t depth = 0;
+
+    for (TreeNode *node = treeNode; node != side->root;)
+    {
+        // a node kept out of the tree for the snapshots was in a folder
+        // they may still see
+        TreeNode *parent = node->parent != NULL ? node->parent
+                                                : snap_parent(node);
+        if (parent == NULL)
+            return NULL;
+        size_t count = snap_children(side->snapshot, parent,
+                                     &names->entries, &names->entryCapacity);
+        size_t i = 0;
+        while (i < count && names->entries[i].node != node)
+            i++;
+        if (i == count)
+            return NULL;
+        if (depth == names->pathCapacity)
+        {
+            names->pathCapacity = depth ? depth * 2 : 16;
+            names->path = realloc(names->path,
+                                  names->pathCapacity * sizeof(char *));
+            DIE(!names->path, "realloc");
+        }
+        names->path[depth++] = names->entries[i].name;
+        node = parent;
+    }
+
+    char *path = strdup("");
+    DIE(!path, "strdup");
+    while (depth > 0)
+    {
+        char *childPath = child_path(path, names->path[--depth]);
+        free(path);
+        path = childPath;
+    }
+    return path;
+}
+
+// a name of the file both trees have in the same place, the commands
+// leave it alone, NULL if none; the names of a loaded tree are its own
+static char *name_kept(DiffNames *names, const SnapEntry *entry)
+{
+    DiffSide *sides = names->sides;
+
+    if (sides[0].loaded || sides[1].loaded)
+        return NULL;
+    for (TreeNode *name = entry->node->linkNext;
+         name != NULL && name != entry->node; name = name->linkNext)
+    {
+        char *path = side_path(names, &sides[1], name);
+        if (path == NULL)
+            continue;
+        char *fromPath = side_path(names, &sides[0], name);
+        int same = fromPath != NULL && !strcmp(path, fromPath);
+        free(fromPath);
+        if (same)
+            return path;
+        free(path);
+    }
+    return NULL;
+}
+
+// the path the other names of a file are linked to, NULL while it has none
+static const char *name_first(DiffNames *names, const SnapEntry *entry)
+{
+    FileContent *content = entry->node->content;
+    const char *first = name_written(names, content);
+
+    if (first != NULL)
+        return first;
+    char *kept = name_kept(names, entry);
+    if (kept == NULL)
+        return NULL;
+    name_add(names, content, kept);
+    free(kept);
+    return name_written(names, content);
+}
+
+// a further name of a file is linked to its first one, 1 if it was
+static int emit_name(DiffNames *names, const char *path,
+                     const SnapEntry *entry)
+{
+    if (!((FileContent *)entry->node->content)->linked)
+        return 0;
+    const char *first = name_first(names, entry);
+    if (first != NULL)
+    {
+        out_printf("ln %s %s\n", first, path);
+        return 1;
+    }
+    name_add(names, entry->node->content, path);
+    return 0;
+}
+
+// rewrites what changed in a file, or the whole file when a write can't
+// get it there: it got shorter, got a zero where it had something else, or
+// shares its content with other names
+static void emit_update(DiffNames *names, DiffItem *item, char **buffers,
+                        size_t *capacities)
+{
+    // the name is taken, the link goes where it was
+    FileContent *content = item->entry.node->content;
+    if (content->linked && name_first(names, &item->entry) != NULL)
+    {
+        out_printf("rm %s\n", item->path);
+        emit_name(names, item->path, &item->entry);
+        return;
+    }
+    emit_name(names, item->path, &item->entry);
+
+    size_t fromSize = data_read(item->from, &buffers[0], &capacities[0]);
+    size_t size = data_read(item->entry.data, &buffers[1], &capacities[1]);
+    const char *from = buffers[0], *bytes = buffers[1];
+    int rewrite = size < fromSize || item->linked;
+
+    for (size_t i = 0; i < fromSize && !rewrite; i++)
+        rewrite = bytes[i] == '\0' && from[i] != '\0';
+    if (rewrite)
+    {
+        out_printf("rm %s\n", item->path);
+        emit_file(item->path, item->entry.data, &buffers[1], &capacities[1]);
+        return;
+    }
+
+    size_t start = 0;
+    while (start < size)
+    {
+        if (bytes[start] == '\0')
+        {
+            start++;
+            continue;
+        }
+        size_t end = run_end(bytes, size, start);
+        size_t same = start;
+        while (same < end && same < fromSize && from[same] == bytes[same])
+            same++;
+        if (same < end)
+            emit_write(item->path, bytes, start, end);
+        start = end;
+    }
+}
+
+// makes a folder the second tree has and the first one hasn't
+static void emit_folder(DiffSide *side, DiffNames *names, DiffItem *item,
+                        char **buffers, size_t *capacities)
+{
+    size_t depth = 1, capacity = 16;
+    DiffPair *stack = malloc(capacity * sizeof(DiffPair));
+    SnapEntry *entries = NULL;
+    size_t entryCapacity = 0;
+
+    DIE(!stack, "malloc");
+    out_printf("mkdir %s\n", item->path);
+    stack[0].from = NULL;
+    stack[0].to = item->entry.node;
+    stack[0].path = strdup(item->path);
+    DIE(!stack[0].path, "strdup");
+    while (depth > 0)
+    {
+        DiffPair pair = stack[--depth];
+        size_t count = snap_children(side->snapshot, pair.to, &entries,
+                                     &entryCapacity);
+        for (size_t i = 0; i < count; i++)
+        {
+            char *path = child_path(pair.path, entries[i].name);
+            if (entries[i].node->type != FOLDER_NODE)
+            {
+                if (entries[i].node->type == SYMLINK_NODE)
+                    emit_symlink(path, &entries[i]);
+                else if (!emit_name(names, path, &entries[i]))
+                    emit_file(path, entries[i].data, &buffers[0],
+                              &capacities[0]);
+                free(path);
+                continue;
+            }
+            out_printf("mkdir %s\n", path);
+            if (depth == capacity)
+            {
+                capacity *= 2;
+                stack = realloc(stack, capacity * sizeof(DiffPair));
+                DIE(!stack, "realloc");
+            }
+            stack[depth].from = NULL;
+            stack[depth].to = entries[i].node;
+            stack[depth++].path = path;
+        }
+        free(pair.path);
+    }
+    free(stack);
+    free(entries);
+}
+
+// sorts out the children of two folders whose insides differ
+static void diff_folders(DiffSide *sides, DiffPair *pair, DiffList *lists,
+                         DiffPair **stack, size_t *depth, size_t *capacity,
+                         SnapEntry **entries, size_t *entryCapacities)
+{
+    DiffList *removed = &lists[0], *added = &lists[1], *changed = &lists[2];
+    size_t fromCount = snap_children(sides[0].snapshot, pair->from,
+                                     &entries[0], &entryCapacities[0]);
+    size_t toCount = snap_children(sides[1].snapshot, pair->to,
+                                   &entries[1], &entryCapacities[1]);
+    SnapEntry *from = entries[0], *to = entries[1];
+
+    // both sorted by name, the names they share meet
+    qsort(from, fromCount, sizeof(SnapEntry), entry_compare);
+    qsort(to, toCount, sizeof(SnapEntry), entry_compare);
+    size_t i = 0, j = 0;
+    while (i < fromCount || j < toCount)
+    {
+        int order = i == fromCount ? 1 : j == toCount ? -1 :
+                    strcmp(from[i].name, to[j].name);
+        if (order < 0)
+        {
+            list_add(removed, pair->path, &from[i],
+                     content_digest(&sides[0], &from[i]));
+            i++;
+            continue;
+        }
+        if (order > 0)
+        {
+            list_add(added, pair->path, &to[j],
+                     content_digest(&sides[1], &to[j]));
+            j++;
+            continue;
+        }
+
+        SnapEntry *old = &from[i++], *new = &to[j++];
+        uint64_t oldDigest = content_digest(&sides[0], old);
+        uint64_t newDigest = content_digest(&sides[1], new);
+        // a symlink is made again to point somewhere else
+        if (old->node->type != new->node->type ||
+            (new->node->type == SYMLINK_NODE && oldDigest != newDigest))
+        {
+            list_add(removed, pair->path, old, oldDigest);
+            list_add(added, pair->path, new, newDigest)->replaces = 1;
+        }
+        else if (oldDigest == newDigest)
+            continue;
+        else if (new->node->type == FILE_NODE)
+        {
+            DiffItem *item = list_add(changed, pair->path, new, newDigest);
+            item->from = old->data;
+            item->linked = ((FileContent *)old->node->content)->linked;
+        }
+        else
+        {
+            if (*depth == *capacity)
+            {
+                *capacity = *capacity ? *capacity * 2 : 16;
+                *stack = realloc(*stack, *capacity * sizeof(DiffPair));
+                DIE(!*stack, "realloc");
+            }
+            DiffPair *next = &(*stack)[(*depth)++];
+            next->from = old->node;
+            next->to = new->node;
+            next->path = child_path(pair->path, new->name);
+        }
+    }
+}
+
+static void match_moves(DiffList *removed, DiffList *added)
+{
+    if (removed->count > 1)
+        qsort(removed->items, removed->count, sizeof(DiffItem),
+              item_compare);
+    for (size_t i = 0; i < added->count; i++)
+    {
+        DiffItem *item = &added->items[i];
+        // a name another node still has when the moves run can't be moved to
+        if (item->replaces)
+            continue;
+
+        // the first of the nodes that left with the same content
+        size_t low = 0, high = removed->count;
+        while (low < high)
+        {
+            size_t middle = (low + high) / 2;
+            if (item_compare(&removed->items[middle], item) < 0)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        for (; low < removed->count &&
+               item_compare(&removed->items[low], item) == 0; low++)
+        {
+            if (removed->items[low].move != NULL)
+                continue;
+            removed->items[low].move = item;
+            item->move = &removed->items[low];
+            break;
+        }
+    }
+}
+
+void diffTrees(TreeNode *root, char *from, char *to)
+{
+    DiffSide sides[2];
+    DiffList lists[3];
+
+    if (!strcmp(from, NO_ARG))
+    {
+        out_puts("diff: missing operand\n");
+        return;
+    }
+    if (side_open(&sides[0], root, from) < 0)
+        return;
+    if (side_open(&sides[1], root, to) < 0)
+    {
+        side_close(&sides[0]);
+        return;
+    }
+
+    // the folders whose insides differ, from the roots down
+    memset(lists, 0, sizeof(lists));
+    DiffPair *stack = NULL;
+    size_t depth = 0, capacity = 0;
+    SnapEntry *entries[2] = {NULL, NULL};
+    size_t entryCapacities[2] = {0, 0};
+    if (side_digest(&sides[0], sides[0].root) !=
+        side_digest(&sides[1], sides[1].root))
+    {
+        DiffPair pair = {sides[0].root, sides[1].root, strdup("")};
+        DIE(!pair.path, "strdup");
+        for (;;)
+        {
+            diff_folders(sides, &pair, lists, &stack, &depth, &capacity,
+                         entries, entryCapacities);
+            free(pair.path);
+            if (depth == 0)
+                break;
+            pair = stack[--depth];
+        }
+    }
+    free(stack);
+    free(entries[0]);
+    free(entries[1]);
+
+    DiffList *removed = &lists[0], *added = &lists[1], *changed = &lists[2];
+    match_moves(removed, added);
+
+    // what goes away first, then the moves have their names free, then
+    // what changed and what is new, the new names of a file after the
+    // ones it keeps
+    char *buffers[2] = {NULL, NULL};
+    size_t capacities[2] = {0, 0};
+    DiffNames names;
+    memset(&names, 0, sizeof(names));
+    names.sides = sides;
+    for (size_t i = 0; i < removed->count; i++)
+    {
+        DiffItem *item = &removed->items[i];
+        if (item->move == NULL)
+            out_printf("%s %s\n", item->entry.node->type == FOLDER_NODE ?
+                                  "rmrec" : "rm", item->path);
+    }
+    for (size_t i = 0; i < added->count; i++)
+    {
+        DiffItem *item = &added->items[i];
+        if (item->move != NULL)
+            out_printf("mv %s %s\n", item->move->path, item->path);
+    }
+    for (size_t i = 0; i < changed->count; i++)
+        emit_update(&names, &changed->items[i], buffers, capacities);
+    for (size_t i = 0; i < added->count; i++)
+    {
+        DiffItem *item = &added->items[i];
+        if (item->move != NULL)
+            continue;
+        if (item->entry.node->type == SYMLINK_NODE)
+            emit_symlink(item->path, &item->entry);
+        else if (item->entry.node->type == FILE_NODE)
+        {
+            if (!emit_name(&names, item->path, &item->entry))
+                emit_file(item->path, item->entry.data, &buffers[0],
+                          &capacities[0]);
+        }
+        else
+            emit_folder(&sides[1], &names, item, buffers, capacities);
+    }
+
+    names_free(&names);
+    free(buffers[0]);
+    free(buffers[1]);
+    for (int i = 0; i < 3; i++)
+        list_free(&lists[i]);
+    side_close(&sides[0]);
+    side_close(&sides[1]);
+}
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "disk.h"
+
+void *disk_map(const char *path, size_t *size)
+{
+    struct stat info;
+    void *data;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &info) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    // an empty file can't be mapped
+    if (info.st_size == 0)
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the file is closed
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    *size = info.st_size;
+    return data;
+}
+
+void disk_unmap(void *data, size_t size)
+{
+    munmap(data, size);
+}
+
+int disk_sync(FILE *file)
+{
+    if (fflush(file) != 0)
+        return -1;
+    return fsync(fileno(file));
+}
+
+int disk_truncate(const char *path, long size)
+{
+    return truncate(path, size);
+}
@@ -0,0 +1,17 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/*
+ * Thin wrappers over the system calls persistence needs. They live apart
+ * from tree.h because <unistd.h> and <sys/stat.h> declare their own
+ * mkdir and rmdir.
+ */
+void* disk_map(const char* path, size_t* size);
+void disk_unmap(void* data, size_t size);
+int disk_sync(FILE* file);
+int disk_truncate(const char* path, long size);
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include "tree.h"
+
+typedef struct EpochSlot EpochSlot;
+typedef struct Retired Retired;
+
+/*
+ * Epoch based reclamation. A reader publishes the epoch it entered at in
+ * its slot for as long as it walks the tree. Writers unlink what they
+ * remove, then retire it: retiring stamps the object with the epoch and
+ * moves the epoch on, so readers entering later can't reach it anymore.
+ * An object is released once every reader still inside entered after it
+ * was retired.
+ */
+
+// every reader has a slot of its own, alone on its cache line
+struct EpochSlot {
+    // the epoch the reader entered at, 0 while it is outside
+    uint64_t epoch;
+    int claimed;
+} __attribute__((aligned(64)));
+
+struct Retired {
+    EpochRelease release;
+    void* context;
+    void* object;
+    uint64_t epoch;
+    Retired* next;
+};
+
+static EpochSlot slots[EPOCH_MAX_READERS];
+// slots ever claimed, the scans stop there
+static int slotCount;
+static uint64_t globalEpoch = 1;
+
+static pthread_mutex_t retiredLock = PTHREAD_MUTEX_INITIALIZER;
+static Retired *retired;
+static unsigned int retiredCount;
+
+// a thread gives its slot back when it exits
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+static __thread EpochSlot *self;
+static __thread int depth;
+
+static void release_slot(void *slot)
+{
+    __atomic_store_n(&((EpochSlot *)slot)->claimed, 0, __ATOMIC_RELEASE);
+}
+
+static void create_slot_key()
+{
+    errno = pthread_key_create(&slotKey, release_slot);
+    DIE(errno != 0, "pthread_key_create");
+}
+
+static EpochSlot *claim_slot()
+{
+    pthread_once(&slotKeyOnce, create_slot_key);
+    for (int i = 0; i < EPOCH_MAX_READERS; i++)
+    {
+        int expected = 0;
+        if (!__atomic_compare_exchange_n(&slots[i].claimed, &expected, 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            continue;
+
+        int count = __atomic_load_n(&slotCount, __ATOMIC_SEQ_CST);
+        while (count <= i &&
+               !__atomic_compare_exchange_n(&slotCount, &count, i + 1, 0,
+                                            __ATOMIC_SEQ_CST,
+                                            __ATOMIC_SEQ_CST))
+            ;
+        pthread_setspecific(slotKey, &slots[i]);
+        return &slots[i];
+    }
+    errno = EAGAIN;
+    DIE(1, "epoch_enter");
+    return NULL;
+}
+
+void epoch_enter()
+{
+    if (depth++ > 0)
+        return;
+    if (self == NULL)
+        self = claim_slot();
+
+    // the slot has to be visible before we read anything from the tree
+    __atomic_store_n(&self->epoch,
+                     __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST),
+                     __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit()
+{
+    if (--depth > 0)
+        return;
+    __atomic_store_n(&self->epoch, 0, __ATOMIC_RELEASE);
+}
+
+// releases what no reader can hold anymore, returns how many are left
+static unsigned int epoch_reclaim()
+{
+    // objects retired from now on are stamped with at least this epoch,
+    // so we leave them for the next time
+    uint64_t oldest = __atomic_load_n(&globalEpoch, __ATOMIC_SEQ_CST);
+    int count = __atomic_load_n(&slotCount, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t epoch = __atomic_load_n(&slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    Retired *ready = NULL;
+    pthread_mutex_lock(&retiredLock);
+    Retired **link = &retired;
+    while (*link != NULL)
+    {
+        Retired *record = *link;
+        if (record->epoch < oldest)
+        {
+            *link = record->next;
+            record->next = ready;
+            ready = record;
+            retiredCount--;
+        }
+        else
+            link = &record->next;
+    }
+    unsigned int left = retiredCount;
+    pthread_mutex_unlock(&retiredLock);
+
+    // the objects are released outside the lock, they may retire more
+    while (ready != NULL)
+    {
+        Retired *next = ready->next;
+        ready->release(ready->context, ready->object);
+        free(ready);
+        ready = next;
+    }
+    return left;
+}
+
+void epoch_retire(EpochRelease release, void *context, void *object)
+{
+    // without any reader there is nobody to wait for
+    if (__atomic_load_n(&slotCount, __ATOMIC_SEQ_CST) == 0)
+    {
+        release(context, object);
+        return;
+    }
+
+    Retired *record = malloc(sizeof(Retired));
+    DIE(!record, "malloc");
+    record->release = release;
+    record->context = context;
+    record->object = object;
+    record->epoch = __atomic_fetch_add(&globalEpoch, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&retiredLock);
+    record->next = retired;
+    retired = record;
+    int reclaim = ++retiredCount >= EPOCH_RECLAIM_BATCH;
+    pthread_mutex_unlock(&retiredLock);
+
+    if (reclaim)
+        epoch_reclaim();
+}
+
+static void release_memory(void *context, void *object)
+{
+    free(object);
+}
+
+void epoch_free(void *object)
+{
+    epoch_retire(release_memory, NULL, object);
+}
+
+void epoch_barrier()
+{
+    // the caller must not be inside an epoch itself
+    while (epoch_reclaim() != 0)
+        sched_yield();
+}
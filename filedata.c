@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "tree.h"
+
+/*
+ * A file's bytes are cut in chunks of CONTENT_CHUNK_SIZE bytes, only the
+ * last one may be shorter, so the chunk holding an offset is found with a
+ * division. Every chunk is an interned blob, and the list of chunks is
+ * shared by the files copied from each other: it is copied, without the
+ * bytes, on the first write to one of them. A write then only rebuilds the
+ * chunks it touches.
+ *
+ * Cold contents, the big ones and the ones left unused for a while, have
+ * their chunks packed (see blob_pack), and reads unpack the chunks they
+ * need on the fly. Both thresholds are off until data_tier sets them.
+ */
+
+static struct {
+    // contents of at least this many bytes are packed, 0 for none
+    size_t size;
+    // contents unused for this many commands are packed, 0 for none
+    unsigned long idle;
+    // the commands run so far
+    unsigned long clock;
+} tier;
+
+static size_t chunk_count(size_t size)
+{
+    return (size + CONTENT_CHUNK_SIZE - 1) / CONTENT_CHUNK_SIZE;
+}
+
+static FileData *data_alloc(size_t capacity)
+{
+    FileData *data = malloc(sizeof(FileData) + capacity * sizeof(Blob *));
+    DIE(!data, "malloc");
+
+    data->refs = 1;
+    data->capacity = capacity;
+    data->count = 0;
+    data->packed = 0;
+    data->used = tier.clock;
+    data->digest = 0;
+    data->size = 0;
+    return data;
+}
+
+static void pack_chunks(FileData *data, size_t first, size_t end)
+{
+    for (size_t i = first; i < end; i++)
+        data->chunks[i] = blob_pack(data->chunks[i]);
+}
+
+// makes the content the caller's own, with room for count chunks
+static FileData *data_private(FileData **slot, size_t count)
+{
+    FileData *data = *slot;
+    int owned = data != NULL && data->capacity != 0 &&
+                __atomic_load_n(&data->refs, __ATOMIC_ACQUIRE) == 1;
+
+    if (owned && data->capacity >= count)
+        return data;
+
+    size_t capacity = data != NULL && data->capacity * 2 > count ?
+                            data->capacity * 2 : count;
+    if (owned)
+    {
+        // nobody else sees it, it can just grow
+        data = realloc(data, sizeof(FileData) + capacity * sizeof(Blob *));
+        DIE(!data, "realloc");
+        data->capacity = capacity;
+        *slot = data;
+        return data;
+    }
+
+    // the copy shares the chunks, only their list is copied
+    FileData *copy = data_alloc(capacity);
+    if (data != NULL)
+    {
+        copy->size = data->size;
+        copy->count = data->count;
+        copy->packed = data->packed;
+        for (size_t i = 0; i < data->count; i++)
+            copy->chunks[i] = blob_hold(data->chunks[i]);
+        data_release(data);
+    }
+    *slot = copy;
+    return copy;
+}
+
+FileData *data_create(const char *bytes, size_t length)
+{
+    FileData *data = NULL;
+
+    data_write(&data, 0, bytes, length);
+    if (data == NULL)
+        data = data_alloc(1);
+    return data;
+}
+
+FileData *data_hold(FileData *data)
+{
+    if (data != NULL)
+        __atomic_add_fetch(&data->refs, 1, __ATOMIC_RELAXED);
+    return data;
+}
+
+void data_release(FileData *data)
+{
+    if (data == NULL ||
+        __atomic_sub_fetch(&data->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+
+    for (size_t i = 0; i < data->count; i++)
+        blob_release(data->chunks[i]);
+    // a content loaded from an image goes away with the tree's memory
+    if (data->capacity != 0)
+        free(data);
+}
+
+size_t data_size(FileData *data)
+{
+    return data != NULL ? data->size : 0;
+}
+
+const char *data_bytes(FileData *data, size_t offset, char *buffer,
+                       size_t *length)
+{
+    if (data == NULL || offset >= data->size)
+    {
+        *length = 0;
+        return NULL;
+    }
+
+    data->used = tier.clock;
+    Blob *chunk = data->chunks[offset / CONTENT_CHUNK_SIZE];
+    size_t start = offset % CONTENT_CHUNK_SIZE;
+    *length = chunk->length - start;
+    return blob_bytes(chunk, buffer) + start;
+}
+
+void data_write(FileData **slot, size_t offset, const char *bytes,
+                size_t length)
+{
+    if (length == 0)
+        return;
+
+    // writing past the end fills the gap with zeros
+    size_t oldSize = data_size(*slot);
+    size_t end = offset + length;
+    size_t size = end > oldSize ? end : oldSize;
+    FileData *data = data_private(slot, chunk_count(size));
+    size_t oldCount = data->count;
+
+    // only the chunks from the first changed byte to the last one are
+    // rebuilt, the others are left shared
+    size_t from = offset < oldSize ? offset : oldSize;
+    size_t first = from / CONTENT_CHUNK_SIZE;
+    size_t last = (end - 1) / CONTENT_CHUNK_SIZE;
+    char buffer[CONTENT_CHUNK_SIZE];
+    for (size_t i = first; i <= last; i++)
+    {
+        size_t start = i * CONTENT_CHUNK_SIZE;
+        size_t chunkLength = size - start < CONTENT_CHUNK_SIZE ?
+                             size - start : CONTENT_CHUNK_SIZE;
+
+        size_t kept = 0;
+        if (i < oldCount)
+        {
+            kept = data->chunks[i]->length;
+            const char *old = blob_bytes(data->chunks[i], buffer);
+            if (old != buffer)
+                memcpy(buffer, old, kept);
+        }
+        memset(buffer + kept, 0, chunkLength - kept);
+
+        size_t writeStart = offset > start ? offset - start : 0;
+        size_t writeEnd = end - start < chunkLength ? end - start :
+                                                      chunkLength;
+        if (writeStart < writeEnd)
+            memcpy(buffer + writeStart, bytes + (start + writeStart - offset),
+                   writeEnd - writeStart);
+
+        Blob *chunk = blob_create(buffer, chunkLength);
+        if (i < oldCount)
+            blob_release(data->chunks[i]);
+        data->chunks[i] = chunk;
+    }
+
+    data->count = chunk_count(size);
+    data->size = size;
+    data->used = tier.clock;
+    data->digest = 0;
+
+    // a big content keeps all its chunks packed, the new ones too
+    if (tier.size != 0 && size >= tier.size)
+    {
+        pack_chunks(data, data->packed ? first : 0, data->count);
+        data->packed = 1;
+    }
+    else
+        data->packed = 0;
+}
+
+void data_tier(size_t size, unsigned long idle)
+{
+    tier.size = size;
+    tier.idle = idle;
+}
+
+int data_tick()
+{
+    // with an idle threshold, a sweep every that many commands packs the
+    // contents left unused for one to two thresholds
+    tier.clock++;
+    return tier.idle != 0 && tier.clock % tier.idle == 0;
+}
+
+void data_sweep(FileData *data)
+{
+    if (data == NULL || data->packed)
+        return;
+    if ((tier.size != 0 && data->size >= tier.size) ||
+        (tier.idle != 0 && tier.clock - data->used >= tier.idle))
+    {
+        pack_chunks(data, 0, data->count);
+        data->packed = 1;
+    }
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "tree.h"
+
+typedef struct GrepQuery GrepQuery;
+typedef struct GrepWork GrepWork;
+
+/*
+ * grep reads every file under a folder, the folders are handed out to a
+ * work stealing pool (see work.c) when the subtree is big enough, and
+ * each thread collects the lines it matched on its own.
+ *
+ * With the trigram index, every chunk carries a signature of the 3 byte
+ * sequences it holds (one bit per hashed trigram, see blob_trigrams). A
+ * match inside a chunk sets all the bits of the pattern's trigrams, and a
+ * match across two chunks is found in the few bytes around their border,
+ * so a file whose chunks fail both is skipped without reading it. The
+ * chunks are interned and never change, a signature is made once for all
+ * the files sharing it, and a write only signs the chunks it makes.
+ */
+
+struct GrepQuery {
+    const char* pattern;
+    size_t length;
+    // the signature bits of the pattern's trigrams, NULL without the index
+    unsigned int* bits;
+    size_t bitCount;
+};
+
+struct GrepWork {
+    const GrepQuery* query;
+    // the bytes of the file being scanned
+    char* buffer;
+    size_t capacity;
+    GrepMatch* matches;
+    size_t count;
+    size_t matchCapacity;
+};
+
+static unsigned int trigram_bit(const unsigned char *bytes)
+{
+    uint32_t trigram = bytes[0] | bytes[1] << 8 | (uint32_t)bytes[2] << 16;
+    return (trigram * 2654435761u) >> 20 & (TRIGRAM_SIGNATURE_BITS - 1);
+}
+
+void trigram_sign(const char *bytes, size_t length, uint64_t *signature)
+{
+    const unsigned char *in = (const unsigned char *)bytes;
+
+    memset(signature, 0, TRIGRAM_SIGNATURE_BITS / 8);
+    for (size_t i = 0; i + 3 <= length; i++)
+    {
+        unsigned int bit = trigram_bit(in + i);
+        signature[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+const char *scan_find(const char *haystack, size_t length, const char *needle,
+                      size_t needleLength)
+{
+    if (needleLength == 0)
+        return haystack;
+    if (needleLength > length)
+        return NULL;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    // 16 positions at a time, the ones starting with the needle's first
+    // byte and ending with its last one are compared in full
+    __m128i first = _mm_set1_epi8(needle[0]);
+    __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+    for (; i + needleLength - 1 + 16 <= length; i += 16)
+    {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i blockLast = _mm_loadu_si128(
+            (const __m128i *)(haystack + i + needleLength - 1));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst),
+                          _mm_cmpeq_epi8(last, blockLast)));
+        while (mask != 0)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            if (memcmp(haystack + at + 1, needle + 1, needleLength - 1) == 0)
+                return haystack + at;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // what is left, or everything without SSE2
+    while (i + needleLength <= length)
+    {
+        const char *at = memchr(haystack + i, needle[0],
+                                length - needleLength + 1 - i);
+        if (at == NULL)
+            return NULL;
+        if (memcmp(at + 1, needle + 1, needleLength - 1) == 0)
+            return at;
+        i = at - haystack + 1;
+    }
+    return NULL;
+}
+
+// whether all the pattern's bits are set in the signature
+static int signature_holds(const GrepQuery *query, const uint64_t *signature)
+{
+    for (size_t i = 0; i < query->bitCount; i++)
+    {
+        unsigned int bit = query->bits[i];
+        if (!(signature[bit / 64] & (uint64_t)1 << (bit % 64)))
+            return 0;
+    }
+    return 1;
+}
+
+// whether the trigram index leaves a chance of a match in the content
+static int may_match(GrepWork *work, FileData *data)
+{
+    const GrepQuery *query = work->query;
+    char chunk[CONTENT_CHUNK_SIZE];
+
+    for (size_t i = 0; i < data->count; i++)
+    {
+        if (signature_holds(query, blob_trigrams(data->chunks[i])))
+            return 1;
+    }
+
+    // the pattern may also start in a chunk and end in the next one, it
+    // is then in the last and first length - 1 bytes of the two
+    size_t border = query->length - 1;
+    char *window = work->buffer;
+    for (size_t i = 0; i + 1 < data->count; i++)
+    {
+        Blob *before = data->chunks[i];
+        Blob *after = data->chunks[i + 1];
+        size_t head = after->length < border ? after->length : border;
+        memcpy(window, blob_bytes(before, chunk) + before->length - border,
+               border);
+        memcpy(window + border, blob_bytes(after, chunk), head);
+        if (scan_find(window, border + head, query->pattern,
+                      query->length) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+// copies the file's bytes in the work's buffer
+static void read_file(GrepWork *work, FileData *data)
+{
+    char chunk[CONTENT_CHUNK_SIZE];
+
+    if (data->size > work->capacity)
+    {
+        free(work->buffer);
+        work->capacity = data->size;
+        work->buffer = malloc(work->capacity);
+        DIE(!work->buffer, "malloc");
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < data->count; i++)
+    {
+        Blob *blob = data->chunks[i];
+        memcpy(work->buffer + offset, blob_bytes(blob, chunk), blob->length);
+        offset += blob->length;
+    }
+}
+
+static void grep_file(GrepWork *work, TreeNode *fileNode)
+{
+    const GrepQuery *query = work->query;
+    FileData *data = ((FileContent *)fileNode->content)->data;
+
+    if (data == NULL || data->size < query->length)
+        return;
+    if (query->bits != NULL && !may_match(work, data))
+        return;
+
+    read_file(work, data);
+    char *lines = NULL;
+    size_t length = 0, capacity = 0;
+    const char *end = work->buffer + data->size;
+    const char *line = work->buffer;
+    const char *at;
+    while (line < end &&
+           (at = scan_find(line, end - line, query->pattern,
+                           query->length)) != NULL)
+    {
+        // the line holding the match, once even if it matches again
+        const char *start = at;
+        while (start > line && start[-1] != '\n')
+            start--;
+        const char *stop = memchr(at, '\n', end - at);
+        if (stop == NULL)
+            stop = end;
+
+        size_t size = stop - start;
+        if (length + size + 1 > capacity)
+        {
+            capacity = (length + size + 1) * 2;
+            lines = realloc(lines, capacity);
+            DIE(!lines, "realloc");
+        }
+        memcpy(lines + length, start, size);
+        length += size;
+        lines[length++] = '\n';
+        if (stop == end)
+            break;
+        line = stop + 1;
+    }
+    if (lines == NULL)
+        return;
+
+    if (work->count == work->matchCapacity)
+    {
+        work->matchCapacity = work->matchCapacity ? work->matchCapacity * 2
+                                                  : 16;
+        work->matches = realloc(work->matches,
+                                work->matchCapacity * sizeof(GrepMatch));
+        DIE(!work->matches, "realloc");
+    }
+    GrepMatch *match = &work->matches[work->count++];
+    match->file = fileNode;
+    match->lines = lines;
+    match->length = length;
+}
+
+// greps the files of a folder, its folders become new pieces of work
+static void grep_task(Worker *worker, void *context, void *arg)
+{
+    GrepWork *work = context;
+    TreeNode *folderNode = arg;
+
+    for (TreeNode *child = ((FolderContent *)folderNode->content)->head;
+         child != NULL; child = child->next)
+    {
+        if (child->type == FOLDER_NODE)
+            work_push(worker, child);
+        else
+            grep_file(work, child);
+    }
+}
+
+size_t grep_search(TreeNode *start, const char *pattern, int indexed,
+                   GrepMatch **matches)
+{
+    GrepQuery query;
+    query.pattern = pattern;
+    query.length = strlen(pattern);
+    query.bits = NULL;
+    query.bitCount = 0;
+
+    // shorter patterns have no trigram, longer ones may span many chunks
+    if (indexed)
+        blob_index_trigrams();
+    if (indexed && query.length >= 3 && query.length <= CONTENT_CHUNK_SIZE)
+    {
+        query.bitCount = query.length - 2;
+        query.bits = malloc(query.bitCount * sizeof(unsigned int));
+        DIE(!query.bits, "malloc");
+        for (size_t i = 0; i < query.bitCount; i++)
+            query.bits[i] = trigram_bit((const unsigned char *)pattern + i);
+    }
+
+    // threads are only worth it for many nodes or many bytes
+    TreeStats stats;
+    node_stats(start, &stats);
+    int threads = subtree_threads(start);
+    if (threads == 1 && stats.bytes >= GREP_PARALLEL_BYTES && stats.files > 1)
+        threads = work_threads();
+
+    GrepWork works[WORK_MAX_THREADS];
+    void *contexts[WORK_MAX_THREADS];
+    for (int i = 0; i < threads; i++)
+    {
+        works[i].query = &query;
+        // the border of two chunks is checked in the buffer too
+        works[i].capacity = 2 * CONTENT_CHUNK_SIZE;
+        works[i].buffer = malloc(works[i].capacity);
+        DIE(!works[i].buffer, "malloc");
+        works[i].matches = NULL;
+        works[i].count = 0;
+        works[i].matchCapacity = 0;
+        contexts[i] = &works[i];
+    }
+
+    if (start->type != FOLDER_NODE)
+        grep_file(&works[0], start);
+    else
+        work_run(grep_task, start, contexts, threads);
+
+    // the threads' matches are put together
+    size_t count = 0;
+    for (int i = 0; i < threads; i++)
+        count += works[i].count;
+    *matches = malloc((count ? count : 1) * sizeof(GrepMatch));
+    DIE(!*matches, "malloc");
+    count = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        if (works[i].count != 0)
+            memcpy(*matches + count, works[i].matches,
+                   works[i].count * sizeof(GrepMatch));
+        count += works[i].count;
+        free(works[i].matches);
+        free(works[i].buffer);
+    }
+    free(query.bits);
+    return count;
+}
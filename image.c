@@ -0,0 +1,674 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+#include "disk.h"
+
+#define IMAGE_MAGIC "SDFSIMG1"
+#define IMAGE_VERSION 7
+#define IMAGE_NO_DATA UINT32_MAX
+#define IMAGE_LINK 0x100
+#define IMAGE_TMP_SUFFIX ".tmp"
+
+typedef struct ImageHeader ImageHeader;
+typedef struct ImageNode ImageNode;
+typedef struct ImageData ImageData;
+typedef struct ImageBlob ImageBlob;
+typedef struct AddressMap AddressMap;
+typedef struct ImageWriter ImageWriter;
+
+/*
+ * An image is the header, followed by the node, data, blob and chunk
+ * tables, the name pool and the text region. Every reference inside it is
+ * an offset or an index, so it can be used straight from a read only
+ * mapping. Names are stored NUL terminated, the text region holds the
+ * blobs' bytes back to back.
+ */
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t nodesOffset;
+    uint64_t dataOffset;
+    uint64_t dataCount;
+    uint64_t blobsOffset;
+    uint64_t blobCount;
+    uint64_t chunksOffset;
+    uint64_t chunkCount;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+    uint64_t textsOffset;
+    uint64_t textsSize;
+    uint64_t sequence;
+};
+
+/*
+ * Nodes are stored in preorder, so a node always comes after its parent,
+ * and the children of a folder are stored last to first.
+ */
+struct ImageNode {
+    uint32_t parent;
+    // with IMAGE_LINK for a file's other names
+    uint16_t type;
+    // the type and permission bits, and the times, as the inode table
+    // has them
+    uint16_t mode;
+    uint32_t name;
+    // the file's data, IMAGE_NO_DATA for a file without content, the
+    // node of the file's first name for its other names, and the target's
+    // offset in the name pool for a symlink
+    uint32_t data;
+    int64_t mtime;
+    int64_t ctime;
+};
+
+/*
+ * A file's content: its size and its chunks, listed in the chunk table
+ * as blob indexes. Files sharing a content share its entry, and contents
+ * sharing a chunk share its blob, so every chunk is stored once.
+ */
+struct ImageData {
+    uint64_t size;
+    uint64_t chunks;
+    uint64_t count;
+};
+
+struct ImageBlob {
+    uint64_t text;
+    uint64_t length;
+};
+
+// shared object (a name, a content, a blob) -> where the image keeps it
+struct AddressMap {
+    const void** keys;
+    uint32_t* values;
+    uint32_t capacity;
+    uint32_t count;
+};
+
+struct ImageWriter {
+    ImageNode* nodes;
+    uint32_t nodeCount;
+    uint32_t nodeCapacity;
+    ImageData* data;
+    uint32_t dataCount;
+    uint32_t dataCapacity;
+    ImageBlob* blobs;
+    // the blobs to write, in blob table order
+    Blob** texts;
+    uint32_t blobCount;
+    uint32_t blobCapacity;
+    uint32_t* chunks;
+    uint64_t chunkCount;
+    uint64_t chunkCapacity;
+    uint64_t textsSize;
+    char* names;
+    uint64_t namesSize;
+    uint64_t namesCapacity;
+    uint64_t sequence;
+    // name -> its offset in the name pool
+    AddressMap nameMap;
+    // file data -> its index in the data table
+    AddressMap dataMap;
+    // blob -> its index in the blob table
+    AddressMap blobMap;
+    // file with several names -> the node of the first one
+    AddressMap linkMap;
+    InodeTable* inodes;
+};
+
+static void *grow(void *array, uint64_t *capacity, size_t itemSize)
+{
+    *capacity = *capacity ? *capacity * 2 : 1024;
+    array = realloc(array, *capacity * itemSize);
+    DIE(!array, "realloc");
+    return array;
+}
+
+static uint32_t map_slot(AddressMap *map, const void *key)
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t i = (uint32_t)(((uintptr_t)key >> 3) * 2654435761u) & mask;
+
+    while (map->keys[i] != NULL && map->keys[i] != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void map_grow(AddressMap *map)
+{
+    const void **keys = map->keys;
+    uint32_t *values = map->values;
+    uint32_t capacity = map->capacity;
+
+    map->capacity = capacity ? capacity * 2 : 1024;
+    map->keys = calloc(map->capacity, sizeof(void *));
+    map->values = malloc(map->capacity * sizeof(uint32_t));
+    DIE(!map->keys || !map->values, "malloc");
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        if (keys[i] == NULL)
+            continue;
+        uint32_t slot = map_slot(map, keys[i]);
+        map->keys[slot] = keys[i];
+        map->values[slot] = values[i];
+    }
+    free(keys);
+    free(values);
+}
+
+// returns the key's value, added tells if the key is new and needs one
+static uint32_t *map_put(AddressMap *map, const void *key, int *added)
+{
+    if ((map->count + 1) * 2 > map->capacity)
+        map_grow(map);
+
+    uint32_t slot = map_slot(map, key);
+    *added = map->keys[slot] == NULL;
+    if (*added)
+    {
+        map->keys[slot] = key;
+        map->count++;
+    }
+    return &map->values[slot];
+}
+
+static uint32_t add_name(ImageWriter *writer, const char *name)
+{
+    // names are interned, so we key them by their address and every
+    // name is stored once in the pool
+    int added;
+    uint32_t *offset = map_put(&writer->nameMap, name, &added);
+    if (!added)
+        return *offset;
+
+    size_t len = strlen(name) + 1;
+    while (writer->namesSize + len > writer->namesCapacity)
+        writer->names = grow(writer->names, &writer->namesCapacity, 1);
+    memcpy(writer->names + writer->namesSize, name, len);
+
+    *offset = (uint32_t)writer->namesSize;
+    writer->namesSize += len;
+    return *offset;
+}
+
+static uint32_t add_blob(ImageWriter *writer, Blob *blob)
+{
+    // identical contents share a blob, so they are written once
+    int added;
+    uint32_t *index = map_put(&writer->blobMap, blob, &added);
+    if (!added)
+        return *index;
+
+    if (writer->blobCount == writer->blobCapacity)
+    {
+        uint64_t capacity = writer->blobCapacity;
+        writer->blobs = grow(writer->blobs, &capacity, sizeof(ImageBlob));
+        writer->texts = realloc(writer->texts, capacity * sizeof(Blob *));
+        DIE(!writer->texts, "realloc");
+        writer->blobCapacity = (uint32_t)capacity;
+    }
+
+    *index = writer->blobCount++;
+    writer->blobs[*index].text = writer->textsSize;
+    writer->blobs[*index].length = blob->length;
+    writer->texts[*index] = blob;
+    writer->textsSize += blob->length;
+    return *index;
+}
+
+static uint32_t add_data(ImageWriter *writer, FileData *data)
+{
+    int added;
+    uint32_t *index = map_put(&writer->dataMap, data, &added);
+    if (!added)
+        return *index;
+
+    if (writer->dataCount == writer->dataCapacity)
+    {
+        uint64_t capacity = writer->dataCapacity;
+        writer->data = grow(writer->data, &capacity, sizeof(ImageData));
+        writer->dataCapacity = (uint32_t)capacity;
+    }
+    *index = writer->dataCount++;
+    writer->data[*index].size = data->size;
+    writer->data[*index].chunks = writer->chunkCount;
+    writer->data[*index].count = data->count;
+
+    for (size_t i = 0; i < data->count; i++)
+    {
+        if (writer->chunkCount == writer->chunkCapacity)
+            writer->chunks = grow(writer->chunks, &writer->chunkCapacity,
+                                  sizeof(uint32_t));
+        writer->chunks[writer->chunkCount++] = add_blob(writer,
+                                                        data->chunks[i]);
+    }
+    return *index;
+}
+
+static void add_node(ImageWriter *writer, TreeNode *treeNode, uint32_t parent)
+{
+    if (writer->nodeCount == writer->nodeCapacity)
+    {
+        uint64_t capacity = writer->nodeCapacity;
+        writer->nodes = grow(writer->nodes, &capacity, sizeof(ImageNode));
+        writer->nodeCapacity = (uint32_t)capacity;
+    }
+
+    uint32_t index = writer->nodeCount++;
+    ImageNode *node = &writer->nodes[index];
+    uint32_t ino = node_ino(treeNode);
+    node->parent = parent;
+    node->type = (uint16_t)treeNode->type;
+    node->mode = writer->inodes->mode[ino];
+    node->name = add_name(writer, treeNode->name);
+    node->data = IMAGE_NO_DATA;
+    node->mtime = writer->inodes->mtime[ino];
+    node->ctime = writer->inodes->ctime[ino];
+
+    if (treeNode->type == SYMLINK_NODE)
+    {
+        node->data = add_name(writer,
+                              ((FileContent *)treeNode->content)->target);
+        return;
+    }
+    if (treeNode->type == FILE_NODE)
+    {
+        FileContent *file = treeNode->content;
+        if (treeNode->linkNext != NULL)
+        {
+            int added;
+            uint32_t *first = map_put(&writer->linkMap, file, &added);
+            if (!added)
+            {
+                node->type |= IMAGE_LINK;
+                node->data = *first;
+                return;
+            }
+            *first = index;
+        }
+        if (file->data != NULL)
+            node->data = add_data(writer, file->data);
+        return;
+    }
+
+    // the children are stored last to first, so that prepending them
+    // on load gives back the same order
+    TreeNode *child = ((FolderContent *)treeNode->content)->head;
+    while (child != NULL && child->next != NULL)
+        child = child->next;
+    while (child != NULL)
+    {
+        add_node(writer, child, index);
+        child = child->prev;
+    }
+}
+
+static uint64_t align8(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// an empty table was never allocated
+static int write_table(FILE *file, const void *table, size_t itemSize,
+                       uint64_t count)
+{
+    if (count == 0)
+        return 0;
+    return fwrite(table, itemSize, count, file) == count ? 0 : -1;
+}
+
+static int write_image(FILE *file, ImageWriter *writer)
+{
+    static const char padding[8];
+    ImageHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.nodeCount = writer->nodeCount;
+    header.nodesOffset = align8(sizeof(header));
+    header.dataOffset = header.nodesOffset +
+                        (uint64_t)writer->nodeCount * sizeof(ImageNode);
+    header.dataCount = writer->dataCount;
+    header.blobsOffset = header.dataOffset +
+                         (uint64_t)writer->dataCount * sizeof(ImageData);
+    header.blobCount = writer->blobCount;
+    header.chunksOffset = header.blobsOffset +
+                          (uint64_t)writer->blobCount * sizeof(ImageBlob);
+    header.chunkCount = writer->chunkCount;
+    header.namesOffset = header.chunksOffset +
+                         writer->chunkCount * sizeof(uint32_t);
+    header.namesSize = writer->namesSize;
+    header.textsOffset = header.namesOffset + header.namesSize;
+    header.textsSize = writer->textsSize;
+    header.sequence = writer->sequence;
+
+    if (fwrite(&header, sizeof(header), 1, file) != 1)
+        return -1;
+    if (fwrite(padding, 1, header.nodesOffset - sizeof(header), file) !=
+        header.nodesOffset - sizeof(header))
+        return -1;
+    if (write_table(file, writer->nodes, sizeof(ImageNode),
+                    writer->nodeCount) < 0 ||
+        write_table(file, writer->data, sizeof(ImageData),
+                    writer->dataCount) < 0 ||
+        write_table(file, writer->blobs, sizeof(ImageBlob),
+                    writer->blobCount) < 0 ||
+        write_table(file, writer->chunks, sizeof(uint32_t),
+                    writer->chunkCount) < 0)
+        return -1;
+    if (fwrite(writer->names, 1, writer->namesSize, file) != writer->namesSize)
+        return -1;
+    // the image keeps the bytes plain, packed blobs are unpacked
+    char buffer[CONTENT_CHUNK_SIZE];
+    for (uint32_t i = 0; i < writer->blobCount; i++)
+    {
+        size_t len = writer->texts[i]->length;
+        if (fwrite(blob_bytes(writer->texts[i], buffer), 1, len, file) != len)
+            return -1;
+    }
+    return 0;
+}
+
+int saveTree(FileTree fileTree, const char *path)
+{
+    ImageWriter writer;
+    int result = -1;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.sequence = fileTree.sequence;
+    writer.inodes = &fileTree.mem->inodes;
+    add_node(&writer, fileTree.root, 0);
+
+    // we write a temporary file, then we move it over the image, so the
+    // old image stays whole until the new one is
+    char *tmpPath = malloc(strlen(path) + sizeof(IMAGE_TMP_SUFFIX));
+    DIE(!tmpPath, "malloc");
+    sprintf(tmpPath, "%s%s", path, IMAGE_TMP_SUFFIX);
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file != NULL)
+    {
+        result = write_image(file, &writer);
+        if (result == 0)
+            result = disk_sync(file);
+        if (fclose(file) != 0)
+            result = -1;
+        if (result == 0)
+            result = rename(tmpPath, path);
+        if (result != 0)
+        {
+            int error = errno;
+            remove(tmpPath);
+            errno = error;
+        }
+    }
+
+    free(tmpPath);
+    free(writer.nodes);
+    free(writer.data);
+    free(writer.blobs);
+    free(writer.texts);
+    free(writer.chunks);
+    free(writer.names);
+    free(writer.nameMap.keys);
+    free(writer.nameMap.values);
+    free(writer.dataMap.keys);
+    free(writer.dataMap.values);
+    free(writer.blobMap.keys);
+    free(writer.blobMap.values);
+    free(writer.linkMap.keys);
+    free(writer.linkMap.values);
+    return result;
+}
+
+static int image_valid(const char *image, size_t size)
+{
+    const ImageHeader *header = (const ImageHeader *)image;
+
+    if (size < sizeof(ImageHeader) ||
+        memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != IMAGE_VERSION || header->nodeCount == 0)
+        return 0;
+
+    // every region has to be inside the file
+    if (header->nodesOffset % 8 != 0 || header->nodesOffset > size ||
+        (size - header->nodesOffset) / sizeof(ImageNode) < header->nodeCount)
+        return 0;
+    if (header->dataOffset % 8 != 0 || header->dataOffset > size ||
+        header->dataCount >= IMAGE_NO_DATA ||
+        (size - header->dataOffset) / sizeof(ImageData) < header->dataCount)
+        return 0;
+    if (header->blobsOffset % 8 != 0 || header->blobsOffset > size ||
+        header->blobCount >= UINT32_MAX ||
+        (size - header->blobsOffset) / sizeof(ImageBlob) < header->blobCount)
+        return 0;
+    if (header->chunksOffset % 4 != 0 || header->chunksOffset > size ||
+        (size - header->chunksOffset) / sizeof(uint32_t) < header->chunkCount)
+        return 0;
+    if (header->namesOffset > size || header->namesSize == 0 ||
+        header->namesSize > size - header->namesOffset ||
+        image[header->namesOffset + header->namesSize - 1] != '\0')
+        return 0;
+    if (header->textsOffset > size ||
+        header->textsSize > size - header->textsOffset)
+        return 0;
+
+    // every blob has to point inside the text region
+    const ImageBlob *blobs = (const ImageBlob *)(image + header->blobsOffset);
+    for (uint64_t i = 0; i < header->blobCount; i++)
+    {
+        if (blobs[i].text > header->textsSize ||
+            blobs[i].length > header->textsSize - blobs[i].text)
+            return 0;
+    }
+
+    // every chunk to a blob, and every content to chunks that add up to
+    // its size, all full but the last one
+    const uint32_t *chunks = (const uint32_t *)(image + header->chunksOffset);
+    for (uint64_t i = 0; i < header->chunkCount; i++)
+    {
+        if (chunks[i] >= header->blobCount)
+            return 0;
+    }
+    const ImageData *data = (const ImageData *)(image + header->dataOffset);
+    for (uint64_t i = 0; i < header->dataCount; i++)
+    {
+        if (data[i].size > FILE_MAX_SIZE ||
+            data[i].chunks > header->chunkCount ||
+            data[i].count > header->chunkCount - data[i].chunks ||
+            data[i].count != (data[i].size + CONTENT_CHUNK_SIZE - 1) /
+                             CONTENT_CHUNK_SIZE)
+            return 0;
+        for (uint64_t j = 0; j < data[i].count; j++)
+        {
+            uint64_t length = blobs[chunks[data[i].chunks + j]].length;
+            uint64_t expected = j + 1 < data[i].count ? CONTENT_CHUNK_SIZE :
+                                data[i].size - j * CONTENT_CHUNK_SIZE;
+            if (length != expected)
+                return 0;
+        }
+    }
+
+    // and every node inside the other regions, to a folder parent
+    static const uint16_t modeTypes[] = {MODE_FILE, MODE_FOLDER,
+                                         MODE_SYMLINK};
+    const ImageNode *nodes = (const ImageNode *)(image + header->nodesOffset);
+    for (uint32_t i = 0; i < header->nodeCount; i++)
+    {
+        if (nodes[i].type != FILE_NODE && nodes[i].type != FOLDER_NODE &&
+            nodes[i].type != SYMLINK_NODE &&
+            nodes[i].type != (FILE_NODE | IMAGE_LINK))
+            return 0;
+        // the type bits say what the node is, and the times are never
+        // before the epoch
+        if ((nodes[i].mode & ~MODE_PERMISSIONS) !=
+            modeTypes[nodes[i].type & ~IMAGE_LINK] ||
+            nodes[i].mtime < 0 || nodes[i].ctime < 0)
+            return 0;
+        if (nodes[i].name >= header->namesSize)
+            return 0;
+        // a file's other names follow its first one
+        if (nodes[i].type == (FILE_NODE | IMAGE_LINK) &&
+            (nodes[i].data >= i || nodes[nodes[i].data].type != FILE_NODE))
+            return 0;
+        if (nodes[i].type == SYMLINK_NODE &&
+            nodes[i].data >= header->namesSize)
+            return 0;
+        if (nodes[i].data != IMAGE_NO_DATA &&
+            ((nodes[i].type == FILE_NODE &&
+              nodes[i].data >= header->dataCount) ||
+             nodes[i].type == FOLDER_NODE))
+            return 0;
+        if (i == 0 && nodes[i].type != FOLDER_NODE)
+            return 0;
+        if (i != 0 && (nodes[i].parent >= i ||
+                       nodes[nodes[i].parent].type != FOLDER_NODE))
+            return 0;
+    }
+    return 1;
+}
+
+int loadTree(const char *path, FileTree *fileTree)
+{
+    size_t size;
+    char *image = disk_map(path, &size);
+    if (image == NULL)
+        return -1;
+    if (!image_valid(image, size))
+    {
+        disk_unmap(image, size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    const ImageHeader *header = (const ImageHeader *)image;
+    const ImageNode *nodes = (const ImageNode *)(image + header->nodesOffset);
+    const ImageData *imageData = (const ImageData *)(image +
+                                                     header->dataOffset);
+    const ImageBlob *imageBlobs = (const ImageBlob *)(image +
+                                                      header->blobsOffset);
+    const uint32_t *chunks = (const uint32_t *)(image + header->chunksOffset);
+    char *names = image + header->namesOffset;
+    char *texts = image + header->textsOffset;
+    uint32_t folderCount = 0, fileCount = 0;
+    for (uint32_t i = 0; i < header->nodeCount; i++)
+    {
+        folderCount += nodes[i].type == FOLDER_NODE;
+        fileCount += nodes[i].type == FILE_NODE ||
+                     nodes[i].type == SYMLINK_NODE;
+    }
+
+    // the tree keeps the image mapped, names and texts are used in place
+    TreeMem *mem = mem_create();
+    mem_add_mapping(mem, image, size);
+
+    // all the nodes and their contents come in five allocations
+    char *treeNodes = pool_alloc_many(&mem->nodes, header->nodeCount);
+    char *folders = pool_alloc_many(&mem->folders, folderCount);
+    char *files = pool_alloc_many(&mem->files, fileCount);
+    Blob *blobs = mem_alloc_bulk(mem, header->blobCount * sizeof(Blob));
+    char *data = mem_alloc_bulk(mem, header->dataCount * sizeof(FileData) +
+                                     header->chunkCount * sizeof(Blob *));
+
+    // the blobs point at their texts inside the mapping, they are left
+    // out of the blob store
+    for (uint64_t i = 0; i < header->blobCount; i++)
+        blob_map(&blobs[i], texts + imageBlobs[i].text, imageBlobs[i].length);
+
+    // the contents are never resized, a write copies them first
+    FileData **contents = malloc(header->dataCount * sizeof(FileData *) + 1);
+    DIE(!contents, "malloc");
+    for (uint64_t i = 0; i < header->dataCount; i++)
+    {
+        FileData *fileData = (FileData *)data;
+        fileData->refs = 0;
+        fileData->capacity = 0;
+        fileData->count = (size_t)imageData[i].count;
+        fileData->packed = 0;
+        fileData->size = imageData[i].size;
+        fileData->used = 0;
+        fileData->digest = 0;
+        for (uint64_t j = 0; j < imageData[i].count; j++)
+            fileData->chunks[j] = blob_hold(&blobs[chunks[imageData[i].chunks +
+                                                          j]]);
+        contents[i] = fileData;
+        data += sizeof(FileData) + imageData[i].count * sizeof(Blob *);
+    }
+
+    for (uint32_t i = 0; i < header->nodeCount; i++)
+    {
+        TreeNode *treeNode = (TreeNode *)(treeNodes +
+                                          i * mem->nodes.objectSize);
+        treeNode->name = names + nodes[i].name;
+        treeNode->type = nodes[i].type & ~IMAGE_LINK;
+        treeNode->next = treeNode->prev = NULL;
+        treeNode->linkNext = NULL;
+        index_add(mem, treeNode);
+
+        if (treeNode->type == FOLDER_NODE)
+        {
+            treeNode->content = folders;
+            folders += mem->folders.objectSize;
+            folder_init(treeNode->content, mem, treeNode);
+        }
+        else if (nodes[i].type & IMAGE_LINK)
+            link_add(mem, treeNode,
+                     (TreeNode *)(treeNodes +
+                                  nodes[i].data * mem->nodes.objectSize));
+        else
+        {
+            FileContent *fileContent = (FileContent *)files;
+            files += mem->files.objectSize;
+            if (treeNode->type == SYMLINK_NODE)
+                file_init(mem, treeNode, fileContent, NULL,
+                          names + nodes[i].data);
+            else
+                file_init(mem, treeNode, fileContent,
+                          nodes[i].data != IMAGE_NO_DATA ?
+                          data_hold(contents[nodes[i].data]) : NULL,
+                          NULL);
+        }
+        // a file's other names have nothing to add
+        if (!(nodes[i].type & IMAGE_LINK))
+        {
+            uint32_t ino = node_ino(treeNode);
+            mem->inodes.mode[ino] = nodes[i].mode;
+            mem->inodes.mtime[ino] = nodes[i].mtime;
+            mem->inodes.ctime[ino] = nodes[i].ctime;
+        }
+
+        if (i == 0)
+        {
+            treeNode->parent = NULL;
+            continue;
+        }
+        treeNode->parent = (TreeNode *)(treeNodes + nodes[i].parent *
+                                                    mem->nodes.objectSize);
+        folder_link(treeNode->parent->content, treeNode);
+    }
+    free(contents);
+
+    // children come after their parents, so going backwards every node is
+    // complete by the time it is added to its parent
+    for (uint32_t i = header->nodeCount - 1; i > 0; i--)
+    {
+        TreeNode *treeNode = (TreeNode *)(treeNodes +
+                                          i * mem->nodes.objectSize);
+        TreeStats stats;
+        node_stats(treeNode, &stats);
+        TreeStats *parentStats =
+            &((FolderContent *)treeNode->parent->content)->stats;
+        parentStats->files += stats.files;
+        parentStats->folders += stats.folders;
+        parentStats->bytes += stats.bytes;
+    }
+
+    fileTree->root = (TreeNode *)treeNodes;
+    fileTree->mem = mem;
+    fileTree->sequence = header->sequence;
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <errno.h>
+#include "tree.h"
+
+/*
+ * The name index of a tree: a radix tree over the names its nodes have,
+ * each name listing the nodes that have it. It is only built the first
+ * time a tree is searched, from then on the commands that create, rename
+ * or free nodes keep it up to date. The edges' labels point inside the
+ * interned names, each edge holding the name it points in, and the edge
+ * of a name nobody has anymore goes away with it.
+ */
+
+static NameTrie *trie_create(NameIndex *index, const char *label,
+                             size_t length, char *owner)
+{
+    NameTrie *trie = pool_alloc(&index->tries);
+    trie->label = label;
+    trie->owner = name_hold(index->mem, owner);
+    trie->length = length;
+    trie->child = NULL;
+    trie->sibling = NULL;
+    trie->nodes = NULL;
+    return trie;
+}
+
+// the trie the name ends at, added if it wasn't there
+static NameTrie *trie_insert(NameIndex *index, char *name)
+{
+    NameTrie *trie = &index->root;
+    const char *rest = name;
+
+    while (*rest != '\0')
+    {
+        // the children are kept sorted by their first byte
+        NameTrie **link = &trie->child;
+        while (*link != NULL &&
+               (unsigned char)(*link)->label[0] < (unsigned char)*rest)
+            link = &(*link)->sibling;
+        NameTrie *child = *link;
+        if (child == NULL || child->label[0] != *rest)
+        {
+            NameTrie *leaf = trie_create(index, rest, strlen(rest), name);
+            leaf->sibling = child;
+            *link = leaf;
+            return leaf;
+        }
+
+        size_t common = 1;
+        while (common < child->length && rest[common] == child->label[common])
+            common++;
+        if (common < child->length)
+        {
+            // the edge is split where the name leaves it
+            NameTrie *middle = trie_create(index, child->label, common,
+                                           child->owner);
+            middle->sibling = child->sibling;
+            middle->child = child;
+            child->sibling = NULL;
+            child->label += common;
+            child->length -= common;
+            *link = middle;
+            child = middle;
+        }
+        rest += common;
+        trie = child;
+    }
+    return trie;
+}
+
+static void trie_free(NameIndex *index, NameTrie *trie)
+{
+    name_release(index->mem, trie->owner);
+    pool_free(&index->tries, trie);
+}
+
+// the trie takes the place of its only child, which holds the whole path
+// down to it, so the longer edge points in the child's name
+static void trie_merge(NameIndex *index, NameTrie *trie)
+{
+    NameTrie *child = trie->child;
+
+    name_release(index->mem, trie->owner);
+    trie->label = child->label - trie->length;
+    trie->owner = child->owner;
+    trie->length += child->length;
+    trie->child = child->child;
+    trie->nodes = child->nodes;
+    if (trie->nodes != NULL)
+        trie->nodes->nameLink = &trie->nodes;
+    pool_free(&index->tries, child);
+}
+
+// once nobody has the name anymore, its trie goes, and a trie left with
+// no nodes and a single child is merged with it, so every trie but the
+// root has nodes or branches
+static void trie_prune(NameIndex *index, const char *name)
+{
+    NameTrie *parent = NULL;
+    NameTrie *trie = &index->root;
+    NameTrie **link = NULL;
+    const char *rest = name;
+
+    while (*rest != '\0')
+    {
+        parent = trie;
+        link = &trie->child;
+        while ((*link)->label[0] != *rest)
+            link = &(*link)->sibling;
+        trie = *link;
+        rest += trie->length;
+    }
+    if (trie == &index->root || trie->nodes != NULL)
+        return;
+
+    if (trie->child == NULL)
+    {
+        *link = trie->sibling;
+        trie_free(index, trie);
+        trie = parent;
+    }
+    if (trie != &index->root && trie->nodes == NULL &&
+        trie->child != NULL && trie->child->sibling == NULL)
+        trie_merge(index, trie);
+}
+
+// the trie holding every name that starts with the prefix, NULL if none
+static NameTrie *trie_seek(NameIndex *index, const char *prefix,
+                           size_t length)
+{
+    NameTrie *trie = &index->root;
+    size_t done = 0;
+
+    while (done < length)
+    {
+        NameTrie *child = trie->child;
+        while (child != NULL && child->label[0] != prefix[done])
+            child = child->sibling;
+        if (child == NULL)
+            return NULL;
+        size_t step = child->length < length - done ? child->length :
+                                                      length - done;
+        if (memcmp(child->label, prefix + done, step) != 0)
+            return NULL;
+        done += step;
+        trie = child;
+    }
+    return trie;
+}
+
+static void trie_visit(NameTrie *trie, const char *pattern,
+                       IndexVisit visit, void *arg)
+{
+    // every node in a list has the same name, the first one speaks for all
+    if (trie->nodes != NULL &&
+        (pattern == NULL || fnmatch(pattern, trie->nodes->name, 0) == 0))
+    {
+        for (TreeNode *node = trie->nodes; node != NULL; node = node->nameNext)
+            visit(arg, node);
+    }
+    for (NameTrie *child = trie->child; child != NULL; child = child->sibling)
+        trie_visit(child, pattern, visit, arg);
+}
+
+void index_add(TreeMem *mem, TreeNode *treeNode)
+{
+    NameIndex *index = mem->index;
+
+    if (index == NULL)
+    {
+        treeNode->nameLink = NULL;
+        return;
+    }
+
+    // the threads of a parallel copy add their nodes at the same time
+    pthread_mutex_lock(&index->lock);
+    NameTrie *trie = trie_insert(index, treeNode->name);
+    treeNode->nameNext = trie->nodes;
+    if (trie->nodes != NULL)
+        trie->nodes->nameLink = &treeNode->nameNext;
+    trie->nodes = treeNode;
+    treeNode->nameLink = &trie->nodes;
+    pthread_mutex_unlock(&index->lock);
+}
+
+void index_remove(TreeMem *mem, TreeNode *treeNode)
+{
+    NameIndex *index = mem->index;
+
+    if (index == NULL)
+        return;
+
+    // removing a neighbour changes the node's link, so it is only read
+    // under the lock
+    pthread_mutex_lock(&index->lock);
+    // nodes created before the index was, and not in the tree when it was
+    // built, were never added
+    if (treeNode->nameLink != NULL)
+    {
+        *treeNode->nameLink = treeNode->nameNext;
+        if (treeNode->nameNext != NULL)
+            treeNode->nameNext->nameLink = treeNode->nameLink;
+        // the last node in its list may have been the last with the name
+        else
+            trie_prune(index, treeNode->name);
+        treeNode->nameLink = NULL;
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+void index_build(TreeMem *mem, TreeNode *root)
+{
+    if (mem->index != NULL)
+        return;
+
+    NameIndex *index = malloc(sizeof(NameIndex));
+    DIE(!index, "malloc");
+    pthread_mutex_init(&index->lock, NULL);
+    pool_init(&index->tries, sizeof(NameTrie));
+    index->mem = mem;
+    index->root.label = "";
+    index->root.owner = NULL;
+    index->root.length = 0;
+    index->root.child = NULL;
+    index->root.sibling = NULL;
+    index->root.nodes = NULL;
+    mem->index = index;
+
+    // the root is never under the folder a search starts from
+    TreeWalk walk;
+    TreeNode *node;
+    walk_start(&walk, root);
+    while ((node = walk_next(&walk)) != NULL)
+    {
+        if (!walk.leaving)
+            index_add(mem, node);
+    }
+    walk_end(&walk);
+}
+
+void index_find(TreeMem *mem, const char *pattern, IndexVisit visit,
+                void *arg)
+{
+    NameIndex *index = mem->index;
+    size_t prefix = strcspn(pattern, "*?[\\");
+
+    pthread_mutex_lock(&index->lock);
+    NameTrie *trie = trie_seek(index, pattern, prefix);
+    if (trie != NULL && pattern[prefix] == '\0')
+    {
+        // a plain name, its trie may only be a part of a longer edge
+        if (trie->nodes != NULL && strcmp(trie->nodes->name, pattern) == 0)
+        {
+            for (TreeNode *node = trie->nodes; node != NULL;
+                 node = node->nameNext)
+                visit(arg, node);
+        }
+    }
+    else if (trie != NULL)
+    {
+        // only the names under the literal prefix are matched, a name
+        // followed by a lone * matches them all
+        int all = pattern[prefix] == '*' && pattern[prefix + 1] == '\0';
+        trie_visit(trie, all ? NULL : pattern, visit, arg);
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+// lets go of the names the tries under the trie hold, and of the nodes
+// in them: the ones kept out of the tree by a snapshot outlive the index
+static void trie_release(NameIndex *index, NameTrie *trie)
+{
+    for (TreeNode *node = trie->nodes; node != NULL; node = node->nameNext)
+        node->nameLink = NULL;
+    for (NameTrie *child = trie->child; child != NULL; child = child->sibling)
+    {
+        trie_release(index, child);
+        name_release(index->mem, child->owner);
+    }
+}
+
+void index_destroy(NameIndex *index)
+{
+    if (index == NULL)
+        return;
+    trie_release(index, &index->root);
+    pool_destroy(&index->tries);
+    pthread_mutex_destroy(&index->lock);
+    free(index);
+}
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include "tree.h"
+
+/*
+ * A node is a name in a folder, what it names is its content: a folder,
+ * or a file, which may have several names. Every content gets an inode
+ * number from its tree's table, which maps the number back to a name of
+ * it, and freed numbers are given again before new ones. The table also
+ * keeps the type and permission bits, the size and the times of each,
+ * a column per field: listings read them by number, and a scan for the
+ * biggest or the latest files runs down two columns without touching a
+ * node.
+ *
+ * The names of a file with more than one are linked in a ring through
+ * their nodes, so a write through one of them can reach the folders of the
+ * others. Removing a name keeps the content until its last name goes. The
+ * threads freeing a subtree may remove names of the same file at once,
+ * the rings are only changed under the table's lock.
+ */
+
+// when the command being run began, what it changes is stamped with it
+static int64_t inode_now;
+
+void inode_tick()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    inode_now = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int64_t inode_time()
+{
+    return inode_now;
+}
+
+// a replayed command is stamped with the time it first ran at
+void inode_set_time(int64_t time)
+{
+    inode_now = time;
+}
+
+void inode_init(InodeTable *table)
+{
+    pthread_mutex_init(&table->lock, NULL);
+    table->capacity = 0;
+    table->count = 1;
+    table->nodes = NULL;
+    table->mode = NULL;
+    table->size = NULL;
+    table->mtime = NULL;
+    table->ctime = NULL;
+    table->free = NULL;
+    table->freeCount = 0;
+    table->freeCapacity = 0;
+    if (inode_now == 0)
+        inode_tick();
+}
+
+void inode_destroy(InodeTable *table)
+{
+    pthread_mutex_destroy(&table->lock);
+    free(table->nodes);
+    free(table->mode);
+    free(table->size);
+    free(table->mtime);
+    free(table->ctime);
+    free(table->free);
+}
+
+static void *column_grow(void *column, uint32_t capacity, size_t size)
+{
+    column = realloc(column, capacity * size);
+    DIE(!column, "realloc");
+    return column;
+}
+
+// the table's lock has to be held
+static void table_grow(InodeTable *table, uint32_t capacity)
+{
+    table->nodes = column_grow(table->nodes, capacity, sizeof(TreeNode *));
+    table->mode = column_grow(table->mode, capacity, sizeof(uint16_t));
+    table->size = column_grow(table->size, capacity, sizeof(uint64_t));
+    table->mtime = column_grow(table->mtime, capacity, sizeof(int64_t));
+    table->ctime = column_grow(table->ctime, capacity, sizeof(int64_t));
+    table->capacity = capacity;
+}
+
+// makes room for that many more numbers, so the columns don't move while
+// threads that don't take the lock use them
+void inode_reserve(TreeMem *mem, uint32_t count)
+{
+    InodeTable *table = &mem->inodes;
+
+    pthread_mutex_lock(&table->lock);
+    if (table->count + count > table->capacity)
+    {
+        uint32_t capacity = table->capacity ? table->capacity : 1024;
+        while (table->count + count > capacity)
+            capacity *= 2;
+        table_grow(table, capacity);
+    }
+    pthread_mutex_unlock(&table->lock);
+}
+
+uint32_t inode_alloc(TreeMem *mem, TreeNode *treeNode, unsigned int mode,
+                     uint64_t size)
+{
+    InodeTable *table = &mem->inodes;
+    uint32_t ino;
+
+    // subtrees are copied by several threads at once, and the columns
+    // move when they grow
+    pthread_mutex_lock(&table->lock);
+    if (table->freeCount > 0)
+        ino = table->free[--table->freeCount];
+    else
+    {
+        if (table->count >= table->capacity)
+            table_grow(table, table->capacity ? table->capacity * 2 : 1024);
+        ino = table->count++;
+    }
+    table->nodes[ino] = treeNode;
+    table->mode[ino] = (uint16_t)mode;
+    table->size[ino] = size;
+    table->mtime[ino] = inode_now;
+    table->ctime[ino] = inode_now;
+    pthread_mutex_unlock(&table->lock);
+    return ino;
+}
+
+void inode_free(TreeMem *mem, uint32_t ino)
+{
+    InodeTable *table = &mem->inodes;
+
+    pthread_mutex_lock(&table->lock);
+    if (table->freeCount == table->freeCapacity)
+    {
+        table->freeCapacity = table->freeCapacity ? table->freeCapacity * 2
+                                                  : 64;
+        table->free = realloc(table->free,
+                              table->freeCapacity * sizeof(uint32_t));
+        DIE(!table->free, "realloc");
+    }
+    table->nodes[ino] = NULL;
+    table->mode[ino] = 0;
+    table->free[table->freeCount++] = ino;
+    pthread_mutex_unlock(&table->lock);
+}
+
+TreeNode *inode_find(TreeMem *mem, uint32_t ino)
+{
+    InodeTable *table = &mem->inodes;
+
+    if (ino == 0 || ino >= table->count)
+        return NULL;
+    return table->nodes[ino];
+}
+
+// a name of the object under start, NULL if all of them are out of the
+// tree or elsewhere in it
+TreeNode *inode_name(TreeMem *mem, uint32_t ino, TreeNode *start)
+{
+    TreeNode *first = inode_find(mem, ino);
+    TreeNode *name = first;
+
+    if (first == NULL)
+        return NULL;
+    do
+    {
+        // a removed node waiting for a snapshot or an abort still has a
+        // folder, but that one doesn't lead up to the root
+        if (name->parent != NULL && is_ancestor(start, name))
+            return name;
+        name = name->linkNext;
+    } while (name != NULL && name != first);
+    return NULL;
+}
+
+uint32_t node_ino(TreeNode *treeNode)
+{
+    if (treeNode->type == FOLDER_NODE)
+        return ((FolderContent *)treeNode->content)->ino;
+    return ((FileContent *)treeNode->content)->ino;
+}
+
+void inode_touch(TreeMem *mem, TreeNode *treeNode, int modified)
+{
+    uint32_t ino = node_ino(treeNode);
+
+    txn_touched(mem, treeNode);
+    if (modified)
+        mem->inodes.mtime[ino] = inode_now;
+    mem->inodes.ctime[ino] = inode_now;
+}
+
+void inode_resize(TreeMem *mem, TreeNode *fileNode, uint64_t size)
+{
+    mem->inodes.size[node_ino(fileNode)] = size;
+    inode_touch(mem, fileNode, 1);
+}
+
+void file_init(TreeMem *mem, TreeNode *treeNode, FileContent *file,
+               FileData *data, char *target)
+{
+    file->data = data;
+    file->target = target;
+    file->links = 1;
+    file->linked = 0;
+    if (target != NULL)
+        file->ino = inode_alloc(mem, treeNode, MODE_SYMLINK | SYMLINK_MODE,
+                                strlen(target));
+    else
+        file->ino = inode_alloc(mem, treeNode, MODE_FILE | FILE_MODE,
+                                data_size(data));
+    treeNode->content = file;
+}
+
+void link_add(TreeMem *mem, TreeNode *treeNode, TreeNode *existing)
+{
+    FileContent *file = existing->content;
+
+    pthread_mutex_lock(&mem->inodes.lock);
+    treeNode->content = file;
+    file->links++;
+    file->linked = 1;
+    // a file's first other name closes the ring
+    TreeNode *next = existing->linkNext != NULL ? existing->linkNext
+                                                : existing;
+    treeNode->linkNext = next;
+    __atomic_store_n(&existing->linkNext, treeNode, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mem->inodes.lock);
+}
+
+unsigned int link_remove(TreeMem *mem, TreeNode *treeNode)
+{
+    FileContent *file = treeNode->content;
+
+    // a node without a ring is the file's only name, nobody else can
+    // reach the file
+    if (__atomic_load_n(&treeNode->linkNext, __ATOMIC_ACQUIRE) == NULL)
+    {
+        file->links = 0;
+        return 0;
+    }
+
+    pthread_mutex_lock(&mem->inodes.lock);
+    // the other names may have gone meanwhile
+    if (treeNode->linkNext == NULL)
+    {
+        file->links = 0;
+        pthread_mutex_unlock(&mem->inodes.lock);
+        return 0;
+    }
+    unsigned int links = --file->links;
+    TreeNode *prev = treeNode;
+    while (prev->linkNext != treeNode)
+        prev = prev->linkNext;
+    // the table keeps naming the file by one of the names left
+    if (mem->inodes.nodes[file->ino] == treeNode)
+        mem->inodes.nodes[file->ino] = prev;
+    // the last name left has no ring anymore
+    if (links == 1)
+        __atomic_store_n(&prev->linkNext, NULL, __ATOMIC_RELEASE);
+    else
+        prev->linkNext = treeNode->linkNext;
+    treeNode->linkNext = NULL;
+    pthread_mutex_unlock(&mem->inodes.lock);
+    return links;
+}
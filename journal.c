@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include "tree.h"
+#include "disk.h"
+
+typedef struct JournalRecord JournalRecord;
+
+/*
+ * Every record is this header followed by its payload: the path of the
+ * folder the command ran in and the command's tokens, all NUL terminated.
+ * The checksum covers the sequence, the time and the payload, so a record
+ * torn by a crash is detected and dropped on replay.
+ */
+struct JournalRecord {
+    uint32_t length;
+    uint32_t checksum;
+    uint64_t sequence;
+    // when the command ran, in nanoseconds, what it changed has that time
+    int64_t time;
+};
+
+/*
+ * Appends only copy the record in the front buffer. The writer thread
+ * swaps it with the back buffer and writes and syncs everything appended
+ * in the meantime at once, so many records share one fsync. The first
+ * write that fails stops the journal: replay ends at a torn record, so
+ * nothing written after it would count, and appends fail from then on.
+ */
+static struct {
+    FILE* file;
+    char* path;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t synced;
+    char* buffer;
+    size_t length;
+    size_t capacity;
+    char* spare;
+    size_t spareCapacity;
+    uint64_t appended;
+    uint64_t durable;
+    uint64_t size;
+    int writing;
+    int stop;
+    int error;
+} journal;
+
+static uint32_t journal_checksum(uint64_t sequence, int64_t time,
+                                 const char *payload, size_t length)
+{
+    // FNV-1a over the sequence, the time and the payload
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 16; i++)
+    {
+        uint64_t word = i < 8 ? sequence : (uint64_t)time;
+        hash ^= (uint8_t)(word >> (i % 8 * 8));
+        hash *= 16777619u;
+    }
+    while (length--)
+    {
+        hash ^= (uint8_t)*payload++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void *journal_writer(void *arg)
+{
+    pthread_mutex_lock(&journal.lock);
+    while (1)
+    {
+        while (journal.length == 0 && !journal.stop)
+            pthread_cond_wait(&journal.work, &journal.lock);
+        if (journal.length == 0)
+            break;
+
+        // we take everything appended so far and let appends go on in
+        // the other buffer while we write it
+        char *buffer = journal.buffer;
+        size_t length = journal.length;
+        uint64_t sequence = journal.appended;
+        journal.buffer = journal.spare;
+        journal.spare = buffer;
+        size_t capacity = journal.capacity;
+        journal.capacity = journal.spareCapacity;
+        journal.spareCapacity = capacity;
+        journal.length = 0;
+        journal.writing = 1;
+        pthread_mutex_unlock(&journal.lock);
+
+        int failed = fwrite(buffer, 1, length, journal.file) != length ||
+                     disk_sync(journal.file) != 0;
+        int error = errno;
+
+        pthread_mutex_lock(&journal.lock);
+        journal.writing = 0;
+        if (failed)
+        {
+            // the file goes back to what was durable, and what was
+            // appended meanwhile goes nowhere
+            journal.error = error;
+            journal.length = 0;
+            disk_truncate(journal.path, (long)journal.size);
+        }
+        else
+        {
+            journal.durable = sequence;
+            journal.size += length;
+        }
+        pthread_cond_broadcast(&journal.synced);
+    }
+    pthread_mutex_unlock(&journal.lock);
+    return NULL;
+}
+
+int journal_open(const char *path, uint64_t sequence)
+{
+    journal.file = fopen(path, "ab");
+    if (journal.file == NULL)
+        return -1;
+    journal.path = strdup(path);
+    DIE(!journal.path, "strdup");
+    // the writer hands whole batches to the system, and a failed one
+    // leaves nothing in stdio to come out after the file is cut back
+    setvbuf(journal.file, NULL, _IONBF, 0);
+
+    journal.buffer = journal.spare = NULL;
+    journal.length = journal.capacity = journal.spareCapacity = 0;
+    journal.appended = journal.durable = sequence;
+    fseek(journal.file, 0, SEEK_END);
+    journal.size = ftell(journal.file);
+    journal.writing = journal.stop = journal.error = 0;
+
+    pthread_mutex_init(&journal.lock, NULL);
+    pthread_cond_init(&journal.work, NULL);
+    pthread_cond_init(&journal.synced, NULL);
+    errno = pthread_create(&journal.writer, NULL, journal_writer, NULL);
+    DIE(errno != 0, "pthread_create");
+    return 0;
+}
+
+int journal_is_open()
+{
+    return journal.file != NULL;
+}
+
+int journal_failed()
+{
+    pthread_mutex_lock(&journal.lock);
+    int error = journal.error;
+    pthread_mutex_unlock(&journal.lock);
+
+    errno = error;
+    return error != 0;
+}
+
+uint64_t journal_append(int64_t time, const char *cwd, char **tokens,
+                        int tokenCount)
+{
+    size_t length = strlen(cwd) + 1;
+    for (int i = 0; i < tokenCount; i++)
+        length += strlen(tokens[i]) + 1;
+
+    pthread_mutex_lock(&journal.lock);
+    // if the writer falls too far behind, we wait for it
+    while (journal.length > JOURNAL_BUFFER_LIMIT && !journal.error)
+        pthread_cond_wait(&journal.synced, &journal.lock);
+    if (journal.error)
+    {
+        errno = journal.error;
+        pthread_mutex_unlock(&journal.lock);
+        return 0;
+    }
+
+    size_t needed = journal.length + sizeof(JournalRecord) + length;
+    if (needed > journal.capacity)
+    {
+        while (needed > journal.capacity)
+            journal.capacity = journal.capacity ? journal.capacity * 2 :
+                                                  JOURNAL_BUFFER_SIZE;
+        journal.buffer = realloc(journal.buffer, journal.capacity);
+        DIE(!journal.buffer, "realloc");
+    }
+
+    // the payload is built in place, right after its header
+    JournalRecord record;
+    char *payload = journal.buffer + journal.length + sizeof(record);
+    char *next = stpcpy(payload, cwd) + 1;
+    for (int i = 0; i < tokenCount; i++)
+        next = stpcpy(next, tokens[i]) + 1;
+
+    record.length = (uint32_t)length;
+    record.sequence = ++journal.appended;
+    record.time = time;
+    record.checksum = journal_checksum(record.sequence, time, payload,
+                                       length);
+    memcpy(journal.buffer + journal.length, &record, sizeof(record));
+    journal.length = needed;
+
+    pthread_cond_signal(&journal.work);
+    pthread_mutex_unlock(&journal.lock);
+    return record.sequence;
+}
+
+int journal_flush()
+{
+    pthread_mutex_lock(&journal.lock);
+    while (journal.durable < journal.appended && !journal.error)
+        pthread_cond_wait(&journal.synced, &journal.lock);
+    int error = journal.error;
+    pthread_mutex_unlock(&journal.lock);
+
+    errno = error;
+    return error ? -1 : 0;
+}
+
+uint64_t journal_size()
+{
+    pthread_mutex_lock(&journal.lock);
+    uint64_t size = journal.size + journal.length;
+    pthread_mutex_unlock(&journal.lock);
+    return size;
+}
+
+int journal_truncate()
+{
+    if (journal_flush() < 0)
+        return -1;
+
+    // everything is durable and the writer is idle, so we can start over
+    pthread_mutex_lock(&journal.lock);
+    FILE *file = freopen(journal.path, "wb", journal.file);
+    if (file == NULL)
+        journal.error = errno;
+    else
+    {
+        setvbuf(file, NULL, _IONBF, 0);
+        journal.size = 0;
+    }
+    int error = journal.error;
+    pthread_mutex_unlock(&journal.lock);
+
+    errno = error;
+    return error ? -1 : 0;
+}
+
+int journal_close()
+{
+    if (journal.file == NULL)
+        return 0;
+
+    pthread_mutex_lock(&journal.lock);
+    journal.stop = 1;
+    pthread_cond_signal(&journal.work);
+    pthread_mutex_unlock(&journal.lock);
+    pthread_join(journal.writer, NULL);
+    int error = journal.error;
+
+    fclose(journal.file);
+    journal.file = NULL;
+    free(journal.path);
+    free(journal.buffer);
+    free(journal.spare);
+    pthread_mutex_destroy(&journal.lock);
+    pthread_cond_destroy(&journal.work);
+    pthread_cond_destroy(&journal.synced);
+
+    errno = error;
+    return error ? -1 : 0;
+}
+
+int journal_replay(const char *path, uint64_t after, JournalReplay replay,
+                   void *arg)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    char *payload = NULL;
+    size_t capacity = 0;
+    char **tokens = NULL;
+    size_t tokenCapacity = 0;
+    long valid = 0;
+    JournalRecord record;
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (record.length > capacity)
+        {
+            capacity = record.length;
+            payload = realloc(payload, capacity);
+            DIE(!payload, "realloc");
+        }
+        // a torn or corrupted record ends the journal
+        if (fread(payload, 1, record.length, file) != record.length ||
+            record.length == 0 || payload[record.length - 1] != '\0' ||
+            journal_checksum(record.sequence, record.time, payload,
+                             record.length) != record.checksum)
+            break;
+        valid = ftell(file);
+
+        // records already in the image are skipped
+        if (record.sequence <= after)
+            continue;
+
+        // the first string is the folder, the rest are the tokens
+        int tokenCount = 0;
+        char *end = payload + record.length;
+        char *token = payload + strlen(payload) + 1;
+        for (char *p = token; p < end; p += strlen(p) + 1)
+        {
+            if ((size_t)tokenCount == tokenCapacity)
+            {
+                tokenCapacity = tokenCapacity ? tokenCapacity * 2 : 8;
+                tokens = realloc(tokens, tokenCapacity * sizeof(char *));
+                DIE(!tokens, "realloc");
+            }
+            tokens[tokenCount++] = p;
+        }
+        replay(arg, record.sequence, record.time, payload, tokens,
+               tokenCount);
+    }
+
+    int torn = !feof(file) || ftell(file) != valid;
+    fclose(file);
+    free(payload);
+    free(tokens);
+
+    // we cut the torn tail, so new records follow the last good one
+    if (torn && disk_truncate(path, valid) < 0)
+        return -1;
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tree.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+/*
+ * A small LZ77 codec, in the spirit of LZ4. The compressed bytes are a run
+ * of sequences: a token whose high nibble is the number of literals and
+ * low nibble the match length minus LZ_MIN_MATCH (15 meaning more length
+ * bytes follow, each one added until one is below 255), the literals, then
+ * the match's 2 byte little endian offset. The last sequence ends after
+ * its literals.
+ */
+
+static uint32_t lz_read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned int lz_hash(const unsigned char *p)
+{
+    return (lz_read32(p) * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// writes the rest of a length that didn't fit its nibble
+static unsigned char *lz_put_length(unsigned char *out, size_t length)
+{
+    while (length >= 255)
+    {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+// the worst case a sequence adds to its literals: token, lengths, offset
+static size_t lz_overhead(size_t literals, size_t match)
+{
+    return 1 + literals / 255 + 1 + 2 + match / 255 + 1;
+}
+
+size_t lz_compress(const char *source, size_t length, char *destination,
+                   size_t capacity)
+{
+    const unsigned char *in = (const unsigned char *)source;
+    const unsigned char *end = in + length;
+    unsigned char *out = (unsigned char *)destination;
+    unsigned char *outEnd = out + capacity;
+    // last position + 1 of each hashed 4 byte sequence, 0 if none
+    uint32_t table[1 << LZ_HASH_BITS];
+    const unsigned char *anchor = in;
+    const unsigned char *p = in;
+
+    memset(table, 0, sizeof(table));
+    while (length >= LZ_MIN_MATCH && p <= end - LZ_MIN_MATCH)
+    {
+        unsigned int h = lz_hash(p);
+        const unsigned char *candidate = table[h] ? in + table[h] - 1 : NULL;
+        table[h] = (uint32_t)(p - in) + 1;
+        if (candidate == NULL || p - candidate > LZ_MAX_OFFSET ||
+            lz_read32(candidate) != lz_read32(p))
+        {
+            p++;
+            continue;
+        }
+
+        const unsigned char *match = p + LZ_MIN_MATCH;
+        while (match < end && *match == candidate[match - p])
+            match++;
+        size_t literals = p - anchor;
+        size_t matchLength = match - p - LZ_MIN_MATCH;
+        if ((size_t)(outEnd - out) < literals +
+                                     lz_overhead(literals, matchLength))
+            return 0;
+
+        unsigned char *token = out++;
+        *token = (unsigned char)((literals < 15 ? literals : 15) << 4 |
+                                 (matchLength < 15 ? matchLength : 15));
+        if (literals >= 15)
+            out = lz_put_length(out, literals - 15);
+        memcpy(out, anchor, literals);
+        out += literals;
+        size_t offset = p - candidate;
+        *out++ = (unsigned char)offset;
+        *out++ = (unsigned char)(offset >> 8);
+        if (matchLength >= 15)
+            out = lz_put_length(out, matchLength - 15);
+
+        p = anchor = match;
+    }
+
+    // the rest goes out as the literals of the last sequence
+    size_t literals = end - anchor;
+    if ((size_t)(outEnd - out) < literals + 1 + literals / 255 + 1)
+        return 0;
+    *out++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15)
+        out = lz_put_length(out, literals - 15);
+    memcpy(out, anchor, literals);
+    out += literals;
+    return out - (unsigned char *)destination;
+}
+
+// reads the rest of a length, -1 if the input ends first
+static int lz_get_length(const unsigned char **in, const unsigned char *end,
+                         size_t *length)
+{
+    unsigned char byte;
+    do
+    {
+        if (*in == end)
+            return -1;
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+long lz_decompress(const char *source, size_t length, char *destination,
+                   size_t capacity)
+{
+    const unsigned char *in = (const unsigned char *)source;
+    const unsigned char *end = in + length;
+    unsigned char *out = (unsigned char *)destination;
+    unsigned char *outEnd = out + capacity;
+
+    while (in < end)
+    {
+        unsigned char token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && lz_get_length(&in, end, &literals) < 0)
+            return -1;
+        if ((size_t)(end - in) < literals ||
+            (size_t)(outEnd - out) < literals)
+            return -1;
+        memcpy(out, in, literals);
+        in += literals;
+        out += literals;
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return -1;
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && lz_get_length(&in, end, &matchLength) < 0)
+            return -1;
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - (unsigned char *)destination)
+            || (size_t)(outEnd - out) < matchLength)
+            return -1;
+
+        // the match may overlap what it copies, so byte by byte
+        const unsigned char *match = out - offset;
+        for (size_t i = 0; i < matchLength; i++)
+            out[i] = match[i];
+        out += matchLength;
+    }
+    return out - (unsigned char *)destination;
+}
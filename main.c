@@ -1,8 +1,22 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "tree.h"
-#define LINE_MAX_LEN 1000
-#define TOKEN_MAX_LEN 300
+#define BATCH_READ_SIZE (1 << 20)
+#define MAX_TOKENS 8
+#define COMMAND_TABLE_SIZE 128
+#define BATCH_FLAG "-b"
+#define IMAGE_FLAG "-i"
+#define PERSIST_FLAG "-p"
+#define RECURSIVE_FLAG "-r"
+#define SYMBOLIC_FLAG "-s"
+#define LONG_FLAG "-l"
+#define SORT_FLAG "--sort"
+#define LIMIT_FLAG "--limit"
+#define AFTER_FLAG "--after"
+#define JOURNAL_SUFFIX ".journal"
+#define MAX_PATH_LENGTH 4096
 
 #define LS "ls"
 #define PWD "pwd"
@@ -15,67 +29,853 @@
 #define RMREC "rmrec"
 #define MV "mv"
 #define CP "cp"
+#define LN "ln"
+#define SAVE "save"
+#define LOAD "load"
+#define CHECKPOINT "checkpoint"
+#define DEDUP "dedup"
+#define APPEND "append"
+#define READ "read"
+#define WRITE "write"
+#define COMPRESS "compress"
+#define ZSTAT "zstat"
+#define DU "du"
+#define COUNT "count"
+#define STAT "stat"
+#define CHMOD "chmod"
+#define TOP "top"
+#define FIND "find"
+#define GREP "grep"
+#define INDEX_FLAG "-t"
+#define BEGIN "begin"
+#define COMMIT "commit"
+#define ABORT "abort"
+#define SNAPSHOT "snapshot"
+#define SNAPSHOTS "snapshots"
+#define DROP "drop"
+#define DIFF "diff"
+#define SNAPSHOT_MARK '@'
 
-void execute_command(char *cmd, char *arg1, char *arg2) {
-    printf("$ %s %s %s\n", cmd, arg1, arg2);
+static FileTree fileTree;
+// the image the tree persists to, NULL if it only lives in memory
+static char *persistImage;
+
+// the journaled commands of the open transaction, kept until it commits:
+// for each one, its token count, its folder and its tokens
+static struct {
+    char **strings;
+    int count;
+    int capacity;
+} pending;
+
+// the snapshot we cd'ed into, the current folder waits for us to leave it
+static SnapView view;
+
+typedef TreeNode *(*CommandHandler)(TreeNode *currentFolder, char **args);
+
+typedef struct Command {
+    const char *name;
+    CommandHandler handler;
+    // mutating commands are journaled before they run
+    int mutating;
+    // only some commands can look inside a snapshot
+    int inSnapshot;
+} Command;
+
+static TreeNode *run_ls(TreeNode *currentFolder, char **args)
+{
+    char *path = NO_ARG, *sort = NO_ARG, *limit = NO_ARG, *after = NO_ARG;
+    int sorted = 0;
+    int details = 0;
+
+    // the flags take the arg after them, but -l, anything else is the path
+    for (int i = 1; i < MAX_TOKENS && *args[i] != '\0'; i++)
+    {
+        char **value = NULL;
+        if (strcmp(args[i], LONG_FLAG) == 0)
+        {
+            details = 1;
+            continue;
+        }
+        if (strcmp(args[i], SORT_FLAG) == 0)
+            value = &sort;
+        else if (strcmp(args[i], LIMIT_FLAG) == 0)
+            value = &limit;
+        else if (strcmp(args[i], AFTER_FLAG) == 0)
+            value = &after;
+        if (value == NULL)
+        {
+            path = args[i];
+            continue;
+        }
+        sorted = 1;
+        if (i + 1 < MAX_TOKENS)
+            *value = args[++i];
+    }
+
+    // without flags, the children come in the order they are linked
+    if (view.snapshot != NULL && sorted)
+        out_puts("ls: the sorted views are not kept inside a snapshot\n");
+    else if (view.snapshot != NULL && details)
+        out_puts("ls: the metadata is not kept inside a snapshot\n");
+    else if (view.snapshot != NULL)
+        snapshotLs(&view, path);
+    else if (sorted)
+        listChildren(currentFolder, path, sort, limit, after, details);
+    else
+        ls(currentFolder, path, details);
+    return currentFolder;
 }
 
-TreeNode* process_command(TreeNode* currentFolder,
-        char cmd[3][TOKEN_MAX_LEN], int token_count) {
-    execute_command(cmd[0], cmd[1], cmd[2]);
-    if (!strcmp(cmd[0], LS)) {
-        ls(currentFolder, cmd[1]);
-    } else if (!strcmp(cmd[0], PWD)) {
+static TreeNode *run_pwd(TreeNode *currentFolder, char **args)
+{
+    if (view.snapshot != NULL)
+        snapshotPwd(&view);
+    else
         pwd(currentFolder);
-    } else if (!strcmp(cmd[0], TREE)) {
-        tree(currentFolder, cmd[1]);
-    } else if (!strcmp(cmd[0], CD)) {
-        currentFolder = cd(currentFolder, cmd[1]);
-    } else if (!strcmp(cmd[0], MKDIR)) {
-        mkdir(currentFolder, strdup(cmd[1]));
-    } else if (!strcmp(cmd[0], RMDIR)) {
-        rmdir(currentFolder, cmd[1]);
-    } else if (!strcmp(cmd[0], RM)) {
-        rm(currentFolder, cmd[1]);
-    } else if (!strcmp(cmd[0], RMREC)) {
-        rmrec(currentFolder, cmd[1]);
-    } else if (!strcmp(cmd[0], TOUCH)) {
-        touch(currentFolder, strdup(cmd[1]), strdup(cmd[2]));
-    } else if (!strcmp(cmd[0], MV)) {
-        mv(currentFolder, cmd[1], cmd[2]);
-    } else if (!strcmp(cmd[0], CP)) {
-        cp(currentFolder, cmd[1], cmd[2]);
+    return currentFolder;
+}
+
+static TreeNode *run_tree(TreeNode *currentFolder, char **args)
+{
+    if (view.snapshot != NULL)
+        snapshotTree(&view, args[1]);
+    else
+        tree(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_cd(TreeNode *currentFolder, char **args)
+{
+    // @name goes in a snapshot, a lone @ back to the tree
+    if (args[1][0] == SNAPSHOT_MARK && args[1][1] == '\0')
+        leaveSnapshot(&view);
+    else if (args[1][0] == SNAPSHOT_MARK)
+    {
+        if (enterSnapshot(&view, args[1] + 1) < 0)
+            out_printf("cd: no such file or directory: %s", args[1]);
+    }
+    else if (view.snapshot != NULL)
+        snapshotCd(&view, args[1]);
+    else
+        return cd(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_mkdir(TreeNode *currentFolder, char **args)
+{
+    mkdir(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_rmdir(TreeNode *currentFolder, char **args)
+{
+    rmdir(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_rm(TreeNode *currentFolder, char **args)
+{
+    rm(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_rmrec(TreeNode *currentFolder, char **args)
+{
+    rmrec(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_touch(TreeNode *currentFolder, char **args)
+{
+    touch(currentFolder, args[1], args[2]);
+    return currentFolder;
+}
+
+static TreeNode *run_mv(TreeNode *currentFolder, char **args)
+{
+    mv(currentFolder, args[1], args[2]);
+    return currentFolder;
+}
+
+static TreeNode *run_cp(TreeNode *currentFolder, char **args)
+{
+    // with -r, folders are copied along with everything inside them
+    if (strcmp(args[1], RECURSIVE_FLAG) == 0)
+        cp(currentFolder, args[2], args[3], 1);
+    else
+        cp(currentFolder, args[1], args[2], 0);
+    return currentFolder;
+}
+
+static TreeNode *run_ln(TreeNode *currentFolder, char **args)
+{
+    // with -s, the link only keeps the target's path
+    if (strcmp(args[1], SYMBOLIC_FLAG) == 0)
+        ln(currentFolder, args[2], args[3], 1);
+    else
+        ln(currentFolder, args[1], args[2], 0);
+    return currentFolder;
+}
+
+static TreeNode *run_save(TreeNode *currentFolder, char **args)
+{
+    if (saveTree(fileTree, args[1]) < 0)
+        out_printf("save: cannot write '%s': %s\n", args[1], strerror(errno));
+    return currentFolder;
+}
+
+// writes the tree over its image and starts an empty journal
+static int checkpoint()
+{
+    if (journal_flush() < 0 || saveTree(fileTree, persistImage) < 0)
+        return -1;
+    return journal_truncate();
+}
+
+// the command goes in the journal buffer, with the time it runs at, the
+// writer thread makes it durable together with the ones that follow it
+static int journal_record(const char *cwd, char **tokens, int token_count)
+{
+    uint64_t sequence = journal_append(inode_time(), cwd, tokens,
+                                       token_count);
+    if (sequence == 0)
+        return -1;
+    fileTree.sequence = sequence;
+
+    // once the journal grows too big, we fold it in the image
+    if (journal_size() > JOURNAL_CHECKPOINT_SIZE && checkpoint() < 0)
+        fprintf(stderr, "cannot checkpoint '%s': %s\n", persistImage,
+                strerror(errno));
+    return 0;
+}
+
+static void pending_add(const char *string)
+{
+    if (pending.count == pending.capacity)
+    {
+        pending.capacity = pending.capacity ? pending.capacity * 2 : 64;
+        pending.strings = realloc(pending.strings,
+                                  pending.capacity * sizeof(char *));
+        DIE(!pending.strings, "realloc");
+    }
+    pending.strings[pending.count] = strdup(string);
+    DIE(!pending.strings[pending.count], "strdup");
+    pending.count++;
+}
+
+static void pending_clear()
+{
+    for (int i = 0; i < pending.count; i++)
+        free(pending.strings[i]);
+    pending.count = 0;
+}
+
+static TreeNode *run_begin(TreeNode *currentFolder, char **args)
+{
+    if (txn_active())
+        out_puts("begin: a transaction is already open\n");
+    else
+        txn_begin(fileTree.root);
+    return currentFolder;
+}
+
+static TreeNode *run_commit(TreeNode *currentFolder, char **args)
+{
+    if (!txn_active())
+    {
+        out_puts("commit: no transaction is open\n");
+        return currentFolder;
+    }
+
+    // the whole batch is a single record, after a crash the journal has
+    // all of it or none of it
+    if (pending.count > 0)
+    {
+        char **tokens = malloc((pending.count + 1) * sizeof(char *));
+        DIE(!tokens, "malloc");
+        tokens[0] = BEGIN;
+        memcpy(tokens + 1, pending.strings, pending.count * sizeof(char *));
+        int result = journal_record(NO_ARG, tokens, pending.count + 1);
+        free(tokens);
+        pending_clear();
+        // what a replay wouldn't do is undone
+        if (result < 0)
+        {
+            out_printf("commit: cannot write the journal: %s\n",
+                       strerror(errno));
+            return txn_abort(currentFolder);
+        }
+    }
+    txn_commit();
+    return currentFolder;
+}
+
+static TreeNode *run_abort(TreeNode *currentFolder, char **args)
+{
+    if (!txn_active())
+    {
+        out_puts("abort: no transaction is open\n");
+        return currentFolder;
+    }
+
+    // nothing was journaled, the tree just goes back
+    pending_clear();
+    return txn_abort(currentFolder);
+}
+
+static TreeNode *run_snapshot(TreeNode *currentFolder, char **args)
+{
+    // an abort would change the tree behind the snapshot's back
+    if (txn_active())
+        out_puts("snapshot: cannot snapshot inside a transaction\n");
+    else
+        takeSnapshot(fileTree.root, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_snapshots(TreeNode *currentFolder, char **args)
+{
+    listSnapshots();
+    return currentFolder;
+}
+
+static TreeNode *run_drop(TreeNode *currentFolder, char **args)
+{
+    dropSnapshot(&view, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_diff(TreeNode *currentFolder, char **args)
+{
+    // with one tree, it is compared to the tree as it is
+    diffTrees(fileTree.root, args[1], args[2]);
+    return currentFolder;
+}
+
+static TreeNode *run_load(TreeNode *currentFolder, char **args)
+{
+    FileTree loaded;
+
+    // the transaction could not undo its steps on another tree
+    if (txn_active())
+    {
+        out_puts("load: cannot load inside a transaction\n");
+        return currentFolder;
+    }
+    if (loadTree(args[1], &loaded) < 0)
+    {
+        out_printf("load: cannot load '%s': %s\n", args[1], strerror(errno));
+        return currentFolder;
+    }
+    // the loaded tree replaces the current one, and its snapshots
+    loaded.sequence = fileTree.sequence;
+    snap_drop_all();
+    freeTree(fileTree);
+    fileTree = loaded;
+
+    // the journal can't be replayed over the loaded tree, so it goes
+    // straight in the image
+    if (persistImage != NULL)
+    {
+        if (checkpoint() < 0)
+            out_printf("load: cannot write '%s': %s\n", persistImage,
+                       strerror(errno));
+    }
+    return fileTree.root;
+}
+
+static TreeNode *run_checkpoint(TreeNode *currentFolder, char **args)
+{
+    if (persistImage == NULL)
+        out_puts("checkpoint: the tree is not persistent\n");
+    // the image would hold changes the journal doesn't have yet
+    else if (txn_active())
+        out_puts("checkpoint: cannot checkpoint inside a transaction\n");
+    else if (checkpoint() < 0)
+        out_printf("checkpoint: cannot write '%s': %s\n", persistImage,
+                   strerror(errno));
+    return currentFolder;
+}
+
+static TreeNode *run_append(TreeNode *currentFolder, char **args)
+{
+    appendFile(currentFolder, args[1], args[2]);
+    return currentFolder;
+}
+
+static TreeNode *run_read(TreeNode *currentFolder, char **args)
+{
+    if (view.snapshot != NULL)
+    {
+        snapshotRead(&view, args[1], args[2], args[3]);
+        return currentFolder;
+    }
+    readFile(currentFolder, args[1], args[2], args[3]);
+    return currentFolder;
+}
+
+static TreeNode *run_write(TreeNode *currentFolder, char **args)
+{
+    writeFile(currentFolder, args[1], args[2], args[3]);
+    return currentFolder;
+}
+
+static TreeNode *run_du(TreeNode *currentFolder, char **args)
+{
+    du(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_count(TreeNode *currentFolder, char **args)
+{
+    countTree(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_stat(TreeNode *currentFolder, char **args)
+{
+    statPath(currentFolder, args[1]);
+    return currentFolder;
+}
+
+static TreeNode *run_chmod(TreeNode *currentFolder, char **args)
+{
+    changeMode(currentFolder, args[1], args[2]);
+    return currentFolder;
+}
+
+// the biggest or the latest changed files, as top <field> [count] [path]
+static TreeNode *run_top(TreeNode *currentFolder, char **args)
+{
+    topFiles(currentFolder, args[1], args[2], args[3]);
+    return currentFolder;
+}
+
+static TreeNode *run_find(TreeNode *currentFolder, char **args)
+{
+    findNodes(currentFolder, args[1], args[2]);
+    return currentFolder;
+}
+
+static TreeNode *run_grep(TreeNode *currentFolder, char **args)
+{
+    // with -t the trigram index narrows the files to scan
+    if (strcmp(args[1], INDEX_FLAG) == 0)
+        grepFiles(currentFolder, args[2], args[3], 1);
+    else
+        grepFiles(currentFolder, args[1], args[2], 0);
+    return currentFolder;
+}
+
+static TreeNode *run_compress(TreeNode *currentFolder, char **args)
+{
+    compress(fileTree.root, args[1], args[2]);
+    return currentFolder;
+}
+
+static unsigned long long average(uint64_t total, uint64_t count)
+{
+    return count != 0 ? (unsigned long long)(total / count) : 0;
+}
+
+// what the packed tier holds, and what packing and unpacking cost
+static TreeNode *run_zstat(TreeNode *currentFolder, char **args)
+{
+    BlobStats stats;
+
+    blob_stats(&stats);
+    out_printf("packed: %zu blobs, %llu bytes in %llu bytes, ratio: %.2f\n",
+               stats.packedBlobs, (unsigned long long)stats.unpackedBytes,
+               (unsigned long long)stats.packedBytes,
+               stats.packedBytes != 0 ?
+               (double)stats.unpackedBytes / stats.packedBytes : 1.0);
+    out_printf("stored: %llu bytes in %zu blobs\n",
+               (unsigned long long)stats.storedBytes, stats.blobs);
+    out_printf("packs: %llu, average: %llu ns\n",
+               (unsigned long long)stats.packs,
+               average(stats.packNanos, stats.packs));
+    out_printf("unpacks: %llu, average: %llu ns\n",
+               (unsigned long long)stats.unpacks,
+               average(stats.unpackNanos, stats.unpacks));
+    return currentFolder;
+}
+
+// how much the blob store saves by keeping identical contents once
+static TreeNode *run_dedup(TreeNode *currentFolder, char **args)
+{
+    BlobStats stats;
+
+    blob_stats(&stats);
+    out_printf("blobs: %zu, references: %llu\n", stats.blobs,
+               (unsigned long long)stats.references);
+    out_printf("stored: %llu bytes, referenced: %llu bytes, saved: %llu "
+               "bytes, ratio: %.2f\n",
+               (unsigned long long)stats.storedBytes,
+               (unsigned long long)stats.referencedBytes,
+               (unsigned long long)(stats.referencedBytes -
+                                    stats.storedBytes),
+               stats.storedBytes ? (double)stats.referencedBytes /
+                                   stats.storedBytes : 1.0);
+    return currentFolder;
+}
+
+static const Command commands[] = {
+    {LS, run_ls, 0, 1},
+    {PWD, run_pwd, 0, 1},
+    {TREE, run_tree, 0, 1},
+    {CD, run_cd, 0, 1},
+    {MKDIR, run_mkdir, 1, 0},
+    {RMDIR, run_rmdir, 1, 0},
+    {RM, run_rm, 1, 0},
+    {RMREC, run_rmrec, 1, 0},
+    {TOUCH, run_touch, 1, 0},
+    {MV, run_mv, 1, 0},
+    {CP, run_cp, 1, 0},
+    {LN, run_ln, 1, 0},
+    {SAVE, run_save, 0, 0},
+    {LOAD, run_load, 0, 0},
+    {CHECKPOINT, run_checkpoint, 0, 0},
+    {DEDUP, run_dedup, 0, 0},
+    {APPEND, run_append, 1, 0},
+    {READ, run_read, 0, 1},
+    {WRITE, run_write, 1, 0},
+    {COMPRESS, run_compress, 0, 0},
+    {ZSTAT, run_zstat, 0, 0},
+    {DU, run_du, 0, 0},
+    {COUNT, run_count, 0, 0},
+    {STAT, run_stat, 0, 0},
+    {CHMOD, run_chmod, 1, 0},
+    {TOP, run_top, 0, 0},
+    {FIND, run_find, 0, 0},
+    {GREP, run_grep, 0, 0},
+    {BEGIN, run_begin, 0, 0},
+    {COMMIT, run_commit, 0, 0},
+    {ABORT, run_abort, 0, 0},
+    {SNAPSHOT, run_snapshot, 0, 1},
+    {SNAPSHOTS, run_snapshots, 0, 1},
+    {DROP, run_drop, 0, 1},
+    {DIFF, run_diff, 0, 1},
+};
+
+// perfect hash table of the commands, its seed is picked at startup
+static const Command *commandTable[COMMAND_TABLE_SIZE];
+static unsigned int commandSeed;
+
+static unsigned int command_hash(const char *name, unsigned int seed)
+{
+    unsigned int hash = seed;
+    while (*name)
+        hash = hash * 31 + (unsigned char)*name++;
+    hash ^= hash >> 7;
+    return hash & (COMMAND_TABLE_SIZE - 1);
+}
+
+static void build_command_table()
+{
+    size_t count = sizeof(commands) / sizeof(commands[0]);
+
+    // we look for a seed that gives every command its own slot
+    for (commandSeed = 1; commandSeed != 0; commandSeed++)
+    {
+        size_t i;
+        memset(commandTable, 0, sizeof(commandTable));
+        for (i = 0; i < count; i++)
+        {
+            unsigned int slot = command_hash(commands[i].name, commandSeed);
+            if (commandTable[slot] != NULL)
+                break;
+            commandTable[slot] = &commands[i];
+        }
+        if (i == count)
+            return;
+    }
+    errno = EINVAL;
+    DIE(1, "build_command_table");
+}
+
+static const Command *find_command(const char *name)
+{
+    const Command *command = commandTable[command_hash(name, commandSeed)];
+    if (command == NULL || strcmp(command->name, name) != 0)
+        return NULL;
+    return command;
+}
+
+void execute_command(char **tokens, int token_count)
+{
+    // we always echo at least the command and two args, like we used to
+    out_write("$ ", 2);
+    out_puts(tokens[0]);
+    for (int i = 1; i < token_count || i < 3; i++)
+    {
+        out_write(" ", 1);
+        out_puts(tokens[i]);
+    }
+    out_write("\n", 1);
+}
+
+// splits the line in place, the tokens point inside the line
+static int tokenize(char *line, char **tokens)
+{
+    int token_count = 0;
+
+    while (token_count < MAX_TOKENS)
+    {
+        while (*line == ' ')
+            line++;
+        if (*line == '\0')
+            break;
+        tokens[token_count++] = line;
+        while (*line != ' ' && *line != '\0')
+            line++;
+        if (*line == '\0')
+            break;
+        *line++ = '\0';
+    }
+
+    for (int i = token_count; i < MAX_TOKENS; i++)
+        tokens[i] = NO_ARG;
+    return token_count;
+}
+
+// -1 if the journal can't take the command, which then doesn't run
+static int journal_command(TreeNode *currentFolder, char **tokens,
+                           int token_count)
+{
+    char cwd[MAX_PATH_LENGTH];
+    char count[16];
+    char time[24];
+
+    if (nodePath(currentFolder, cwd, sizeof(cwd)) >= sizeof(cwd)) {
+        errno = ENAMETOOLONG;
+        DIE(1, "nodePath");
+    }
+    if (!txn_active())
+        return journal_record(cwd, tokens, token_count);
+    if (journal_failed())
+        return -1;
+
+    // a transaction's commands wait for its commit, each with its time
+    snprintf(count, sizeof(count), "%d", token_count);
+    snprintf(time, sizeof(time), "%lld", (long long)inode_time());
+    pending_add(count);
+    pending_add(time);
+    pending_add(cwd);
+    for (int i = 0; i < token_count; i++)
+        pending_add(tokens[i]);
+    return 0;
+}
+
+// runs a journaled command again, in the folder it first ran in
+static void replay_one(int64_t time, char *cwd, char **tokens,
+                       int tokenCount)
+{
+    char *args[MAX_TOKENS];
+    PathLookup lookup;
+
+    const Command *command = tokenCount > 0 ? find_command(tokens[0]) : NULL;
+    if (command == NULL || !command->mutating ||
+        resolve_path(fileTree.root, cwd, &lookup) < 0 ||
+        lookup.node->type != FOLDER_NODE)
+        return;
+
+    for (int i = 0; i < MAX_TOKENS; i++)
+        args[i] = i < tokenCount ? tokens[i] : NO_ARG;
+    // the times are those of the first run, not of the replay
+    inode_set_time(time);
+    command->handler(lookup.node, args);
+}
+
+static void replay_command(void *arg, uint64_t sequence, int64_t time,
+                           char *cwd, char **tokens, int tokenCount)
+{
+    fileTree.sequence = sequence;
+    if (tokenCount == 0 || strcmp(tokens[0], BEGIN) != 0) {
+        replay_one(time, cwd, tokens, tokenCount);
+        return;
+    }
+
+    // a committed transaction, its commands follow one another, each as
+    // its token count, its time, its folder and its tokens
+    int i = 1;
+    while (i + 2 < tokenCount) {
+        int count = atoi(tokens[i]);
+        if (count < 0 || count > tokenCount - i - 3)
+            return;
+        replay_one(strtoll(tokens[i + 1], NULL, 10), tokens[i + 2],
+                   tokens + i + 3, count);
+        i += count + 3;
+    }
+}
+
+// starts from the image and the journal kept next to it
+static int open_persistent(const char *image)
+{
+    char *journalPath = malloc(strlen(image) + sizeof(JOURNAL_SUFFIX));
+    DIE(!journalPath, "malloc");
+    sprintf(journalPath, "%s%s", image, JOURNAL_SUFFIX);
+
+    // a missing image means an empty tree
+    if (loadTree(image, &fileTree) < 0) {
+        if (errno != ENOENT) {
+            free(journalPath);
+            return -1;
+        }
+        fileTree = createFileTree("root");
+    }
+
+    // the replayed commands already printed their output once
+    out_mute(1);
+    int result = journal_replay(journalPath, fileTree.sequence,
+                                replay_command, NULL);
+    out_mute(0);
+    if (result == 0)
+        result = journal_open(journalPath, fileTree.sequence);
+    free(journalPath);
+    return result;
+}
+
+TreeNode* process_command(TreeNode* currentFolder,
+        char **tokens, int token_count) {
+    execute_command(tokens, token_count);
+    const Command *command = find_command(tokens[0]);
+    if (command != NULL && view.snapshot != NULL && !command->inSnapshot) {
+        out_printf("%s: not available inside a snapshot\n", tokens[0]);
+    } else if (command != NULL) {
+        // what the command changes is stamped with when it ran, and so is
+        // its journal record
+        inode_tick();
+        if (command->mutating && persistImage != NULL &&
+            journal_command(currentFolder, tokens, token_count) < 0) {
+            out_printf("%s: cannot write the journal: %s\n", tokens[0],
+                       strerror(errno));
+        } else {
+            currentFolder = command->handler(currentFolder, tokens);
+            // every so often, the contents left unused are packed
+            if (data_tick())
+                packTree(fileTree.root);
+        }
     } else {
-        printf("UNRECOGNIZED COMMAND!\n");
+        out_puts("UNRECOGNIZED COMMAND!\n");
     }
-    printf("\n");
+    out_write("\n", 1);
     return currentFolder;
 }
 
-int main() {
-    char line[LINE_MAX_LEN];
-    char cmd[3][TOKEN_MAX_LEN];
-    char *token;
+static TreeNode *process_line(TreeNode *currentFolder, char *line)
+{
+    char *tokens[MAX_TOKENS];
+    int token_count = tokenize(line, tokens);
+    return process_command(currentFolder, tokens, token_count);
+}
 
-    FileTree fileTree = createFileTree(strdup("root"));
-    TreeNode* currentFolder = fileTree.root;
+// runs the commands one line at a time, for interactive use
+static TreeNode *run_lines(TreeNode *currentFolder)
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
 
-    while (fgets(line, sizeof(line), stdin) != NULL) {
-        line[strlen(line)-1] = 0;
+    while ((len = getline(&line, &capacity, stdin)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[len - 1] = 0;
+        currentFolder = process_line(currentFolder, line);
+        out_flush();
+    }
+    free(line);
+    return currentFolder;
+}
 
-        cmd[0][0] = cmd[1][0] = cmd[2][0] = 0;
+// reads the input in big blocks and runs every complete line in them,
+// the output only goes out when the output buffer fills up
+static TreeNode *run_batch(TreeNode *currentFolder)
+{
+    size_t capacity = BATCH_READ_SIZE;
+    size_t length = 0;
+    size_t bytes;
+    char *buffer = malloc(capacity + 1);
+    DIE(!buffer, "malloc");
 
-        int token_idx = 0;
-        token = strtok(line, " ");
-        while (token) {
-            strcpy(cmd[token_idx], token);
-            ++token_idx;
+    // we read straight into our buffer, stdio would copy it once more
+    setvbuf(stdin, NULL, _IONBF, 0);
+    while ((bytes = fread(buffer + length, 1, capacity - length, stdin)) > 0) {
+        char *line = buffer;
+        char *end = buffer + length + bytes;
+        char *newline;
 
-            token = strtok(NULL, " ");
+        while ((newline = memchr(line, '\n', end - line)) != NULL) {
+            *newline = 0;
+            currentFolder = process_line(currentFolder, line);
+            line = newline + 1;
+        }
+
+        // the incomplete last line is moved in front of the next block
+        length = end - line;
+        memmove(buffer, line, length);
+        if (length == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity + 1);
+            DIE(!buffer, "realloc");
         }
-        currentFolder = process_command(currentFolder, cmd, token_idx);
     }
 
+    // the input may not end with a new line
+    if (length > 0) {
+        buffer[length] = 0;
+        currentFolder = process_line(currentFolder, buffer);
+    }
+    free(buffer);
+    return currentFolder;
+}
+
+int main(int argc, char **argv) {
+    int batch = 0;
+    char *image = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], BATCH_FLAG))
+            batch = 1;
+        else if (!strcmp(argv[i], IMAGE_FLAG) && i + 1 < argc)
+            image = argv[++i];
+        else if (!strcmp(argv[i], PERSIST_FLAG) && i + 1 < argc)
+            persistImage = argv[++i];
+    }
+
+    build_command_table();
+    // we start from the image, if we were given one
+    if (persistImage != NULL) {
+        if (open_persistent(persistImage) < 0) {
+            fprintf(stderr, "cannot open '%s': %s\n", persistImage,
+                    strerror(errno));
+            return 1;
+        }
+    } else if (image == NULL)
+        fileTree = createFileTree("root");
+    else if (loadTree(image, &fileTree) < 0) {
+        fprintf(stderr, "cannot load '%s': %s\n", image, strerror(errno));
+        return 1;
+    }
+    TreeNode* currentFolder = fileTree.root;
+
+    if (batch)
+        currentFolder = run_batch(currentFolder);
+    else
+        currentFolder = run_lines(currentFolder);
+    out_flush();
+
+    // a transaction left open never committed, so it is undone
+    if (txn_active()) {
+        pending_clear();
+        txn_abort(currentFolder);
+    }
+    free(pending.strings);
+    leaveSnapshot(&view);
+    snap_drop_all();
+    // whatever is still in the journal buffer is written before we leave
+    if (journal_close() < 0)
+        fprintf(stderr, "cannot write the journal of '%s': %s\n",
+                persistImage, strerror(errno));
     freeTree(fileTree);
 
     return 0;
@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "tree.h"
+#include "disk.h"
+
+// header of every block pools and bulk allocations carve memory from
+struct Slab {
+    Slab* next;
+};
+
+// keeps the objects handed out by pools and arenas aligned
+#define MEM_ALIGN sizeof(void *)
+#define MEM_ROUND(size) (((size) + MEM_ALIGN - 1) & ~(MEM_ALIGN - 1))
+#define SLAB_HEADER MEM_ROUND(sizeof(Slab))
+
+void pool_init(Pool *pool, size_t objectSize)
+{
+    // a freed object stores the free list link in itself
+    if (objectSize < sizeof(void *))
+        objectSize = sizeof(void *);
+    pool->objectSize = MEM_ROUND(objectSize);
+    pool->freeList = pool->freeTail = NULL;
+    pool->next = pool->end = NULL;
+    pool->slabs = NULL;
+}
+
+void *pool_alloc(Pool *pool)
+{
+    void *object;
+
+    // we reuse freed objects first
+    if (pool->freeList != NULL)
+    {
+        object = pool->freeList;
+        pool->freeList = *(void **)object;
+        return object;
+    }
+
+    // if the current slab is full, we grab a new one
+    if (pool->next == pool->end)
+    {
+        size_t count = (POOL_SLAB_SIZE - SLAB_HEADER) / pool->objectSize;
+        if (count == 0)
+            count = 1;
+        Slab *slab = malloc(SLAB_HEADER + count * pool->objectSize);
+        DIE(!slab, "malloc");
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->next = (char *)slab + SLAB_HEADER;
+        pool->end = pool->next + count * pool->objectSize;
+    }
+
+    // allocating is a pointer bump
+    object = pool->next;
+    pool->next += pool->objectSize;
+    return object;
+}
+
+void *pool_alloc_many(Pool *pool, size_t count)
+{
+    // the objects get a slab of their own, they are freed like any other
+    Slab *slab = malloc(SLAB_HEADER + count * pool->objectSize);
+    DIE(!slab, "malloc");
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    return (char *)slab + SLAB_HEADER;
+}
+
+void pool_free(Pool *pool, void *object)
+{
+    if (object == NULL)
+        return;
+    if (pool->freeList == NULL)
+        pool->freeTail = object;
+    *(void **)object = pool->freeList;
+    pool->freeList = object;
+}
+
+void pool_merge(Pool *pool, Pool *other)
+{
+    // what is left of the other pool's current slab becomes free objects
+    while (other->next != other->end)
+    {
+        pool_free(other, other->next);
+        other->next += other->objectSize;
+    }
+
+    // its free list and its slabs are spliced in front of ours
+    if (other->freeList != NULL)
+    {
+        *(void **)other->freeTail = pool->freeList;
+        if (pool->freeList == NULL)
+            pool->freeTail = other->freeTail;
+        pool->freeList = other->freeList;
+    }
+    if (other->slabs != NULL)
+    {
+        Slab *last = other->slabs;
+        while (last->next != NULL)
+            last = last->next;
+        last->next = pool->slabs;
+        pool->slabs = other->slabs;
+    }
+    pool_init(other, other->objectSize);
+}
+
+void pool_destroy(Pool *pool)
+{
+    // every object goes away with its slab
+    Slab *slab = pool->slabs;
+    while (slab != NULL)
+    {
+        Slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    pool_init(pool, pool->objectSize);
+}
+
+/*
+ * Every interned string is counted: the nodes naming it, the snapshots
+ * and undo logs keeping an old name, the edges of the name index. The
+ * last one to let go of it takes it out of the table and gives it back
+ * to the pool of its size class. Names only go away on frees, which big
+ * subtrees run on several threads, so counting up is lock free and only
+ * the last release takes the lock, which interning holds too: a string
+ * can't be found again while it is on its way out.
+ */
+
+typedef struct ArenaString {
+    unsigned int refs;
+    // its pool, ARENA_CLASSES for one malloced on its own
+    unsigned int sizeClass;
+} ArenaString;
+
+#define ARENA_HEADER MEM_ROUND(sizeof(ArenaString))
+
+static ArenaString *arena_header(const char *string)
+{
+    return (ArenaString *)(string - ARENA_HEADER);
+}
+
+static char *arena_copy(StringArena *arena, const char *string, size_t len)
+{
+    // the smallest class it fits in, long ones get an allocation of
+    // their own
+    unsigned int sizeClass = 0;
+    while (sizeClass < ARENA_CLASSES &&
+           arena->sizes[sizeClass].objectSize < ARENA_HEADER + len + 1)
+        sizeClass++;
+    ArenaString *header;
+    if (sizeClass < ARENA_CLASSES)
+        header = pool_alloc(&arena->sizes[sizeClass]);
+    else
+    {
+        header = malloc(ARENA_HEADER + len + 1);
+        DIE(!header, "malloc");
+    }
+
+    header->refs = 1;
+    header->sizeClass = sizeClass;
+    char *copy = (char *)header + ARENA_HEADER;
+    memcpy(copy, string, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static void arena_grow(StringArena *arena)
+{
+    unsigned int capacity = arena->capacity ? arena->capacity * 2 :
+                                              CHILD_INDEX_MIN_CAPACITY;
+    char **strings = calloc(capacity, sizeof(char *));
+    DIE(!strings, "calloc");
+
+    // we rehash every interned string in the bigger table
+    for (unsigned int i = 0; i < arena->capacity; i++)
+    {
+        char *string = arena->strings[i];
+        if (string == NULL)
+            continue;
+        unsigned int j = name_hash(string, strlen(string)) & (capacity - 1);
+        while (strings[j] != NULL)
+            j = (j + 1) & (capacity - 1);
+        strings[j] = string;
+    }
+
+    free(arena->strings);
+    arena->strings = strings;
+    arena->capacity = capacity;
+}
+
+// takes the string out of the table, the ones after it in its run move
+// back so lookups still find them
+static void arena_remove(StringArena *arena, char *string)
+{
+    unsigned int mask = arena->capacity - 1;
+    unsigned int i = name_hash(string, strlen(string)) & mask;
+    while (arena->strings[i] != string)
+        i = (i + 1) & mask;
+
+    unsigned int j = i;
+    for (;;)
+    {
+        arena->strings[i] = NULL;
+        unsigned int home;
+        do
+        {
+            j = (j + 1) & mask;
+            if (arena->strings[j] == NULL)
+            {
+                arena->count--;
+                return;
+            }
+            home = name_hash(arena->strings[j],
+                             strlen(arena->strings[j])) & mask;
+        // a string stays put if its home slot is between the hole and it
+        } while (i <= j ? i < home && home <= j : i < home || home <= j);
+        arena->strings[i] = arena->strings[j];
+        i = j;
+    }
+}
+
+void arena_init(StringArena *arena)
+{
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->strings = NULL;
+    arena->capacity = 0;
+    arena->count = 0;
+    for (unsigned int i = 0; i < ARENA_CLASSES; i++)
+        pool_init(&arena->sizes[i], 16 << i);
+}
+
+char *arena_intern(StringArena *arena, const char *string, size_t len)
+{
+    pthread_mutex_lock(&arena->lock);
+    // keep the table at most half full
+    if ((arena->count + 1) * 2 > arena->capacity)
+        arena_grow(arena);
+
+    // if we already have the string, we hand out the same copy
+    unsigned int mask = arena->capacity - 1;
+    unsigned int i = name_hash(string, len) & mask;
+    while (arena->strings[i] != NULL)
+    {
+        char *interned = arena->strings[i];
+        if (strncmp(interned, string, len) == 0 && interned[len] == '\0')
+        {
+            __atomic_add_fetch(&arena_header(interned)->refs, 1,
+                               __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&arena->lock);
+            return interned;
+        }
+        i = (i + 1) & mask;
+    }
+
+    arena->strings[i] = arena_copy(arena, string, len);
+    arena->count++;
+    pthread_mutex_unlock(&arena->lock);
+    return arena->strings[i];
+}
+
+static void arena_release(StringArena *arena, char *string)
+{
+    ArenaString *header = arena_header(string);
+
+    // while others hold it too, it only loses a reference
+    unsigned int refs = __atomic_load_n(&header->refs, __ATOMIC_RELAXED);
+    while (refs > 1)
+    {
+        if (__atomic_compare_exchange_n(&header->refs, &refs, refs - 1, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+
+    pthread_mutex_lock(&arena->lock);
+    if (__atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        arena_remove(arena, string);
+        if (header->sizeClass < ARENA_CLASSES)
+            pool_free(&arena->sizes[header->sizeClass], header);
+        else
+            free(header);
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void arena_destroy(StringArena *arena)
+{
+    // the long strings are the only ones outside the pools
+    for (unsigned int i = 0; i < arena->capacity; i++)
+    {
+        char *string = arena->strings[i];
+        if (string != NULL && arena_header(string)->sizeClass == ARENA_CLASSES)
+            free(arena_header(string));
+    }
+    for (unsigned int i = 0; i < ARENA_CLASSES; i++)
+        pool_destroy(&arena->sizes[i]);
+    free(arena->strings);
+    pthread_mutex_destroy(&arena->lock);
+    arena->strings = NULL;
+    arena->capacity = 0;
+    arena->count = 0;
+}
+
+// names loaded with an image are used in place, they are nobody's to free
+static int mem_mapped(TreeMem *mem, const char *name)
+{
+    for (Mapping *mapping = mem->mappings; mapping != NULL;
+         mapping = mapping->next)
+    {
+        if (name >= (char *)mapping->data &&
+            name < (char *)mapping->data + mapping->size)
+            return 1;
+    }
+    return 0;
+}
+
+// one more holder of a name the caller already holds
+char *name_hold(TreeMem *mem, char *name)
+{
+    if (name != NULL && !mem_mapped(mem, name))
+        __atomic_add_fetch(&arena_header(name)->refs, 1, __ATOMIC_RELAXED);
+    return name;
+}
+
+void name_release(TreeMem *mem, char *name)
+{
+    if (name != NULL && !mem_mapped(mem, name))
+        arena_release(&mem->names, name);
+}
+
+TreeMem *mem_create()
+{
+    TreeMem *mem = malloc(sizeof(TreeMem));
+    DIE(!mem, "malloc");
+
+    pool_init(&mem->nodes, sizeof(TreeNode));
+    pool_init(&mem->files, sizeof(FileContent));
+    pool_init(&mem->folders, sizeof(FolderContent));
+    arena_init(&mem->names);
+    mem->bulk = NULL;
+    mem->mappings = NULL;
+    mem->index = NULL;
+    inode_init(&mem->inodes);
+    return mem;
+}
+
+void *mem_alloc_bulk(TreeMem *mem, size_t size)
+{
+    // the block lives as long as the tree
+    Slab *block = malloc(SLAB_HEADER + size);
+    DIE(!block, "malloc");
+    block->next = mem->bulk;
+    mem->bulk = block;
+    return (char *)block + SLAB_HEADER;
+}
+
+void mem_add_mapping(TreeMem *mem, void *data, size_t size)
+{
+    Mapping *mapping = malloc(sizeof(Mapping));
+    DIE(!mapping, "malloc");
+    mapping->data = data;
+    mapping->size = size;
+    mapping->next = mem->mappings;
+    mem->mappings = mapping;
+}
+
+void mem_destroy(TreeMem *mem)
+{
+    // the index lets go of the nodes and the names it holds
+    index_destroy(mem->index);
+    pool_destroy(&mem->nodes);
+    pool_destroy(&mem->files);
+    pool_destroy(&mem->folders);
+    arena_destroy(&mem->names);
+    inode_destroy(&mem->inodes);
+    while (mem->bulk != NULL)
+    {
+        Slab *next = mem->bulk->next;
+        free(mem->bulk);
+        mem->bulk = next;
+    }
+    while (mem->mappings != NULL)
+    {
+        Mapping *next = mem->mappings->next;
+        disk_unmap(mem->mappings->data, mem->mappings->size);
+        free(mem->mappings);
+        mem->mappings = next;
+    }
+    free(mem);
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "tree.h"
+
+/*
+ * The sorted views of a folder's children, one skip list per sort order
+ * anyone asked for. An order is built the first time a folder is listed
+ * with it, from then on folder_link, folder_unlink and the writes that
+ * resize a file keep it in place, so a page is a seek and a short walk.
+ *
+ * Names are unique in a folder, so every key is: type and size orders
+ * break their ties by name.
+ */
+
+typedef struct OrderKey {
+    enum TreeNodeType type;
+    size_t size;
+    const char* name;
+} OrderKey;
+
+// folders weigh nothing here, only file contents are sized
+static size_t node_size(TreeNode *treeNode)
+{
+    if (treeNode->type == FOLDER_NODE)
+        return 0;
+    return data_size(((FileContent *)treeNode->content)->data);
+}
+
+static void entry_key(OrderEntry *entry, OrderKey *key)
+{
+    key->type = entry->node->type;
+    key->size = entry->size;
+    key->name = entry->node->name;
+}
+
+static int key_compare(enum ChildSort sort, const OrderKey *a,
+                       const OrderKey *b)
+{
+    // folders come first, then the biggest files, symlinks sort as files
+    if (sort == SORT_TYPE &&
+        (a->type == FOLDER_NODE) != (b->type == FOLDER_NODE))
+        return a->type == FOLDER_NODE ? -1 : 1;
+    if (sort == SORT_SIZE && a->size != b->size)
+        return a->size > b->size ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+// the entries before the key at every level, in update
+static void order_search(ChildOrder *order, const OrderKey *key,
+                         OrderEntry ***update)
+{
+    OrderEntry **link = order->head;
+    OrderKey current;
+
+    for (int level = ORDER_MAX_HEIGHT - 1; level >= 0; level--)
+    {
+        while (link[level] != NULL)
+        {
+            entry_key(link[level], &current);
+            if (key_compare(order->sort, &current, key) >= 0)
+                break;
+            link = link[level]->forward;
+        }
+        update[level] = &link[level];
+    }
+}
+
+static void order_insert(ChildOrder *order, TreeNode *treeNode, size_t size)
+{
+    OrderEntry **update[ORDER_MAX_HEIGHT];
+    OrderKey key = {treeNode->type, size, treeNode->name};
+
+    // a level more for a quarter of the entries of the level below
+    unsigned int height = 1;
+    while (height < ORDER_MAX_HEIGHT)
+    {
+        order->seed ^= order->seed << 13;
+        order->seed ^= order->seed >> 17;
+        order->seed ^= order->seed << 5;
+        if (order->seed & 3)
+            break;
+        height++;
+    }
+
+    OrderEntry *entry = malloc(sizeof(OrderEntry) +
+                               height * sizeof(OrderEntry *));
+    DIE(!entry, "malloc");
+    entry->node = treeNode;
+    entry->size = size;
+    entry->height = height;
+    order_search(order, &key, update);
+    for (unsigned int level = 0; level < height; level++)
+    {
+        entry->forward[level] = *update[level];
+        *update[level] = entry;
+    }
+    order->count++;
+}
+
+static void order_remove(ChildOrder *order, TreeNode *treeNode, size_t size)
+{
+    OrderEntry **update[ORDER_MAX_HEIGHT];
+    OrderKey key = {treeNode->type, size, treeNode->name};
+
+    order_search(order, &key, update);
+    OrderEntry *entry = *update[0];
+    if (entry == NULL || entry->node != treeNode)
+    {
+        // a size changed without telling us, the entry is looked for the
+        // slow way, by its stored key
+        for (entry = order->head[0]; entry != NULL;
+             entry = entry->forward[0])
+        {
+            if (entry->node == treeNode)
+                break;
+        }
+        if (entry == NULL)
+            return;
+        entry_key(entry, &key);
+        order_search(order, &key, update);
+    }
+
+    for (unsigned int level = 0; level < entry->height; level++)
+        *update[level] = entry->forward[level];
+    free(entry);
+    order->count--;
+}
+
+ChildOrder *order_get(FolderContent *folder, enum ChildSort sort)
+{
+    for (ChildOrder *order = folder->orders; order != NULL;
+         order = order->next)
+    {
+        if (order->sort == sort)
+            return order;
+    }
+
+    ChildOrder *order = malloc(sizeof(ChildOrder));
+    DIE(!order, "malloc");
+    order->sort = sort;
+    order->seed = 2463534242u;
+    order->count = 0;
+    memset(order->head, 0, sizeof(order->head));
+    for (TreeNode *child = folder->head; child != NULL; child = child->next)
+        order_insert(order, child, node_size(child));
+    order->next = folder->orders;
+    folder->orders = order;
+    return order;
+}
+
+OrderEntry *order_after(ChildOrder *order, enum TreeNodeType type,
+                        size_t size, const char *name)
+{
+    OrderEntry **update[ORDER_MAX_HEIGHT];
+    OrderKey key = {type, size, name};
+
+    order_search(order, &key, update);
+    OrderEntry *entry = *update[0];
+    OrderKey current;
+    // the entry equal to the key is the one the page ended with
+    if (entry != NULL)
+    {
+        entry_key(entry, &current);
+        if (key_compare(order->sort, &current, &key) == 0)
+            entry = entry->forward[0];
+    }
+    return entry;
+}
+
+void order_link(FolderContent *folder, TreeNode *treeNode)
+{
+    for (ChildOrder *order = folder->orders; order != NULL;
+         order = order->next)
+        order_insert(order, treeNode, node_size(treeNode));
+}
+
+void order_unlink(FolderContent *folder, TreeNode *treeNode)
+{
+    for (ChildOrder *order = folder->orders; order != NULL;
+         order = order->next)
+        order_remove(order, treeNode, node_size(treeNode));
+}
+
+void order_resize(TreeNode *fileNode, size_t oldSize, size_t newSize)
+{
+    FolderContent *folder = fileNode->parent->content;
+
+    if (oldSize == newSize)
+        return;
+    for (ChildOrder *order = folder->orders; order != NULL;
+         order = order->next)
+    {
+        // only the size order moves the file
+        if (order->sort != SORT_SIZE)
+            continue;
+        order_remove(order, fileNode, oldSize);
+        order_insert(order, fileNode, newSize);
+    }
+}
+
+void order_destroy(FolderContent *folder)
+{
+    while (folder->orders != NULL)
+    {
+        ChildOrder *order = folder->orders;
+        OrderEntry *entry = order->head[0];
+        while (entry != NULL)
+        {
+            OrderEntry *next = entry->forward[0];
+            free(entry);
+            entry = next;
+        }
+        folder->orders = order->next;
+        free(order);
+    }
+}
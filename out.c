@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include "tree.h"
+
+// every command writes its output here, it only reaches stdout on flush
+static char outputBuffer[OUTPUT_BUFFER_SIZE];
+static size_t outputLength;
+// while muted, the output is dropped
+static int outputMuted;
+
+void out_mute(int muted)
+{
+    outputMuted = muted;
+}
+
+void out_flush()
+{
+    if (outputLength == 0)
+        return;
+    fwrite(outputBuffer, 1, outputLength, stdout);
+    fflush(stdout);
+    outputLength = 0;
+}
+
+void out_write(const char *data, size_t len)
+{
+    if (outputMuted)
+        return;
+    // if the data doesn't fit, we make room for it
+    if (len > OUTPUT_BUFFER_SIZE - outputLength)
+    {
+        out_flush();
+        // anything bigger than the whole buffer goes out directly
+        if (len >= OUTPUT_BUFFER_SIZE)
+        {
+            fwrite(data, 1, len, stdout);
+            return;
+        }
+    }
+    memcpy(outputBuffer + outputLength, data, len);
+    outputLength += len;
+}
+
+void out_pad(size_t width)
+{
+    static const char spaces[] = "                                ";
+
+    while (width > 0)
+    {
+        size_t len = width < sizeof(spaces) - 1 ? width : sizeof(spaces) - 1;
+        out_write(spaces, len);
+        width -= len;
+    }
+}
+
+void out_puts(const char *string)
+{
+    out_write(string, strlen(string));
+}
+
+void out_printf(const char *format, ...)
+{
+    va_list args;
+    size_t room = OUTPUT_BUFFER_SIZE - outputLength;
+
+    if (outputMuted)
+        return;
+    // we format straight in the buffer
+    va_start(args, format);
+    int len = vsnprintf(outputBuffer + outputLength, room, format, args);
+    va_end(args);
+    DIE(len < 0, "vsnprintf");
+    if ((size_t)len < room)
+    {
+        outputLength += len;
+        return;
+    }
+
+    // if it didn't fit, we format it again after a flush
+    out_flush();
+    if ((size_t)len < OUTPUT_BUFFER_SIZE)
+    {
+        va_start(args, format);
+        vsnprintf(outputBuffer, OUTPUT_BUFFER_SIZE, format, args);
+        va_end(args);
+        outputLength = len;
+        return;
+    }
+
+    // the text is bigger than the whole buffer
+    char *text = malloc(len + 1);
+    DIE(!text, "malloc");
+    va_start(args, format);
+    vsnprintf(text, len + 1, format, args);
+    va_end(args);
+    fwrite(text, 1, len, stdout);
+    free(text);
+}
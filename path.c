@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+
+typedef struct Dentry Dentry;
+
+/*
+ * A cached (parent, name) -> child lookup. The cache is direct mapped,
+ * a colliding insert just replaces the older entry.
+ */
+struct Dentry {
+    TreeNode* parent;
+    TreeNode* child;
+    unsigned int hash;
+    unsigned int generation;
+};
+
+static Dentry dentryCache[DENTRY_CACHE_SIZE];
+// entries from an older generation are treated as empty
+static unsigned int dentryGeneration = 1;
+
+static unsigned int dc_slot(TreeNode *parent, unsigned int hash)
+{
+    uintptr_t key = (uintptr_t)parent >> 4;
+    key ^= hash * 2654435761u;
+    return (unsigned int)(key ^ (key >> 16)) & (DENTRY_CACHE_SIZE - 1);
+}
+
+void dc_invalidate()
+{
+    // we drop every cached entry at once by moving to a new generation,
+    // shared trees may unlink nodes from several threads at once
+    if (__atomic_add_fetch(&dentryGeneration, 1, __ATOMIC_RELAXED) == 0)
+    {
+        memset(dentryCache, 0, sizeof(dentryCache));
+        dentryGeneration = 1;
+    }
+}
+
+TreeNode *dc_lookup(TreeNode *parent, const char *name, size_t len)
+{
+    unsigned int hash = name_hash(name, len);
+    Dentry *dentry = &dentryCache[dc_slot(parent, hash)];
+
+    // on a hit, we still check the name in case two names share a hash
+    if (dentry->generation == dentryGeneration && dentry->parent == parent &&
+        dentry->hash == hash && strncmp(dentry->child->name, name, len) == 0 &&
+        dentry->child->name[len] == '\0')
+        return dentry->child;
+
+    // on a miss, we search the folder and remember what we found
+    TreeNode *child = folder_lookup(parent->content, name, len);
+    if (child != NULL)
+    {
+        dentry->parent = parent;
+        dentry->child = child;
+        dentry->hash = hash;
+        dentry->generation = dentryGeneration;
+    }
+    return child;
+}
+
+/*
+ * A symlink on the way is replaced by where its target leads, from the
+ * folder holding it, or from the root for a target starting with a
+ * slash. The last component is only followed if the caller asks for it,
+ * and a path following too many symlinks is taken for a loop.
+ */
+static int resolve_from(TreeNode *start, const char *path, PathLookup *lookup,
+                        int followLast, unsigned int *follows)
+{
+    TreeNode *currentNode = start;
+    const char *component = path;
+
+    // an empty path resolves to the start node
+    lookup->node = start;
+    lookup->parent = start->parent;
+    lookup->last = NULL;
+    lookup->last_len = 0;
+    lookup->error = RESOLVE_OK;
+
+    while (*component == '/')
+        component++;
+    while (*component != '\0')
+    {
+        size_t len = strcspn(component, "/");
+        const char *next = component + len;
+        while (*next == '/')
+            next++;
+
+        // we can only go through folders
+        if (currentNode->type != FOLDER_NODE)
+        {
+            lookup->node = NULL;
+            lookup->error = RESOLVE_NOT_DIR;
+            return -1;
+        }
+
+        TreeNode *child;
+        // we check if the node we want to go to is a parent node
+        if (len == strlen(PARENT_DIR) && !strncmp(component, PARENT_DIR, len))
+        {
+            // there is nothing above the root node
+            if (currentNode->parent == NULL)
+            {
+                lookup->node = NULL;
+                lookup->error = RESOLVE_ABOVE_ROOT;
+                return -1;
+            }
+            child = currentNode->parent;
+            lookup->parent = child->parent;
+        }
+        else
+        {
+            child = dc_lookup(currentNode, component, len);
+            lookup->parent = currentNode;
+        }
+        lookup->node = child;
+        lookup->last = component;
+        lookup->last_len = len;
+
+        // only the last component of the path is allowed to be missing
+        if (child == NULL)
+        {
+            if (*next == '\0')
+                return 0;
+            lookup->error = RESOLVE_NOT_FOUND;
+            return -1;
+        }
+
+        if (child->type == SYMLINK_NODE && (*next != '\0' || followLast))
+        {
+            if (++*follows > SYMLINK_MAX_FOLLOWS)
+            {
+                lookup->node = NULL;
+                lookup->error = RESOLVE_LOOP;
+                return -1;
+            }
+            const char *target = ((FileContent *)child->content)->target;
+            TreeNode *from = lookup->parent;
+            if (*target == '/')
+            {
+                while (from->parent != NULL)
+                    from = from->parent;
+            }
+            if (resolve_from(from, target, lookup, 1, follows) < 0)
+                return -1;
+            // a symlink to nothing only ends a path, which then names
+            // what it points to
+            if (lookup->node == NULL && *next != '\0')
+            {
+                lookup->error = RESOLVE_NOT_FOUND;
+                return -1;
+            }
+            child = lookup->node;
+        }
+
+        currentNode = child;
+        component = next;
+    }
+    return 0;
+}
+
+int resolve_path(TreeNode *start, const char *path, PathLookup *lookup)
+{
+    unsigned int follows = 0;
+    return resolve_from(start, path, lookup, 1, &follows);
+}
+
+int resolve_entry(TreeNode *start, const char *path, PathLookup *lookup)
+{
+    unsigned int follows = 0;
+    return resolve_from(start, path, lookup, 0, &follows);
+}
+
+/*
+ * Every folder can cache its full path, built from its parent's, so a
+ * cached folder always has a cached parent. A mv drops the caches of the
+ * subtree it moves, they are rebuilt the next time they are asked for.
+ */
+const char *folder_path(TreeNode *folderNode, size_t *length)
+{
+    FolderContent *folder = folderNode->content;
+    if (folder->path != NULL)
+    {
+        *length = folder->pathLength;
+        return folder->path;
+    }
+
+    // we find the uncached folders up to a cached one, then build their
+    // paths top down
+    size_t count = 0;
+    for (TreeNode *node = folderNode;
+         node != NULL && ((FolderContent *)node->content)->path == NULL;
+         node = node->parent)
+        count++;
+    TreeNode **chain = malloc(count * sizeof(TreeNode *));
+    DIE(!chain, "malloc");
+    TreeNode *node = folderNode;
+    for (size_t i = count; i > 0; i--, node = node->parent)
+        chain[i - 1] = node;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        FolderContent *content = chain[i]->content;
+        size_t nameLength = strlen(chain[i]->name);
+        TreeNode *parent = chain[i]->parent;
+        if (parent == NULL)
+        {
+            content->path = malloc(nameLength + 1);
+            DIE(!content->path, "malloc");
+            memcpy(content->path, chain[i]->name, nameLength + 1);
+            content->pathLength = nameLength;
+            // the root is an empty path under itself
+            content->pathStart = nameLength;
+            continue;
+        }
+
+        FolderContent *parentContent = parent->content;
+        size_t parentLength = parentContent->pathLength;
+        content->path = malloc(parentLength + 1 + nameLength + 1);
+        DIE(!content->path, "malloc");
+        memcpy(content->path, parentContent->path, parentLength);
+        content->path[parentLength] = '/';
+        memcpy(content->path + parentLength + 1, chain[i]->name,
+               nameLength + 1);
+        content->pathLength = parentLength + 1 + nameLength;
+        content->pathStart = parent->parent == NULL ? parentLength + 1 :
+                                                      parentContent->pathStart;
+    }
+    free(chain);
+
+    *length = folder->pathLength;
+    return folder->path;
+}
+
+void path_invalidate(TreeNode *folderNode)
+{
+    FolderContent *folder = folderNode->content;
+
+    // nothing under an uncached folder is cached
+    if (folder->path == NULL)
+        return;
+    free(folder->path);
+    folder->path = NULL;
+
+    TreeWalk walk;
+    TreeNode *node;
+    walk_start(&walk, folderNode);
+    while ((node = walk_next(&walk)) != NULL)
+    {
+        if (node->type != FOLDER_NODE || walk.leaving)
+            continue;
+        FolderContent *content = node->content;
+        if (content->path == NULL)
+        {
+            walk_skip(&walk);
+            continue;
+        }
+        free(content->path);
+        content->path = NULL;
+    }
+    walk_end(&walk);
+}
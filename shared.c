@@ -0,0 +1,845 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include "tree.h"
+
+/*
+ * Readers never lock: they walk the tree inside an epoch (see epoch.c), so
+ * whatever they reach stays allocated until they leave it, and removed
+ * nodes are retired instead of freed. Listings are weakly consistent, like
+ * readdir: a child added or removed meanwhile may or may not show up.
+ *
+ * Writers lock the folder they change, for writing, once their walk got
+ * there. Every folder has a rwlock, and tree walks take it for reading
+ * top down, with lock coupling. The only commands that lock two folders
+ * side by side (mv, rmdir, rmrec) do it under the tree's rename lock,
+ * parents before children, unrelated folders in address order.
+ *
+ * A mv bumps the rename sequence around relinking a node, so a walk that
+ * raced with it may have ended up in the wrong place and starts over.
+ */
+
+static void lock_folder(TreeNode *folderNode, int write)
+{
+    FolderContent *folder = folderNode->content;
+
+    if (write)
+        pthread_rwlock_wrlock(&folder->lock);
+    else
+        pthread_rwlock_rdlock(&folder->lock);
+}
+
+static void unlock_folder(TreeNode *folderNode)
+{
+    pthread_rwlock_unlock(&((FolderContent *)folderNode->content)->lock);
+}
+
+static int folder_removed(TreeNode *folderNode)
+{
+    return ((FolderContent *)folderNode->content)->removed;
+}
+
+static void lock_pair(TreeNode *first, TreeNode *second)
+{
+    if (first == second)
+    {
+        lock_folder(first, 1);
+        return;
+    }
+    if (is_ancestor(second, first) ||
+        (!is_ancestor(first, second) &&
+         (uintptr_t)second < (uintptr_t)first))
+    {
+        TreeNode *swap = first;
+        first = second;
+        second = swap;
+    }
+    lock_folder(first, 1);
+    lock_folder(second, 1);
+}
+
+static void unlock_pair(TreeNode *first, TreeNode *second)
+{
+    unlock_folder(first);
+    if (second != first)
+        unlock_folder(second);
+}
+
+static unsigned int read_begin(SharedTree *shared)
+{
+    unsigned int seq;
+
+    // we wait for a mv in progress to be done
+    while ((seq = __atomic_load_n(&shared->renameSeq, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+    return seq;
+}
+
+static int read_retry(SharedTree *shared, unsigned int seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&shared->renameSeq, __ATOMIC_RELAXED) != seq;
+}
+
+// returns a copy of the path with its ".." resolved and without any
+// empty component, like "a/b/c", the root is the empty path
+static char *normalize(const char *path)
+{
+    char *normalized = malloc(strlen(path) + 1);
+    DIE(!normalized, "malloc");
+    size_t length = 0;
+
+    while (*path != '\0')
+    {
+        size_t len = strcspn(path, "/");
+        if (len == strlen(PARENT_DIR) && !strncmp(path, PARENT_DIR, len))
+        {
+            // there is nothing above the root node
+            if (length == 0)
+            {
+                free(normalized);
+                errno = ENOENT;
+                return NULL;
+            }
+            while (length > 0 && normalized[length - 1] != '/')
+                length--;
+            if (length > 0)
+                length--;
+        }
+        else if (len > 0)
+        {
+            if (length > 0)
+                normalized[length++] = '/';
+            memcpy(normalized + length, path, len);
+            length += len;
+        }
+        path += len;
+        while (*path == '/')
+            path++;
+    }
+    normalized[length] = '\0';
+    return normalized;
+}
+
+/*
+ * Walks a normalized path down to the folder holding its last component,
+ * without any lock, so the caller has to be inside an epoch. last is set
+ * to the last component, or to NULL for the root.
+ */
+static TreeNode *walk(SharedTree *shared, char *path, char **last)
+{
+    TreeNode *folder = shared->tree.root;
+    char *component = path;
+    char *slash;
+
+    while ((slash = strchr(component, '/')) != NULL)
+    {
+        TreeNode *child = folder_lookup(folder->content, component,
+                                        slash - component);
+        if (child == NULL || child->type != FOLDER_NODE)
+        {
+            errno = child == NULL ? ENOENT : ENOTDIR;
+            return NULL;
+        }
+        folder = child;
+        component = slash + 1;
+    }
+
+    *last = *component != '\0' ? component : NULL;
+    return folder;
+}
+
+// like walk, but it goes down to the node itself and it starts over if
+// a mv got in its way
+static TreeNode *lookup_node(SharedTree *shared, char *path)
+{
+    TreeNode *node;
+    char *last;
+    unsigned int seq;
+
+    do
+    {
+        seq = read_begin(shared);
+        node = walk(shared, path, &last);
+        if (node != NULL && last != NULL)
+        {
+            node = folder_find(node->content, last);
+            if (node == NULL)
+                errno = ENOENT;
+        }
+    } while (read_retry(shared, seq));
+    return node;
+}
+
+// walks to the folder holding the last component and write locks it
+static TreeNode *lock_parent(SharedTree *shared, char *path, char **last)
+{
+    while (1)
+    {
+        unsigned int seq = read_begin(shared);
+        TreeNode *folder = walk(shared, path, last);
+        if (folder == NULL)
+        {
+            if (!read_retry(shared, seq))
+                return NULL;
+            continue;
+        }
+
+        // the folder may have moved or gone away before we locked it
+        lock_folder(folder, 1);
+        if (!read_retry(shared, seq))
+        {
+            if (!folder_removed(folder))
+                return folder;
+            unlock_folder(folder);
+            errno = ENOENT;
+            return NULL;
+        }
+        unlock_folder(folder);
+    }
+}
+
+static char *intern_name(SharedTree *shared, const char *name)
+{
+    pthread_mutex_lock(&shared->memLock);
+    char *interned = arena_intern(&shared->tree.mem->names, name,
+                                  strlen(name));
+    pthread_mutex_unlock(&shared->memLock);
+    return interned;
+}
+
+/*
+ * Changes are carried up one at a time, so the parent links they follow
+ * can't change under them: mv relinks, and removals mark folders removed,
+ * under the same lock.
+ */
+static void update_stats(SharedTree *shared, TreeNode *folderNode,
+                         const TreeStats *added, const TreeStats *removed)
+{
+    pthread_mutex_lock(&shared->statsLock);
+    stats_update(folderNode, added, removed);
+    pthread_mutex_unlock(&shared->statsLock);
+}
+
+// other writers may be growing the inode table's columns meanwhile
+static void update_size(SharedTree *shared, TreeNode *fileNode,
+                        uint64_t size)
+{
+    TreeMem *mem = shared->tree.mem;
+
+    pthread_mutex_lock(&mem->inodes.lock);
+    inode_tick();
+    inode_resize(mem, fileNode, size);
+    pthread_mutex_unlock(&mem->inodes.lock);
+}
+
+// takes the node out of its folder's stats, then out of the folder
+static void unlink_node(SharedTree *shared, TreeNode *folder,
+                        TreeNode *treeNode)
+{
+    TreeStats stats;
+
+    pthread_mutex_lock(&shared->statsLock);
+    if (treeNode->type == FOLDER_NODE)
+        ((FolderContent *)treeNode->content)->removed = 1;
+    node_stats(treeNode, &stats);
+    stats_update(folder, NULL, &stats);
+    pthread_mutex_unlock(&shared->statsLock);
+    folder_unlink(folder->content, treeNode);
+}
+
+// the parent has to be write locked
+static TreeNode *create_node(SharedTree *shared, TreeNode *parent,
+                             const char *name, enum TreeNodeType type,
+                             FileData *data)
+{
+    TreeMem *mem = shared->tree.mem;
+
+    pthread_mutex_lock(&shared->memLock);
+    TreeNode *treeNode = pool_alloc(&mem->nodes);
+    treeNode->name = arena_intern(&mem->names, name, strlen(name));
+    if (type == FOLDER_NODE)
+        treeNode->content = folder_create(mem, treeNode);
+    else
+        file_init(mem, treeNode, pool_alloc(&mem->files), data, NULL);
+    treeNode->linkNext = NULL;
+    pthread_mutex_unlock(&shared->memLock);
+    index_add(mem, treeNode);
+
+    treeNode->parent = parent;
+    treeNode->type = type;
+    // once linked, a new folder may get children before we count it, and
+    // their stats go up through it already
+    TreeStats stats;
+    node_stats(treeNode, &stats);
+    folder_link(parent->content, treeNode);
+    update_stats(shared, parent, &stats, NULL);
+    return treeNode;
+}
+
+static void release_node(void *context, void *object)
+{
+    SharedTree *shared = context;
+
+    // the node's folder may have been freed before it, its memory is
+    // the tree's
+    pthread_mutex_lock(&shared->memLock);
+    freeNodeIn(shared->tree.mem, object);
+    pthread_mutex_unlock(&shared->memLock);
+}
+
+static void release_data(void *context, void *object)
+{
+    data_release(object);
+}
+
+static void release_name(void *context, void *object)
+{
+    SharedTree *shared = context;
+
+    name_release(shared->tree.mem, object);
+}
+
+// the node is freed, with its whole subtree, once no reader can see it
+static void retire_node(SharedTree *shared, TreeNode *treeNode)
+{
+    epoch_retire(release_node, shared, treeNode);
+}
+
+// a reader may still be taking a reference to data it just found
+static void retire_data(SharedTree *shared, FileData *data)
+{
+    if (data != NULL)
+        epoch_retire(release_data, shared, data);
+}
+
+// a reader may still be reading the name a node had before a mv
+static void retire_name(SharedTree *shared, char *name)
+{
+    epoch_retire(release_name, shared, name);
+}
+
+void shared_init(SharedTree *shared, FileTree fileTree)
+{
+    shared->tree = fileTree;
+    // the shared functions never cache paths, so they don't keep them
+    // up to date either: we drop the ones the tree had
+    path_invalidate(fileTree.root);
+    pthread_mutex_init(&shared->renameLock, NULL);
+    shared->renameSeq = 0;
+    pthread_mutex_init(&shared->memLock, NULL);
+    pthread_mutex_init(&shared->statsLock, NULL);
+}
+
+void shared_destroy(SharedTree *shared)
+{
+    // the retired nodes go back to the tree, the tree itself is left to
+    // its owner
+    epoch_barrier();
+    pthread_mutex_destroy(&shared->renameLock);
+    pthread_mutex_destroy(&shared->memLock);
+    pthread_mutex_destroy(&shared->statsLock);
+}
+
+int shared_stat(SharedTree *shared, const char *path)
+{
+    char *normalized = normalize(path);
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    TreeNode *node = lookup_node(shared, normalized);
+    int type = node ? (int)node->type : -1;
+    epoch_exit();
+    free(normalized);
+    return type;
+}
+
+int shared_ls(SharedTree *shared, const char *path, SharedVisit visit,
+              void *arg)
+{
+    char *normalized = normalize(path);
+    TreeNode **children = NULL;
+    size_t count, capacity = 0;
+    unsigned int seq;
+    TreeNode *node;
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    // we gather the children first, a mv may send us to another folder's
+    // children and then we start over
+    do
+    {
+        seq = read_begin(shared);
+        count = 0;
+        node = lookup_node(shared, normalized);
+        if (node == NULL)
+            continue;
+
+        // a file is listed by itself
+        TreeNode *child = node;
+        if (node->type == FOLDER_NODE)
+            child = __atomic_load_n(&((FolderContent *)node->content)->head,
+                                    __ATOMIC_ACQUIRE);
+        while (child != NULL)
+        {
+            if (count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                children = realloc(children, capacity * sizeof(TreeNode *));
+                DIE(!children, "realloc");
+            }
+            children[count++] = child;
+            if (node->type != FOLDER_NODE)
+                break;
+            child = __atomic_load_n(&child->next, __ATOMIC_ACQUIRE);
+        }
+    } while (read_retry(shared, seq));
+
+    // the nodes stay allocated until we leave the epoch
+    for (size_t i = 0; i < count; i++)
+        visit(arg, children[i], 0);
+    epoch_exit();
+    free(children);
+    free(normalized);
+    return node ? 0 : -1;
+}
+
+// the folder is read locked by the caller, the folders under it are read
+// locked while the walk is inside them
+static void visit_tree(TreeNode *folderNode, SharedVisit visit, void *arg)
+{
+    TreeWalk walk;
+    TreeNode *node;
+
+    walk_start(&walk, folderNode);
+    while ((node = walk_next(&walk)) != NULL)
+    {
+        if (walk.leaving)
+        {
+            unlock_folder(node);
+            continue;
+        }
+        visit(arg, node, (int)walk.level);
+        if (node->type == FOLDER_NODE)
+            lock_folder(node, 0);
+    }
+    walk_end(&walk);
+}
+
+int shared_tree(SharedTree *shared, const char *path, SharedVisit visit,
+                void *arg)
+{
+    char *normalized = normalize(path);
+    TreeNode *node;
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    // a whole subtree is listed under read locks, so it is seen at once
+    while (1)
+    {
+        unsigned int seq = read_begin(shared);
+        node = lookup_node(shared, normalized);
+        if (node == NULL || node->type != FOLDER_NODE)
+            break;
+        lock_folder(node, 0);
+        if (!read_retry(shared, seq) && !folder_removed(node))
+            break;
+        unlock_folder(node);
+    }
+    free(normalized);
+
+    if (node == NULL || node->type != FOLDER_NODE)
+    {
+        epoch_exit();
+        if (node != NULL)
+            errno = ENOTDIR;
+        return -1;
+    }
+    visit_tree(node, visit, arg);
+    unlock_folder(node);
+    epoch_exit();
+    return 0;
+}
+
+// creates the node the path names, unless it exists already
+static int create_path(SharedTree *shared, const char *path,
+                       enum TreeNodeType type, const char *text)
+{
+    char *normalized = normalize(path);
+    char *last;
+    int result = -1;
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    TreeNode *folder = lock_parent(shared, normalized, &last);
+    if (folder != NULL)
+    {
+        if (last == NULL || folder_find(folder->content, last) != NULL)
+            errno = EEXIST;
+        else
+        {
+            // the node is filled in before it is linked, readers only
+            // ever see it whole
+            FileData *data = NULL;
+            if (text != NULL)
+                data = data_create(text, strlen(text));
+            create_node(shared, folder, last, type, data);
+            result = 0;
+        }
+        unlock_folder(folder);
+    }
+    epoch_exit();
+    free(normalized);
+    return result;
+}
+
+int shared_mkdir(SharedTree *shared, const char *path)
+{
+    return create_path(shared, path, FOLDER_NODE, NULL);
+}
+
+int shared_touch(SharedTree *shared, const char *path, const char *text)
+{
+    // like touch, an existing file is left as it is
+    if (create_path(shared, path, FILE_NODE, text) < 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+int shared_rm(SharedTree *shared, const char *path)
+{
+    char *normalized = normalize(path);
+    TreeNode *treeNode = NULL;
+    char *last;
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    TreeNode *folder = lock_parent(shared, normalized, &last);
+    if (folder != NULL)
+    {
+        treeNode = last ? folder_find(folder->content, last) : folder;
+        if (treeNode == NULL || treeNode->type == FOLDER_NODE)
+        {
+            errno = treeNode == NULL ? ENOENT : EISDIR;
+            treeNode = NULL;
+        }
+        else
+            unlink_node(shared, folder, treeNode);
+        unlock_folder(folder);
+    }
+    if (treeNode != NULL)
+        retire_node(shared, treeNode);
+    epoch_exit();
+    free(normalized);
+    return treeNode ? 0 : -1;
+}
+
+// removes the folder the path names, with everything in it if recursive
+// is set, under the rename lock
+static TreeNode *remove_folder(SharedTree *shared, char *path, int recursive)
+{
+    char *last;
+
+    // no folder can move or go away while we hold the rename lock, so
+    // the walk can't be misled
+    TreeNode *folder = walk(shared, path, &last);
+    if (folder == NULL)
+        return NULL;
+    if (last == NULL)
+    {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    lock_folder(folder, 1);
+    TreeNode *treeNode = folder_find(folder->content, last);
+    if (treeNode == NULL || (!recursive && treeNode->type != FOLDER_NODE))
+    {
+        unlock_folder(folder);
+        errno = treeNode == NULL ? ENOENT : ENOTDIR;
+        return NULL;
+    }
+
+    // the writers that got in before us are done once we have its lock,
+    // the ones that come after find it removed
+    if (treeNode->type == FOLDER_NODE)
+    {
+        lock_folder(treeNode, 1);
+        if (!recursive && ((FolderContent *)treeNode->content)->size != 0)
+        {
+            unlock_pair(folder, treeNode);
+            errno = ENOTEMPTY;
+            return NULL;
+        }
+    }
+    unlink_node(shared, folder, treeNode);
+    if (treeNode->type == FOLDER_NODE)
+        unlock_folder(treeNode);
+    unlock_folder(folder);
+    return treeNode;
+}
+
+int shared_rmdir(SharedTree *shared, const char *path)
+{
+    char *normalized = normalize(path);
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    pthread_mutex_lock(&shared->renameLock);
+    TreeNode *treeNode = remove_folder(shared, normalized, 0);
+    pthread_mutex_unlock(&shared->renameLock);
+    if (treeNode != NULL)
+        retire_node(shared, treeNode);
+    epoch_exit();
+    free(normalized);
+    return treeNode ? 0 : -1;
+}
+
+int shared_rmrec(SharedTree *shared, const char *path)
+{
+    char *normalized = normalize(path);
+
+    if (normalized == NULL)
+        return -1;
+    epoch_enter();
+    pthread_mutex_lock(&shared->renameLock);
+    TreeNode *treeNode = remove_folder(shared, normalized, 1);
+    pthread_mutex_unlock(&shared->renameLock);
+    // the readers still inside the subtree keep it alive
+    if (treeNode != NULL)
+        retire_node(shared, treeNode);
+    epoch_exit();
+    free(normalized);
+    return treeNode ? 0 : -1;
+}
+
+int shared_cp(SharedTree *shared, const char *source,
+              const char *destination)
+{
+    char *sourcePath = normalize(source);
+    char *destinationPath = normalize(destination);
+    int result = -1;
+    char *last;
+
+    if (sourcePath == NULL || destinationPath == NULL)
+    {
+        free(sourcePath);
+        free(destinationPath);
+        return -1;
+    }
+
+    epoch_enter();
+    TreeNode *sourceNode = lookup_node(shared, sourcePath);
+    TreeNode *folder = NULL;
+    FileData *data = NULL;
+    if (sourceNode != NULL && sourceNode->type == FOLDER_NODE)
+        errno = EISDIR;
+    else if (sourceNode != NULL)
+    {
+        // we share the data the source has right now, it can't be
+        // released before we leave the epoch
+        data = data_hold(__atomic_load_n(
+            &((FileContent *)sourceNode->content)->data, __ATOMIC_ACQUIRE));
+        folder = lock_parent(shared, destinationPath, &last);
+    }
+
+    if (folder != NULL)
+    {
+        // if the destination is a folder, we copy the file inside it
+        // else the destination names the copy
+        char *name = sourceNode->name;
+        if (last != NULL)
+        {
+            TreeNode *node = folder_find(folder->content, last);
+            if (node != NULL && node->type == FOLDER_NODE)
+            {
+                // we hold its parent, so it can't be removed meanwhile
+                lock_folder(node, 1);
+                unlock_folder(folder);
+                folder = node;
+            }
+            else
+                name = last;
+        }
+
+        TreeNode *destinationNode = folder_find(folder->content, name);
+        if (destinationNode != NULL && destinationNode->type == FOLDER_NODE)
+            errno = EISDIR;
+        else if (destinationNode == NULL)
+        {
+            create_node(shared, folder, name, FILE_NODE, data);
+            data = NULL;
+            result = 0;
+        }
+        else
+        {
+            // readers may still be reading the old data
+            FileContent *content = destinationNode->content;
+            FileData *old = content->data;
+            TreeStats newBytes = {0, 0, data_size(data)};
+            TreeStats oldBytes = {0, 0, data_size(old)};
+            __atomic_store_n(&content->data, data, __ATOMIC_RELEASE);
+            update_stats(shared, folder, &newBytes, &oldBytes);
+            update_size(shared, destinationNode, newBytes.bytes);
+            order_resize(destinationNode, oldBytes.bytes, newBytes.bytes);
+            retire_data(shared, old);
+            data = NULL;
+            result = 0;
+        }
+        unlock_folder(folder);
+    }
+    epoch_exit();
+    data_release(data);
+    free(sourcePath);
+    free(destinationPath);
+    return result;
+}
+
+// moves the source with both folders write locked by the caller
+static int move_node(SharedTree *shared, TreeNode *sourceFolder,
+                     const char *sourceName, TreeNode *destinationFolder,
+                     const char *name, TreeNode **removed)
+{
+    TreeNode *sourceNode = folder_find(sourceFolder->content, sourceName);
+    if (sourceNode == NULL)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    TreeNode *destinationNode = folder_find(destinationFolder->content,
+                                            name ? name : sourceNode->name);
+    if (destinationNode == sourceNode)
+        return 0;
+
+    // a folder can't be moved inside itself
+    if (is_ancestor(sourceNode, destinationFolder))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (destinationNode != NULL)
+    {
+        if (destinationNode->type == FOLDER_NODE)
+        {
+            errno = EISDIR;
+            return -1;
+        }
+        if (sourceNode->type == FOLDER_NODE)
+        {
+            errno = ENOTDIR;
+            return -1;
+        }
+
+        // the destination file takes over the source content
+        FileContent *destinationContent = destinationNode->content;
+        FileContent *sourceContent = sourceNode->content;
+        TreeStats newBytes = {0, 0, data_size(sourceContent->data)};
+        TreeStats oldBytes = {0, 0, data_size(destinationContent->data)};
+        retire_data(shared, destinationContent->data);
+        __atomic_store_n(&destinationContent->data, sourceContent->data,
+                         __ATOMIC_RELEASE);
+        __atomic_store_n(&sourceContent->data, NULL, __ATOMIC_RELEASE);
+        update_stats(shared, destinationFolder, &newBytes, &oldBytes);
+        update_size(shared, destinationNode, newBytes.bytes);
+        order_resize(destinationNode, oldBytes.bytes, newBytes.bytes);
+        order_resize(sourceNode, newBytes.bytes, 0);
+        // and the source is removed, the caller retires it
+        unlink_node(shared, sourceFolder, sourceNode);
+        *removed = sourceNode;
+        return 0;
+    }
+
+    // walks that raced with the relinking start over
+    unsigned int seq = shared->renameSeq;
+    __atomic_store_n(&shared->renameSeq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    // the node's stats move along with it
+    TreeStats stats;
+    char *oldName = NULL;
+    pthread_mutex_lock(&shared->statsLock);
+    node_stats(sourceNode, &stats);
+    stats_update(sourceFolder, NULL, &stats);
+    folder_unlink(sourceFolder->content, sourceNode);
+    if (name != NULL)
+    {
+        oldName = sourceNode->name;
+        index_remove(shared->tree.mem, sourceNode);
+        __atomic_store_n(&sourceNode->name, intern_name(shared, name),
+                         __ATOMIC_RELEASE);
+        index_add(shared->tree.mem, sourceNode);
+    }
+    sourceNode->parent = destinationFolder;
+    folder_link(destinationFolder->content, sourceNode);
+    stats_update(destinationFolder, &stats, NULL);
+    pthread_mutex_unlock(&shared->statsLock);
+
+    __atomic_store_n(&shared->renameSeq, seq + 2, __ATOMIC_RELEASE);
+    if (oldName != NULL)
+        retire_name(shared, oldName);
+    return 0;
+}
+
+int shared_mv(SharedTree *shared, const char *source,
+              const char *destination)
+{
+    char *sourcePath = normalize(source);
+    char *destinationPath = normalize(destination);
+    TreeNode *removed = NULL;
+    char *sourceName, *name;
+    int result = -1;
+
+    if (sourcePath == NULL || destinationPath == NULL)
+    {
+        free(sourcePath);
+        free(destinationPath);
+        return -1;
+    }
+
+    epoch_enter();
+    // with the rename lock held no folder can move or go away, so the
+    // folders we find stay where they are until we lock them
+    pthread_mutex_lock(&shared->renameLock);
+    TreeNode *sourceFolder = walk(shared, sourcePath, &sourceName);
+    TreeNode *folder = NULL;
+    if (sourceFolder != NULL && sourceName == NULL)
+        errno = EBUSY;
+    else if (sourceFolder != NULL)
+        folder = walk(shared, destinationPath, &name);
+
+    if (folder != NULL)
+    {
+        // if the destination is a folder, we move the source inside it
+        // else the destination gives the new name of the source
+        TreeNode *destinationFolder = folder;
+        TreeNode *node = name ? folder_find(folder->content, name) : NULL;
+        if (node != NULL && node->type == FOLDER_NODE)
+        {
+            destinationFolder = node;
+            name = NULL;
+        }
+
+        lock_pair(sourceFolder, destinationFolder);
+        result = move_node(shared, sourceFolder, sourceName,
+                           destinationFolder, name, &removed);
+        unlock_pair(sourceFolder, destinationFolder);
+    }
+    pthread_mutex_unlock(&shared->renameLock);
+
+    if (removed != NULL)
+        retire_node(shared, removed);
+    epoch_exit();
+    free(sourcePath);
+    free(destinationPath);
+    return result;
+}
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/sysinfo.h>
+#include <pthread.h>
+#include "tree.h"
+#define BENCH_MAX_THREADS 64
+#define BENCH_MILLIS 500
+#define BENCH_FOLDERS 32
+#define BENCH_FILES 32
+#define BENCH_PATH_LENGTH 64
+
+/*
+ * How lookups through the shared functions scale with the readers: a
+ * tree of folders, subfolders and files is built, then 1, 2, 4 ... up to
+ * 64 readers run stat on random paths, with one ls in a hundred, for a
+ * while each round. A writer may keep making and removing files in the
+ * same folders meanwhile. Run it with make bench, or as
+ * shared_bench [max readers] [milliseconds per round] [writers].
+ */
+
+typedef struct BenchThread {
+    pthread_t thread;
+    SharedTree* shared;
+    unsigned int seed;
+    uint64_t ops;
+    // the nodes ls went over
+    uint64_t seen;
+} BenchThread;
+
+static int benchDone;
+
+static void random_path(unsigned int *seed, char *path)
+{
+    snprintf(path, BENCH_PATH_LENGTH, "d%d/e%d/f%d",
+             rand_r(seed) % BENCH_FOLDERS, rand_r(seed) % BENCH_FOLDERS,
+             rand_r(seed) % BENCH_FILES);
+}
+
+static void count_node(void *arg, TreeNode *node, int depth)
+{
+    ((BenchThread *)arg)->seen++;
+}
+
+static void *reader(void *arg)
+{
+    BenchThread *bench = arg;
+    char path[BENCH_PATH_LENGTH];
+
+    while (!__atomic_load_n(&benchDone, __ATOMIC_ACQUIRE))
+    {
+        random_path(&bench->seed, path);
+        if (rand_r(&bench->seed) % 100 == 0)
+        {
+            // the folder holding the file
+            *strrchr(path, '/') = '\0';
+            shared_ls(bench->shared, path, count_node, bench);
+        }
+        else
+            shared_stat(bench->shared, path);
+        bench->ops++;
+    }
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    BenchThread *bench = arg;
+    char path[BENCH_PATH_LENGTH];
+
+    while (!__atomic_load_n(&benchDone, __ATOMIC_ACQUIRE))
+    {
+        random_path(&bench->seed, path);
+        // the files are put back right away, the readers keep finding
+        // most of them
+        shared_rm(bench->shared, path);
+        shared_touch(bench->shared, path, "x");
+        bench->ops++;
+    }
+    return NULL;
+}
+
+static uint64_t now_nanos()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// runs the readers and writers for a while, returns the readers' ops
+static double run_round(SharedTree *shared, int readers, int writers,
+                        int millis, uint64_t *writes)
+{
+    BenchThread threads[BENCH_MAX_THREADS + BENCH_MAX_THREADS];
+
+    __atomic_store_n(&benchDone, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < readers + writers; i++)
+    {
+        threads[i].shared = shared;
+        threads[i].seed = i + 1;
+        threads[i].ops = 0;
+        threads[i].seen = 0;
+        errno = pthread_create(&threads[i].thread, NULL,
+                               i < readers ? reader : writer, &threads[i]);
+        DIE(errno != 0, "pthread_create");
+    }
+    uint64_t start = now_nanos();
+    struct timespec wait = {millis / 1000, (long)(millis % 1000) * 1000000};
+    nanosleep(&wait, NULL);
+    __atomic_store_n(&benchDone, 1, __ATOMIC_RELEASE);
+
+    uint64_t reads = 0;
+    *writes = 0;
+    for (int i = 0; i < readers + writers; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        if (i < readers)
+            reads += threads[i].ops;
+        else
+            *writes += threads[i].ops;
+    }
+    return reads / ((now_nanos() - start) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+    int maxReaders = argc > 1 ? atoi(argv[1]) : BENCH_MAX_THREADS;
+    int millis = argc > 2 ? atoi(argv[2]) : BENCH_MILLIS;
+    int writers = argc > 3 ? atoi(argv[3]) : 0;
+    char path[BENCH_PATH_LENGTH];
+
+    if (maxReaders < 1 || maxReaders > BENCH_MAX_THREADS || millis < 1 ||
+        writers < 0 || writers > BENCH_MAX_THREADS)
+    {
+        fprintf(stderr, "usage: %s [1-%d readers] [milliseconds] "
+                "[writers]\n", argv[0], BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    FileTree fileTree = createFileTree("root");
+    SharedTree shared;
+    shared_init(&shared, fileTree);
+    for (int i = 0; i < BENCH_FOLDERS; i++)
+    {
+        snprintf(path, sizeof(path), "d%d", i);
+        shared_mkdir(&shared, path);
+        for (int j = 0; j < BENCH_FOLDERS; j++)
+        {
+            snprintf(path, sizeof(path), "d%d/e%d", i, j);
+            shared_mkdir(&shared, path);
+            for (int k = 0; k < BENCH_FILES; k++)
+            {
+                snprintf(path, sizeof(path), "d%d/e%d/f%d", i, j, k);
+                shared_touch(&shared, path, "x");
+            }
+        }
+    }
+
+    printf("%d cores, %d writers, %d ms per round\n", get_nprocs(), writers,
+           millis);
+    printf("readers\tlookups/s\tper reader\tscaling\twrites/s\n");
+    double single = 0;
+    for (int readers = 1; readers <= maxReaders; readers *= 2)
+    {
+        uint64_t writes;
+        double rate = run_round(&shared, readers, writers, millis, &writes);
+        if (readers == 1)
+            single = rate;
+        printf("%d\t%.0f\t%.0f\t%.2fx\t%.0f\n", readers, rate,
+               rate / readers, rate / single, writes * 1000.0 / millis);
+    }
+
+    shared_destroy(&shared);
+    freeTree(fileTree);
+    return 0;
+}
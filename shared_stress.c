@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include "tree.h"
+#define STRESS_READERS 4
+#define STRESS_WRITERS 3
+#define STRESS_OPS 100000
+#define STRESS_FOLDERS 6
+#define STRESS_FILES 6
+#define STRESS_PATH_LENGTH 64
+
+/*
+ * Readers and writers hammering the shared functions at once, over a few
+ * folders and files so they keep running into each other: the writers
+ * make, write, copy, move and remove nodes while the readers look them
+ * up, list them and walk them. Once they are done, every folder's stats
+ * have to match what is in it. Run it with make stress, or built with a
+ * sanitizer through make stress-asan and make stress-tsan, as
+ * shared_stress [readers] [writers] [operations per writer].
+ */
+
+typedef struct StressThread {
+    pthread_t thread;
+    SharedTree* shared;
+    unsigned int seed;
+    size_t ops;
+    // how many operations a writer runs
+    size_t count;
+    // what the reader saw, so the walks aren't optimized away
+    size_t seen;
+} StressThread;
+
+static int readersDone;
+
+// a folder, or a folder inside it, or a file in either
+static void random_path(unsigned int *seed, char *path, int file)
+{
+    int length = snprintf(path, STRESS_PATH_LENGTH, "d%d",
+                          rand_r(seed) % STRESS_FOLDERS);
+    if (rand_r(seed) % 2)
+        length += snprintf(path + length, STRESS_PATH_LENGTH - length,
+                           "/e%d", rand_r(seed) % STRESS_FOLDERS);
+    if (file)
+        snprintf(path + length, STRESS_PATH_LENGTH - length, "/f%d",
+                 rand_r(seed) % STRESS_FILES);
+}
+
+static void count_node(void *arg, TreeNode *node, int depth)
+{
+    StressThread *stress = arg;
+
+    // the name is read to make sure the node is still there, a mv may be
+    // renaming it meanwhile
+    stress->seen += __atomic_load_n(&node->name, __ATOMIC_ACQUIRE)[0] != '\0';
+}
+
+static void *reader(void *arg)
+{
+    StressThread *stress = arg;
+    char path[STRESS_PATH_LENGTH];
+
+    while (!__atomic_load_n(&readersDone, __ATOMIC_ACQUIRE))
+    {
+        int op = rand_r(&stress->seed) % 8;
+        random_path(&stress->seed, path, op < 4);
+        if (op < 4)
+            stress->seen += shared_stat(stress->shared, path) >= 0;
+        else if (op < 7)
+            shared_ls(stress->shared, path, count_node, stress);
+        else
+            shared_tree(stress->shared, path, count_node, stress);
+        stress->ops++;
+    }
+    return NULL;
+}
+
+static void *writer(void *arg)
+{
+    StressThread *stress = arg;
+    char path[STRESS_PATH_LENGTH];
+    char other[STRESS_PATH_LENGTH];
+
+    for (size_t i = 0; i < stress->count; i++)
+    {
+        int op = rand_r(&stress->seed) % 10;
+        random_path(&stress->seed, path, op >= 2 && op <= 5);
+        switch (op)
+        {
+        case 0:
+        case 1:
+            shared_mkdir(stress->shared, path);
+            break;
+        case 2:
+        case 3:
+            shared_touch(stress->shared, path, "some text");
+            break;
+        case 4:
+            shared_rm(stress->shared, path);
+            break;
+        case 5:
+            random_path(&stress->seed, other, 1);
+            shared_cp(stress->shared, path, other);
+            break;
+        case 6:
+            random_path(&stress->seed, other, 0);
+            shared_mv(stress->shared, path, other);
+            break;
+        case 7:
+            shared_rmdir(stress->shared, path);
+            break;
+        default:
+            // folders go rarely, so the tree keeps some depth
+            if (rand_r(&stress->seed) % 4 == 0)
+                shared_rmrec(stress->shared, path);
+            else
+                shared_touch(stress->shared, path, NULL);
+            break;
+        }
+        stress->ops++;
+    }
+    return NULL;
+}
+
+// counts the folder's subtree by walking it, and checks it against the
+// stats every folder keeps
+static int check_stats(TreeNode *folderNode, TreeStats *counted)
+{
+    FolderContent *folder = folderNode->content;
+    int valid = 1;
+
+    memset(counted, 0, sizeof(*counted));
+    for (TreeNode *child = folder->head; child != NULL; child = child->next)
+    {
+        TreeStats stats;
+        if (child->type == FOLDER_NODE)
+        {
+            valid &= check_stats(child, &stats);
+            stats.folders++;
+        }
+        else
+            node_stats(child, &stats);
+        counted->files += stats.files;
+        counted->folders += stats.folders;
+        counted->bytes += stats.bytes;
+    }
+    if (memcmp(counted, &folder->stats, sizeof(*counted)) != 0)
+    {
+        fprintf(stderr, "stats of '%s' are off\n", folderNode->name);
+        valid = 0;
+    }
+    return valid;
+}
+
+int main(int argc, char **argv)
+{
+    int readers = argc > 1 ? atoi(argv[1]) : STRESS_READERS;
+    int writers = argc > 2 ? atoi(argv[2]) : STRESS_WRITERS;
+    size_t count = argc > 3 ? strtoul(argv[3], NULL, 10) : STRESS_OPS;
+    StressThread *threads = calloc(readers + writers, sizeof(StressThread));
+    DIE(!threads, "calloc");
+
+    FileTree fileTree = createFileTree("root");
+    SharedTree shared;
+    shared_init(&shared, fileTree);
+
+    for (int i = 0; i < readers + writers; i++)
+    {
+        threads[i].shared = &shared;
+        threads[i].seed = i + 1;
+        threads[i].count = count;
+        errno = pthread_create(&threads[i].thread, NULL,
+                               i < readers ? reader : writer, &threads[i]);
+        DIE(errno != 0, "pthread_create");
+    }
+    size_t reads = 0, writes = 0;
+    for (int i = readers; i < readers + writers; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        writes += threads[i].ops;
+    }
+    __atomic_store_n(&readersDone, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < readers; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        reads += threads[i].ops;
+    }
+
+    shared_destroy(&shared);
+    TreeStats counted;
+    int valid = check_stats(fileTree.root, &counted);
+    printf("%zu reads, %zu writes, %llu directories, %llu files: %s\n",
+           reads, writes, (unsigned long long)counted.folders,
+           (unsigned long long)counted.files, valid ? "ok" : "FAILED");
+    freeTree(fileTree);
+    free(threads);
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,661 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+
+typedef struct SnapFolder SnapFolder;
+typedef struct SnapRemoved SnapRemoved;
+typedef struct SnapCursor SnapCursor;
+
+/*
+ * Taking a snapshot copies nothing, it only starts a new generation. The
+ * tree keeps changing in place, and the first change to a folder after a
+ * snapshot saves the children the folder had, with their names and their
+ * files' contents, in that snapshot. The nodes removed meanwhile are kept
+ * out of the tree instead of freed, so a snapshot only ever holds what
+ * changed after it was taken.
+ *
+ * A snapshot sees a folder as the oldest copy saved in it or in a newer
+ * snapshot, or as the tree has it if nobody saved one: a folder that
+ * changed after the snapshot was saved in it, or in the next snapshot if
+ * it only changed after that one, which then holds the same children.
+ * Dropping a snapshot hands its copies to the one before it, for the
+ * folders that one didn't save itself.
+ */
+
+struct SnapFolder {
+    FolderContent* folder;
+    SnapFolder* next;
+    size_t count;
+    SnapEntry entries[];
+};
+
+// a node removed after the snapshot, and the folder it was in
+struct SnapRemoved {
+    TreeNode* node;
+    TreeNode* parent;
+};
+
+struct Snapshot {
+    char* name;
+    uint64_t id;
+    TreeNode* root;
+    // the folders saved in the snapshot, hashed by their content
+    SnapFolder** buckets;
+    size_t capacity;
+    size_t count;
+    SnapRemoved* removed;
+    size_t removedCount;
+    size_t removedCapacity;
+    Snapshot* older;
+    Snapshot* newer;
+};
+
+// the children of a folder as a snapshot sees them
+struct SnapCursor {
+    SnapFolder* saved;
+    size_t at;
+    TreeNode* next;
+};
+
+static struct {
+    Snapshot* oldest;
+    Snapshot* newest;
+    // the id of the last snapshot taken, dropped or not
+    uint64_t generation;
+} snaps;
+
+static size_t folder_slot(FolderContent *folder, size_t capacity)
+{
+    uintptr_t key = (uintptr_t)folder >> 4;
+    return (size_t)(key * 2654435761u) & (capacity - 1);
+}
+
+static SnapFolder *saved_find(Snapshot *snapshot, FolderContent *folder)
+{
+    if (snapshot->count == 0)
+        return NULL;
+    SnapFolder *copy = snapshot->buckets[folder_slot(folder,
+                                                     snapshot->capacity)];
+    while (copy != NULL && copy->folder != folder)
+        copy = copy->next;
+    return copy;
+}
+
+static void saved_add(Snapshot *snapshot, SnapFolder *copy)
+{
+    if (snapshot->count == snapshot->capacity)
+    {
+        size_t capacity = snapshot->capacity ? snapshot->capacity * 2 : 64;
+        SnapFolder **buckets = calloc(capacity, sizeof(SnapFolder *));
+        DIE(!buckets, "calloc");
+        for (size_t i = 0; i < snapshot->capacity; i++)
+        {
+            SnapFolder *next;
+            for (SnapFolder *old = snapshot->buckets[i]; old != NULL;
+                 old = next)
+            {
+                next = old->next;
+                size_t slot = folder_slot(old->folder, capacity);
+                old->next = buckets[slot];
+                buckets[slot] = old;
+            }
+        }
+        free(snapshot->buckets);
+        snapshot->buckets = buckets;
+        snapshot->capacity = capacity;
+    }
+
+    size_t slot = folder_slot(copy->folder, snapshot->capacity);
+    copy->next = snapshot->buckets[slot];
+    snapshot->buckets[slot] = copy;
+    snapshot->count++;
+}
+
+// the folder may be gone: one taken out of the tree is freed with the
+// oldest snapshot keeping it, a write through another name of a file in
+// it may have saved it in a newer one
+static void saved_free(TreeMem *mem, SnapFolder *copy)
+{
+    for (size_t i = 0; i < copy->count; i++)
+    {
+        data_release(copy->entries[i].data);
+        name_release(mem, copy->entries[i].name);
+    }
+    free(copy);
+}
+
+static void removed_add(Snapshot *snapshot, TreeNode *treeNode,
+                        TreeNode *parent)
+{
+    if (snapshot->removedCount == snapshot->removedCapacity)
+    {
+        snapshot->removedCapacity = snapshot->removedCapacity ?
+                                    snapshot->removedCapacity * 2 : 64;
+        snapshot->removed = realloc(snapshot->removed,
+                                    snapshot->removedCapacity *
+                                    sizeof(SnapRemoved));
+        DIE(!snapshot->removed, "realloc");
+    }
+    SnapRemoved *removed = &snapshot->removed[snapshot->removedCount++];
+    removed->node = treeNode;
+    removed->parent = parent;
+}
+
+uint64_t snap_generation()
+{
+    return snaps.generation;
+}
+
+void snap_save(FolderContent *folder)
+{
+    Snapshot *newest = snaps.newest;
+
+    // saved already, or made after the newest snapshot
+    if (newest == NULL || folder->saved >= newest->id)
+        return;
+    folder->saved = newest->id;
+
+    SnapFolder *copy = malloc(sizeof(SnapFolder) +
+                              folder->size * sizeof(SnapEntry));
+    DIE(!copy, "malloc");
+    copy->folder = folder;
+    copy->count = 0;
+    for (TreeNode *child = folder->head; child != NULL; child = child->next)
+    {
+        SnapEntry *entry = &copy->entries[copy->count++];
+        entry->node = child;
+        // the node may be renamed after, the snapshot keeps the old name
+        entry->name = name_hold(folder->mem, child->name);
+        entry->data = NULL;
+        if (child->type == FILE_NODE)
+            entry->data = data_hold(((FileContent *)child->content)->data);
+    }
+    saved_add(newest, copy);
+}
+
+int snap_retain(TreeNode *treeNode)
+{
+    Snapshot *newest = snaps.newest;
+
+    if (newest == NULL)
+        return 0;
+    // out of the tree, where searches don't reach it
+    removed_add(newest, treeNode, treeNode->parent);
+    treeNode->parent = NULL;
+    return 1;
+}
+
+TreeNode *snap_parent(TreeNode *treeNode)
+{
+    // the folder a node kept out of the tree was taken out of, NULL if no
+    // snapshot keeps it
+    for (Snapshot *snapshot = snaps.newest; snapshot != NULL;
+         snapshot = snapshot->older)
+    {
+        for (size_t i = 0; i < snapshot->removedCount; i++)
+        {
+            if (snapshot->removed[i].node == treeNode)
+                return snapshot->removed[i].parent;
+        }
+    }
+    return NULL;
+}
+
+static Snapshot *snap_find(const char *name, size_t length)
+{
+    for (Snapshot *snapshot = snaps.oldest; snapshot != NULL;
+         snapshot = snapshot->newer)
+    {
+        if (strncmp(snapshot->name, name, length) == 0 &&
+            snapshot->name[length] == '\0')
+            return snapshot;
+    }
+    return NULL;
+}
+
+Snapshot *snap_named(const char *name)
+{
+    return snap_find(name, strlen(name));
+}
+
+int snap_unchanged(Snapshot *snapshot, TreeNode *folderNode)
+{
+    // nothing inside the folder changed since the snapshot was taken, it
+    // sees all of it as the tree has it
+    return ((FolderContent *)folderNode->content)->changed < snapshot->id;
+}
+
+static void snap_drop(Snapshot *snapshot)
+{
+    Snapshot *older = snapshot->older;
+    TreeMem *mem = ((FolderContent *)snapshot->root->content)->mem;
+
+    // the older snapshot sees the folders it didn't save as we saved them
+    for (size_t i = 0; i < snapshot->capacity; i++)
+    {
+        SnapFolder *next;
+        for (SnapFolder *copy = snapshot->buckets[i]; copy != NULL;
+             copy = next)
+        {
+            next = copy->next;
+            if (older != NULL && saved_find(older, copy->folder) == NULL)
+                saved_add(older, copy);
+            else
+                saved_free(mem, copy);
+        }
+    }
+
+    // the removed nodes are freed once no snapshot is older, in the order
+    // they were removed, so a folder goes after the files taken out of it
+    for (size_t i = 0; i < snapshot->removedCount; i++)
+    {
+        SnapRemoved *removed = &snapshot->removed[i];
+        if (older != NULL)
+            removed_add(older, removed->node, removed->parent);
+        else
+        {
+            removed->node->parent = removed->parent;
+            freeNode(removed->node);
+        }
+    }
+
+    if (older != NULL)
+        older->newer = snapshot->newer;
+    else
+        snaps.oldest = snapshot->newer;
+    if (snapshot->newer != NULL)
+        snapshot->newer->older = older;
+    else
+        snaps.newest = older;
+    free(snapshot->buckets);
+    free(snapshot->removed);
+    free(snapshot->name);
+    free(snapshot);
+}
+
+void snap_drop_all()
+{
+    // from the oldest, so the removed nodes are freed right away
+    while (snaps.oldest != NULL)
+        snap_drop(snaps.oldest);
+}
+
+static void cursor_start(SnapCursor *cursor, Snapshot *snapshot,
+                         TreeNode *folderNode)
+{
+    FolderContent *folder = folderNode->content;
+
+    cursor->saved = NULL;
+    cursor->at = 0;
+    cursor->next = folder->head;
+    // the tree as it is, or a folder not saved since the snapshot, which
+    // still has the same children
+    if (snapshot == NULL || folder->saved < snapshot->id)
+        return;
+    for (; snapshot != NULL && cursor->saved == NULL;
+         snapshot = snapshot->newer)
+        cursor->saved = saved_find(snapshot, folder);
+}
+
+static int cursor_next(SnapCursor *cursor, SnapEntry *entry)
+{
+    if (cursor->saved != NULL)
+    {
+        if (cursor->at == cursor->saved->count)
+            return 0;
+        *entry = cursor->saved->entries[cursor->at++];
+        return 1;
+    }
+
+    TreeNode *child = cursor->next;
+    if (child == NULL)
+        return 0;
+    cursor->next = child->next;
+    entry->node = child;
+    entry->name = child->name;
+    entry->data = NULL;
+    if (child->type == FILE_NODE)
+        entry->data = ((FileContent *)child->content)->data;
+    return 1;
+}
+
+size_t snap_children(Snapshot *snapshot, TreeNode *folderNode,
+                     SnapEntry **entries, size_t *capacity)
+{
+    SnapCursor cursor;
+    size_t count = 0;
+
+    cursor_start(&cursor, snapshot, folderNode);
+    for (;;)
+    {
+        if (count == *capacity)
+        {
+            *capacity = *capacity ? *capacity * 2 : 16;
+            *entries = realloc(*entries, *capacity * sizeof(SnapEntry));
+            DIE(!*entries, "realloc");
+        }
+        if (!cursor_next(&cursor, &(*entries)[count]))
+            return count;
+        count++;
+    }
+}
+
+static int view_child(Snapshot *snapshot, TreeNode *folderNode,
+                      const char *name, size_t length, SnapEntry *entry)
+{
+    SnapCursor cursor;
+
+    cursor_start(&cursor, snapshot, folderNode);
+    // the folder's own index still knows its children
+    if (cursor.saved == NULL)
+    {
+        TreeNode *child = folder_lookup(folderNode->content, name, length);
+        if (child == NULL)
+            return 0;
+        cursor.next = child;
+        return cursor_next(&cursor, entry);
+    }
+    while (cursor_next(&cursor, entry))
+    {
+        if (strncmp(entry->name, name, length) == 0 &&
+            entry->name[length] == '\0')
+            return 1;
+    }
+    return 0;
+}
+
+static void view_push(SnapView *view, const SnapEntry *entry)
+{
+    if (view->depth == view->capacity)
+    {
+        view->capacity = view->capacity ? view->capacity * 2 : 16;
+        view->path = realloc(view->path, view->capacity * sizeof(SnapEntry));
+        DIE(!view->path, "realloc");
+    }
+    view->path[view->depth++] = *entry;
+}
+
+// follows the path from where the view stands, the result ends with the
+// entry the path names
+static int view_resolve(SnapView *view, const char *path, SnapView *result)
+{
+    result->snapshot = view->snapshot;
+    result->path = NULL;
+    result->depth = result->capacity = 0;
+    for (size_t i = 0; i < view->depth; i++)
+        view_push(result, &view->path[i]);
+
+    while (*path != '\0')
+    {
+        size_t length = strcspn(path, "/");
+        SnapEntry *top = &result->path[result->depth - 1];
+        SnapEntry child;
+        if (length == 0)
+        {
+            path++;
+            continue;
+        }
+
+        // we can only go through folders, and not above the root
+        if (top->node->type != FOLDER_NODE)
+            goto fail;
+        if (length == strlen(PARENT_DIR) &&
+            !strncmp(path, PARENT_DIR, length))
+        {
+            if (result->depth == 1)
+                goto fail;
+            result->depth--;
+        }
+        else if (view_child(view->snapshot, top->node, path, length, &child))
+            view_push(result, &child);
+        else
+            goto fail;
+        path += length;
+    }
+    return 0;
+
+fail:
+    free(result->path);
+    result->path = NULL;
+    return -1;
+}
+
+void takeSnapshot(TreeNode *root, char *name)
+{
+    if (!strcmp(name, NO_ARG))
+    {
+        out_puts("snapshot: missing name\n");
+        return;
+    }
+    // the name is the first part of the paths into the snapshot
+    if (strchr(name, '/') != NULL)
+    {
+        out_printf("snapshot: invalid name '%s'\n", name);
+        return;
+    }
+    if (snap_find(name, strlen(name)) != NULL)
+    {
+        out_printf("snapshot: '%s' already exists\n", name);
+        return;
+    }
+
+    Snapshot *snapshot = calloc(1, sizeof(Snapshot));
+    DIE(!snapshot, "calloc");
+    snapshot->name = strdup(name);
+    DIE(!snapshot->name, "strdup");
+    snapshot->id = ++snaps.generation;
+    snapshot->root = root;
+    snapshot->older = snaps.newest;
+    if (snaps.newest != NULL)
+        snaps.newest->newer = snapshot;
+    else
+        snaps.oldest = snapshot;
+    snaps.newest = snapshot;
+}
+
+void listSnapshots()
+{
+    // what each one costs is what changed since it was taken
+    for (Snapshot *snapshot = snaps.oldest; snapshot != NULL;
+         snapshot = snapshot->newer)
+        out_printf("%s: %zu folders saved, %zu nodes kept\n", snapshot->name,
+                   snapshot->count, snapshot->removedCount);
+}
+
+void dropSnapshot(SnapView *view, char *name)
+{
+    Snapshot *snapshot = snap_find(name, strlen(name));
+
+    if (snapshot == NULL)
+    {
+        out_printf("drop: '%s': No such snapshot\n", name);
+        return;
+    }
+    if (snapshot == view->snapshot)
+    {
+        out_printf("drop: cannot drop '%s': Device or resource busy\n", name);
+        return;
+    }
+    snap_drop(snapshot);
+}
+
+int enterSnapshot(SnapView *view, char *path)
+{
+    size_t length = strcspn(path, "/");
+    Snapshot *snapshot = snap_find(path, length);
+    SnapView start, result;
+
+    if (snapshot == NULL)
+        return -1;
+    SnapEntry root = {snapshot->root, snapshot->root->name, NULL};
+    start.snapshot = snapshot;
+    start.path = &root;
+    start.depth = start.capacity = 1;
+    if (view_resolve(&start, path + length, &result) < 0)
+        return -1;
+    if (result.path[result.depth - 1].node->type != FOLDER_NODE)
+    {
+        free(result.path);
+        return -1;
+    }
+    free(view->path);
+    *view = result;
+    return 0;
+}
+
+void leaveSnapshot(SnapView *view)
+{
+    free(view->path);
+    memset(view, 0, sizeof(SnapView));
+}
+
+static void print_entries(SnapView *view, TreeNode *folderNode)
+{
+    SnapCursor cursor;
+    SnapEntry entry;
+
+    cursor_start(&cursor, view->snapshot, folderNode);
+    while (cursor_next(&cursor, &entry))
+        out_printf("%s\n", entry.name);
+}
+
+void snapshotLs(SnapView *view, char *arg)
+{
+    SnapView result;
+
+    if (view_resolve(view, arg, &result) < 0)
+    {
+        out_printf("ls: cannot access '%s': No such file or directory\n", arg);
+        return;
+    }
+
+    SnapEntry *entry = &result.path[result.depth - 1];
+    if (entry->node->type == FOLDER_NODE)
+        print_entries(view, entry->node);
+    else
+    {
+        out_printf("%s: ", entry->name);
+        if (entry->data == NULL)
+            out_puts("(null)");
+        else
+            print_data(entry->data, 0, entry->data->size);
+        out_puts("\n");
+    }
+    free(result.path);
+}
+
+void snapshotPwd(SnapView *view)
+{
+    out_printf("@%s:", view->snapshot->name);
+    for (size_t i = 0; i < view->depth; i++)
+    {
+        if (i > 0)
+            out_write("/", 1);
+        out_puts(view->path[i].name);
+    }
+}
+
+void snapshotCd(SnapView *view, char *path)
+{
+    SnapView result;
+
+    if (view_resolve(view, path, &result) < 0)
+    {
+        out_printf("cd: no such file or directory: %s", path);
+        return;
+    }
+    if (result.path[result.depth - 1].node->type != FOLDER_NODE)
+    {
+        out_printf("cd: no such file or directory: %s", path);
+        free(result.path);
+        return;
+    }
+    free(view->path);
+    *view = result;
+}
+
+void snapshotTree(SnapView *view, char *arg)
+{
+    SnapView result;
+
+    if (view_resolve(view, arg, &result) < 0 ||
+        result.path[result.depth - 1].node->type != FOLDER_NODE)
+    {
+        free(result.path);
+        out_printf("%s [error opening dir]\n\n0 directories, 0 files\n", arg);
+        return;
+    }
+
+    // a cursor for every folder we are inside of
+    size_t noDirectories = 0;
+    size_t noFiles = 0;
+    size_t depth = 1, capacity = WALK_INLINE_DEPTH;
+    SnapCursor *cursors = malloc(capacity * sizeof(SnapCursor));
+    DIE(!cursors, "malloc");
+    cursor_start(&cursors[0], view->snapshot,
+                 result.path[result.depth - 1].node);
+    while (depth > 0)
+    {
+        SnapEntry entry;
+        if (!cursor_next(&cursors[depth - 1], &entry))
+        {
+            depth--;
+            continue;
+        }
+        out_pad((depth - 1) * TREE_CMD_INDENT_SIZE);
+        out_puts(entry.name);
+        // a symlink's target never changes, the node still has it
+        if (entry.node->type == SYMLINK_NODE)
+            out_printf(" -> %s",
+                       ((FileContent *)entry.node->content)->target);
+        out_write("\n", 1);
+        if (entry.node->type != FOLDER_NODE)
+        {
+            noFiles++;
+            continue;
+        }
+        noDirectories++;
+        if (depth == capacity)
+        {
+            capacity *= 2;
+            cursors = realloc(cursors, capacity * sizeof(SnapCursor));
+            DIE(!cursors, "realloc");
+        }
+        cursor_start(&cursors[depth++], view->snapshot, entry.node);
+    }
+    free(cursors);
+    free(result.path);
+    out_printf("\n%zu directories, %zu files\n", noDirectories, noFiles);
+}
+
+void snapshotRead(SnapView *view, char *fileName, char *offset, char *length)
+{
+    size_t start = 0, count = SIZE_MAX;
+    SnapView result;
+
+    if ((*offset != '\0' &&
+         parse_size("read", "offset", offset, &start) < 0) ||
+        (*length != '\0' &&
+         parse_size("read", "length", length, &count) < 0))
+        return;
+    if (view_resolve(view, fileName, &result) < 0)
+    {
+        out_printf("read: cannot open '%s': No such file or directory\n",
+                   fileName);
+        return;
+    }
+
+    SnapEntry *entry = &result.path[result.depth - 1];
+    if (entry->node->type == FOLDER_NODE)
+        out_printf("read: cannot open '%s': Is a directory\n", fileName);
+    else
+    {
+        if (entry->data != NULL)
+            print_data(entry->data, start, count);
+        out_puts("\n");
+    }
+    free(result.path);
+}
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+
+/*
+ * Every folder counts the files, folders and content bytes it holds, all
+ * the way down. The commands that change the tree hand the difference to
+ * stats_update, which carries it up to the root, so asking a folder for
+ * its totals never walks anything. On the way, the folders' digests are
+ * cleared for diff to work them out again (see diff.c).
+ */
+
+void node_stats(TreeNode *treeNode, TreeStats *stats)
+{
+    // a symlink counts as a file without content
+    if (treeNode->type != FOLDER_NODE)
+    {
+        stats->files = 1;
+        stats->folders = 0;
+        stats->bytes = data_size(((FileContent *)treeNode->content)->data);
+        return;
+    }
+
+    // a folder weighs itself and everything inside it
+    *stats = ((FolderContent *)treeNode->content)->stats;
+    stats->folders++;
+}
+
+void stats_update(TreeNode *folderNode, const TreeStats *added,
+                  const TreeStats *removed)
+{
+    static const TreeStats none;
+
+    digest_touch(folderNode);
+    if (added == NULL)
+        added = &none;
+    if (removed == NULL)
+        removed = &none;
+    for (TreeNode *node = folderNode; node != NULL; node = node->parent)
+    {
+        // a folder a shared tree removed was already taken out of its
+        // parents' stats, with everything in it
+        if (((FolderContent *)node->content)->removed)
+            break;
+        TreeStats *stats = &((FolderContent *)node->content)->stats;
+        stats->files += added->files - removed->files;
+        stats->folders += added->folders - removed->folders;
+        stats->bytes += added->bytes - removed->bytes;
+    }
+}
+
+void stats_resize(TreeNode *fileNode, size_t oldSize, size_t newSize)
+{
+    TreeStats added = {0, 0, newSize};
+    TreeStats removed = {0, 0, oldSize};
+
+    // the bytes may change while the size doesn't
+    digest_touch(fileNode->parent);
+    if (oldSize != newSize)
+        stats_update(fileNode->parent, &added, &removed);
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include "tree.h"
+
+typedef struct SubtreeWork SubtreeWork;
+typedef struct SubtreeCopy SubtreeCopy;
+
+/*
+ * What one thread needs to copy or free a part of a subtree. The pools
+ * are its own, the objects it allocates or frees go through them and
+ * they are merged in the tree's pools once the work is done, so the
+ * threads never share an allocator.
+ */
+struct SubtreeWork {
+    TreeMem* mem;
+    Pool nodes;
+    Pool files;
+    Pool folders;
+    // the pending copies, only used while copying
+    Pool items;
+};
+
+// a folder to copy, and its still empty copy
+struct SubtreeCopy {
+    TreeNode* source;
+    TreeNode* copy;
+};
+
+int subtree_threads(TreeNode *treeNode)
+{
+    if (treeNode->type != FOLDER_NODE)
+        return 1;
+
+    // we walk the subtree in preorder through the parent links, until
+    // it proves big enough to be worth waking threads for
+    size_t count = 0;
+    TreeNode *node = treeNode;
+    while (++count <= PARALLEL_SUBTREE_SIZE)
+    {
+        if (node->type == FOLDER_NODE &&
+            ((FolderContent *)node->content)->head != NULL)
+        {
+            node = ((FolderContent *)node->content)->head;
+            continue;
+        }
+        while (node != treeNode && node->next == NULL)
+            node = node->parent;
+        if (node == treeNode)
+            return 1;
+        node = node->next;
+    }
+    return work_threads();
+}
+
+static SubtreeWork *work_start(TreeMem *mem, int threads, void **contexts)
+{
+    SubtreeWork *works = malloc(threads * sizeof(SubtreeWork));
+    DIE(!works, "malloc");
+
+    for (int i = 0; i < threads; i++)
+    {
+        works[i].mem = mem;
+        pool_init(&works[i].nodes, mem->nodes.objectSize);
+        pool_init(&works[i].files, mem->files.objectSize);
+        pool_init(&works[i].folders, mem->folders.objectSize);
+        pool_init(&works[i].items, sizeof(SubtreeCopy));
+        contexts[i] = &works[i];
+    }
+    return works;
+}
+
+static void work_finish(SubtreeWork *works, int threads)
+{
+    for (int i = 0; i < threads; i++)
+    {
+        TreeMem *mem = works[i].mem;
+        pool_merge(&mem->nodes, &works[i].nodes);
+        pool_merge(&mem->files, &works[i].files);
+        pool_merge(&mem->folders, &works[i].folders);
+        pool_destroy(&works[i].items);
+    }
+    free(works);
+}
+
+// allocates a copy of the node, without its children, in the folder, the
+// copy takes the reference to its name
+static TreeNode *copy_node(SubtreeWork *work, TreeNode *parent,
+                           TreeNode *source, char *name)
+{
+    TreeNode *copy = pool_alloc(&work->nodes);
+
+    copy->parent = parent;
+    copy->name = name;
+    copy->type = source->type;
+    copy->linkNext = NULL;
+    if (source->type == FOLDER_NODE)
+    {
+        copy->content = pool_alloc(&work->folders);
+        folder_init(copy->content, work->mem, copy);
+        // the copy will hold what the source holds
+        ((FolderContent *)copy->content)->stats =
+            ((FolderContent *)source->content)->stats;
+    }
+    else
+    {
+        // the copy shares the source's content, but is a file of its own
+        FileContent *sourceFile = source->content;
+        file_init(work->mem, copy, pool_alloc(&work->files),
+                  data_hold(sourceFile->data),
+                  name_hold(work->mem, sourceFile->target));
+    }
+    // room for the whole copy was made up front, the columns stay put
+    InodeTable *table = &work->mem->inodes;
+    table->mode[node_ino(copy)] = table->mode[node_ino(source)];
+    index_add(work->mem, copy);
+    folder_link(parent->content, copy);
+    return copy;
+}
+
+// pushes the copy of a folder's children as a new piece of work
+static void push_copy(Worker *worker, SubtreeWork *work, TreeNode *source,
+                      TreeNode *copy)
+{
+    SubtreeCopy *item = pool_alloc(&work->items);
+
+    item->source = source;
+    item->copy = copy;
+    work_push(worker, item);
+}
+
+static void copy_task(Worker *worker, void *context, void *arg)
+{
+    SubtreeWork *work = context;
+    SubtreeCopy *item = arg;
+
+    // we copy the children last to first, prepending them keeps their order
+    TreeNode *child = ((FolderContent *)item->source->content)->head;
+    while (child != NULL && child->next != NULL)
+        child = child->next;
+    for (; child != NULL; child = child->prev)
+    {
+        TreeNode *copy = copy_node(work, item->copy, child,
+                                   name_hold(work->mem, child->name));
+        // only the thread that takes it will touch the copy's children
+        if (child->type == FOLDER_NODE &&
+            ((FolderContent *)child->content)->head != NULL)
+            push_copy(worker, work, child, copy);
+    }
+    pool_free(&work->items, item);
+}
+
+TreeNode *subtree_copy(TreeNode *source, TreeNode *parent, char *name,
+                       int threads)
+{
+    void *contexts[WORK_MAX_THREADS];
+    TreeMem *mem = ((FolderContent *)parent->content)->mem;
+    SubtreeWork *works = work_start(mem, threads, contexts);
+    TreeStats stats;
+
+    node_stats(source, &stats);
+    inode_reserve(mem, stats.files + stats.folders);
+
+    TreeNode *copy = copy_node(&works[0], parent, source, name);
+    if (source->type == FOLDER_NODE &&
+        ((FolderContent *)source->content)->head != NULL)
+    {
+        SubtreeCopy *item = pool_alloc(&works[0].items);
+        item->source = source;
+        item->copy = copy;
+        work_run(copy_task, item, contexts, threads);
+    }
+
+    work_finish(works, threads);
+    return copy;
+}
+
+static void free_task(Worker *worker, void *context, void *arg)
+{
+    SubtreeWork *work = context;
+    TreeNode *folderNode = arg;
+    FolderContent *folder = folderNode->content;
+
+    // files are freed right away, folders become new pieces of work
+    TreeNode *child = folder->head;
+    while (child != NULL)
+    {
+        TreeNode *next = child->next;
+        if (child->type == FOLDER_NODE)
+            work_push(worker, child);
+        else
+        {
+            FileContent *file = child->content;
+            // names of the file outside the subtree keep it
+            if (link_remove(work->mem, child) == 0)
+            {
+                data_release(file->data);
+                name_release(work->mem, file->target);
+                inode_free(work->mem, file->ino);
+                pool_free(&work->files, file);
+            }
+            index_remove(work->mem, child);
+            name_release(work->mem, child->name);
+            pool_free(&work->nodes, child);
+        }
+        child = next;
+    }
+
+    // the children's threads don't need their parent anymore
+    inode_free(work->mem, folder->ino);
+    folder_destroy(folder);
+    pool_free(&work->folders, folder);
+    index_remove(work->mem, folderNode);
+    name_release(work->mem, folderNode->name);
+    pool_free(&work->nodes, folderNode);
+}
+
+void subtree_free(TreeNode *folderNode, int threads)
+{
+    void *contexts[WORK_MAX_THREADS];
+    TreeMem *mem = ((FolderContent *)folderNode->content)->mem;
+    SubtreeWork *works = work_start(mem, threads, contexts);
+
+    work_run(free_task, folderNode, contexts, threads);
+    work_finish(works, threads);
+}
@@ -2,133 +2,464 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <time.h>
 #include "tree.h"
 #define TREE_CMD_INDENT_SIZE 4
 #define NO_ARG ""
 #define PARENT_DIR ".."
 
+// files reach the tree's memory through the folder holding them
+static TreeMem *node_mem(TreeNode *treeNode)
+{
+    if (treeNode->type != FOLDER_NODE)
+        treeNode = treeNode->parent;
+    return ((FolderContent *)treeNode->content)->mem;
+}
+
 FileTree createFileTree(char *rootFolderName)
 {
     FileTree fileTree;
 
-    // allocate memory for the root folder
-    fileTree.root = (TreeNode *)malloc(sizeof(TreeNode));
-    DIE(!fileTree.root, "malloc");
+    // every node of the tree is allocated from the tree's memory
+    fileTree.mem = mem_create();
+    fileTree.root = pool_alloc(&fileTree.mem->nodes);
 
     // set the root folder props
     fileTree.root->parent = NULL;
-    fileTree.root->name = rootFolderName;
+    fileTree.root->name = arena_intern(&fileTree.mem->names, rootFolderName,
+                                       strlen(rootFolderName));
     fileTree.root->type = FOLDER_NODE;
+    fileTree.root->linkNext = NULL;
+    index_add(fileTree.mem, fileTree.root);
 
-    // allocate memory for the root folder's content
-    fileTree.root->content = (FolderContent *)malloc(sizeof(FolderContent));
-    DIE(!fileTree.root->content, "malloc");
-
-    // set the root folder's content list
-    ((FolderContent *)fileTree.root->content)->children = ll_create();
+    // allocate the root folder's content
+    fileTree.root->content = folder_create(fileTree.mem, fileTree.root);
+    fileTree.sequence = 0;
     return fileTree;
 }
 
+// file data, child indexes and paths are the only things outside the
+// tree's memory
+static void free_data(TreeNode *folderNode)
+{
+    TreeMem *mem = node_mem(folderNode);
+    TreeWalk walk;
+    TreeNode *node;
+
+    walk_start(&walk, folderNode);
+    while ((node = walk_next(&walk)) != NULL)
+    {
+        // a file's data goes with its last name
+        if (node->type != FOLDER_NODE)
+        {
+            if (link_remove(mem, node) == 0)
+                data_release(((FileContent *)node->content)->data);
+        }
+        else if (walk.leaving)
+            folder_destroy(node->content);
+    }
+    walk_end(&walk);
+    folder_destroy(folderNode->content);
+}
+
 void freeTree(FileTree fileTree)
 {
-    // free the root folder
-    freeNode(fileTree.root);
+    // we drop the file data, then all the nodes go away with their slabs
+    free_data(fileTree.root);
+    // the freed nodes may still be cached
+    dc_invalidate();
+    mem_destroy(fileTree.mem);
 }
 
-void freeNode(TreeNode *treeNode)
+// frees a file, or a folder whose children are already gone
+static void release_node(TreeMem *mem, TreeNode *treeNode)
 {
-    // if the node is a file, free its content
-    if (treeNode->type == FILE_NODE)
+    if (treeNode->type != FOLDER_NODE)
     {
-        free(((FileContent *)treeNode->content)->text);
-        free(treeNode->content);
-        free(treeNode->name);
-        free(treeNode);
+        FileContent *file = treeNode->content;
+        // the other names of the file keep it
+        if (link_remove(mem, treeNode) == 0)
+        {
+            data_release(file->data);
+            name_release(mem, file->target);
+            inode_free(mem, file->ino);
+            pool_free(&mem->files, file);
+        }
+    }
+    else
+        folder_free(treeNode->content);
+    // the index finds the node by its name, it goes after
+    index_remove(mem, treeNode);
+    name_release(mem, treeNode->name);
+    pool_free(&mem->nodes, treeNode);
+}
+
+static void free_node(TreeMem *mem, TreeNode *treeNode)
+{
+    if (treeNode->type != FOLDER_NODE)
+    {
+        release_node(mem, treeNode);
         return;
     }
 
-    // iterate over the folder's content
-    FolderContent *folderContent = treeNode->content;
-    ListNode *listNode = folderContent->children->head;
-    while (listNode != NULL)
+    // the walk is already past the files it returns and the folders it
+    // leaves, so they can go right away
+    TreeWalk walk;
+    TreeNode *node;
+    walk_start(&walk, treeNode);
+    while ((node = walk_next(&walk)) != NULL)
     {
-        // if the node is a folder, recursively free it
-        if (listNode->info->type == FOLDER_NODE)
-        {
-            freeNode(listNode->info);
-        }
-        // free the file content
+        if (node->type != FOLDER_NODE || walk.leaving)
+            release_node(mem, node);
+    }
+    walk_end(&walk);
+    release_node(mem, treeNode);
+}
+
+void freeNode(TreeNode *treeNode)
+{
+    freeNodeIn(node_mem(treeNode), treeNode);
+}
+
+// for a node whose folder may be gone already, like the ones the shared
+// tree frees once no reader sees them
+void freeNodeIn(TreeMem *mem, TreeNode *treeNode)
+{
+    // big subtrees are split between several threads
+    int threads = subtree_threads(treeNode);
+    if (threads > 1)
+        subtree_free(treeNode, threads);
+    else
+        free_node(mem, treeNode);
+}
+
+// prints the bytes straight from the chunks holding them
+void print_data(FileData *data, size_t offset, size_t length)
+{
+    // where packed chunks are unpacked
+    char buffer[CONTENT_CHUNK_SIZE];
+
+    while (length > 0)
+    {
+        size_t available;
+        const char *bytes = data_bytes(data, offset, buffer, &available);
+        if (available == 0)
+            break;
+        if (available > length)
+            available = length;
+        out_write(bytes, available);
+        offset += available;
+        length -= available;
+    }
+}
+
+// the type and permission bits, as ls -l shows them
+static void mode_string(unsigned int mode, char *buffer)
+{
+    static const char bits[] = "rwxrwxrwx";
+
+    if ((mode & MODE_TYPE) == MODE_FOLDER)
+        buffer[0] = 'd';
+    else if ((mode & MODE_TYPE) == MODE_SYMLINK)
+        buffer[0] = 'l';
+    else
+        buffer[0] = '-';
+    for (int i = 0; i < 9; i++)
+        buffer[i + 1] = mode & (0400 >> i) ? bits[i] : '-';
+    buffer[10] = '\0';
+}
+
+// a time in nanoseconds, in local time to the minute, or to the nanosecond
+static void time_string(int64_t time, int precise, char *buffer, size_t size)
+{
+    time_t seconds = (time_t)(time / 1000000000);
+    struct tm local;
+
+    localtime_r(&seconds, &local);
+    size_t length = strftime(buffer, size, precise ? "%Y-%m-%d %H:%M:%S"
+                                                   : "%Y-%m-%d %H:%M",
+                             &local);
+    if (precise)
+        snprintf(buffer + length, size - length, ".%09lld",
+                 (long long)(time % 1000000000));
+}
+
+// a folder has a single name, and no link from its children
+static unsigned int node_links(TreeNode *treeNode)
+{
+    if (treeNode->type == FOLDER_NODE)
+        return 1;
+    return ((FileContent *)treeNode->content)->links;
+}
+
+// a node as ls -l shows it, read off the inode table's columns
+static void print_details(TreeNode *treeNode)
+{
+    InodeTable *table = &node_mem(treeNode)->inodes;
+    uint32_t ino = node_ino(treeNode);
+    char mode[11];
+    char time[32];
+
+    mode_string(table->mode[ino], mode);
+    time_string(table->mtime[ino], 0, time, sizeof(time));
+    out_printf("%s %u %llu %s %s", mode, node_links(treeNode),
+               (unsigned long long)table->size[ino], time, treeNode->name);
+    if (treeNode->type == SYMLINK_NODE)
+        out_printf(" -> %s", ((FileContent *)treeNode->content)->target);
+    out_write("\n", 1);
+}
+
+static void print_children(TreeNode *folderNode, int details)
+{
+    FolderContent *folderContent = folderNode->content;
+    TreeNode *child = folderContent->head;
+    while (child != NULL)
+    {
+        if (details)
+            print_details(child);
         else
+            out_printf("%s\n", child->name);
+        child = child->next;
+    }
+}
+
+// checks if node is the same as, or an ancestor of, descendant
+int is_ancestor(TreeNode *node, TreeNode *descendant)
+{
+    while (descendant != NULL)
+    {
+        if (descendant == node)
+            return 1;
+        descendant = descendant->parent;
+    }
+    return 0;
+}
+
+// the node created with the name takes this reference to it
+static char *copy_name(TreeNode *folderNode, const char *name, size_t len)
+{
+    return arena_intern(&node_mem(folderNode)->names, name, len);
+}
+
+static TreeNode *alloc_node(TreeNode *parent, char *name,
+                            enum TreeNodeType type)
+{
+    TreeNode *treeNode = pool_alloc(&node_mem(parent)->nodes);
+
+    // set the node's props
+    treeNode->parent = parent;
+    treeNode->name = name;
+    treeNode->type = type;
+    treeNode->linkNext = NULL;
+    return treeNode;
+}
+
+// links a new node in its parent folder, and counts it there
+static TreeNode *add_node(TreeNode *treeNode)
+{
+    TreeNode *parent = treeNode->parent;
+
+    index_add(node_mem(parent), treeNode);
+
+    // the node itself is linked in the parent's children, so it keeps
+    // its address for as long as it lives
+    folder_link(parent->content, treeNode);
+    TreeStats stats;
+    node_stats(treeNode, &stats);
+    stats_update(parent, &stats, NULL);
+    inode_touch(node_mem(parent), parent, 1);
+    txn_created(treeNode);
+    return treeNode;
+}
+
+static TreeNode *create_node(TreeNode *parent, char *name,
+                             enum TreeNodeType type)
+{
+    TreeMem *mem = node_mem(parent);
+    TreeNode *treeNode = alloc_node(parent, name, type);
+
+    if (type == FOLDER_NODE)
+        treeNode->content = folder_create(mem, treeNode);
+    else
+        file_init(mem, treeNode, pool_alloc(&mem->files), NULL, NULL);
+    return add_node(treeNode);
+}
+
+// unlinks a node from its parent folder and frees it with all its content
+static void remove_node(TreeNode *treeNode)
+{
+    TreeStats stats;
+    node_stats(treeNode, &stats);
+    stats_update(treeNode->parent, NULL, &stats);
+    // a file left with other names has one less
+    TreeMem *mem = node_mem(treeNode->parent);
+    inode_touch(mem, treeNode->parent, 1);
+    if (treeNode->type != FOLDER_NODE)
+        inode_touch(mem, treeNode, 0);
+    // an open transaction only takes the node out, until it commits
+    if (txn_remove(treeNode))
+        return;
+    folder_unlink(treeNode->parent->content, treeNode);
+    // the snapshots that still show the node keep it
+    if (!snap_retain(treeNode))
+        freeNode(treeNode);
+}
+
+// copies a subtree in a folder, and counts it there, the copy takes the
+// reference to its name
+static void copy_subtree(TreeNode *source, TreeNode *parent, char *name)
+{
+    TreeNode *copy = subtree_copy(source, parent, name,
+                                  subtree_threads(source));
+    TreeStats stats;
+    node_stats(copy, &stats);
+    stats_update(parent, &stats, NULL);
+    inode_touch(node_mem(parent), parent, 1);
+    txn_created(copy);
+}
+
+// a file's content is about to change, an open transaction and the
+// snapshots keep the one it has, in every folder naming the file
+static void file_changing(TreeNode *fileNode)
+{
+    TreeNode *name = fileNode;
+
+    txn_data(fileNode);
+    do
+    {
+        // names kept out of the tree are in no folder
+        if (name->parent != NULL)
+            snap_save(name->parent->content);
+        name = name->linkNext;
+    } while (name != NULL && name != fileNode);
+}
+
+void file_resized(TreeNode *fileNode, size_t oldSize)
+{
+    size_t newSize = data_size(((FileContent *)fileNode->content)->data);
+    TreeNode *name = fileNode;
+    TreeMem *mem = NULL;
+
+    do
+    {
+        if (name->parent != NULL)
         {
-            free(((FileContent *)listNode->info->content)->text);
-            free(listNode->info->content);
-            free(listNode->info->name);
-            free(listNode->info);
+            stats_resize(name, oldSize, newSize);
+            order_resize(name, oldSize, newSize);
+            mem = node_mem(name);
         }
+        name = name->linkNext;
+    } while (name != NULL && name != fileNode);
+    // the size and the times are the file's, whatever its names
+    if (mem != NULL)
+        inode_resize(mem, fileNode, newSize);
+}
+
+// gives a file another content, the file takes a reference on it
+static void set_data(TreeNode *fileNode, FileData *data)
+{
+    FileContent *content = fileNode->content;
+    size_t oldSize = data_size(content->data);
+
+    file_changing(fileNode);
+    data_hold(data);
+    data_release(content->data);
+    content->data = data;
+    file_resized(fileNode, oldSize);
+}
 
-        listNode = listNode->next;
+size_t nodePath(TreeNode *treeNode, char *buffer, size_t size)
+{
+    // the path starts under the root, the root itself is an empty path
+    TreeNode *folderNode = treeNode->type == FOLDER_NODE ? treeNode :
+                                                           treeNode->parent;
+    size_t folderLength;
+    const char *path = folder_path(folderNode, &folderLength);
+    size_t start = ((FolderContent *)folderNode->content)->pathStart;
+    size_t length = folderLength - start;
+
+    // a file is its folder's path and its name
+    size_t nameLength = 0;
+    int slash = 0;
+    if (treeNode != folderNode)
+    {
+        nameLength = strlen(treeNode->name);
+        slash = length != 0;
     }
-    // free the folder's content list
-    ll_free(&folderContent->children);
-    // free the folder's props
-    free(treeNode->content);
-    free(treeNode->name);
-    free(treeNode);
+    if (length + slash + nameLength + 1 > size)
+        return length + slash + nameLength;
+
+    memcpy(buffer, path + start, length);
+    if (slash)
+        buffer[length] = '/';
+    memcpy(buffer + length + slash, treeNode->name, nameLength);
+    length += slash + nameLength;
+    buffer[length] = '\0';
+    return length;
 }
 
-void ls(TreeNode *currentNode, char *arg)
+// why a path that resolved to nothing did
+static const char *lookup_reason(const PathLookup *lookup)
+{
+    if (lookup->error == RESOLVE_LOOP)
+        return "Too many levels of symbolic links";
+    return "No such file or directory";
+}
+
+void ls(TreeNode *currentNode, char *arg, int details)
 {
     // check if the arg is empty, if so, print the current folder's content
     if (!strcmp(arg, NO_ARG))
     {
-        FolderContent *folderContent = currentNode->content;
-        ListNode *listNode = folderContent->children->head;
-        while (listNode != NULL)
-        {
-            printf("%s\n", listNode->info->name);
-            listNode = listNode->next;
-        }
+        print_children(currentNode, details);
+        return;
     }
+
     // if the arg is not empty, print the content of the arg folder/file
+    PathLookup lookup;
+    // a long listing shows a symlink, not where it leads
+    if (details && resolve_entry(currentNode, arg, &lookup) == 0 &&
+        lookup.node != NULL && lookup.node->type == SYMLINK_NODE)
+    {
+        print_details(lookup.node);
+        return;
+    }
+    if (resolve_path(currentNode, arg, &lookup) < 0 || lookup.node == NULL)
+    {
+        out_printf("ls: cannot access '%s': %s\n", arg,
+                   lookup_reason(&lookup));
+        return;
+    }
+
+    TreeNode *treeNode = lookup.node;
+    // if the arg is a folder, print the content of the folder
+    if (treeNode->type == FOLDER_NODE)
+        print_children(treeNode, details);
+    // a long listing shows the file itself
+    else if (details)
+        print_details(treeNode);
+    // if the arg is a file, print the content of the file
     else
     {
-        // check if the arg exists
-        TreeNode *treeNode = fileExist(currentNode, arg);
-        if (treeNode == NULL)
-            printf("ls: cannot access '%s': No such file or directory\n", arg);
+        FileData *data = ((FileContent *)treeNode->content)->data;
+        out_printf("%s: ", treeNode->name);
+        // a file without content prints as printf prints a NULL string
+        if (data == NULL)
+            out_puts("(null)");
         else
-        {
-            // if the arg is a folder, print the content of the folder
-            if (treeNode->type == FOLDER_NODE)
-            {
-                FolderContent *folderContent = treeNode->content;
-                ListNode *listNode = folderContent->children->head;
-                while (listNode != NULL)
-                {
-                    printf("%s\n", listNode->info->name);
-                    listNode = listNode->next;
-                }
-            }
-            // if the arg is a file, print the content of the file
-            else
-                printf("%s: %s\n", treeNode->name,
-                       ((FileContent *)(treeNode->content))->text);
-        }
+            print_data(data, 0, data->size);
+        out_puts("\n");
     }
 }
 
 void pwd(TreeNode *treeNode)
 {
-    // if the current node is the root folder, print the root folder's name
-    if (treeNode->parent == NULL)
-        printf("%s", treeNode->name);
-    // if the current node is not the root folder,
-    // print the path of the current node
-    else
-    {
-        pwd(treeNode->parent);
-        printf("/%s", treeNode->name);
-    }
+    // the folder keeps its path, it is only built on the first call
+    size_t length;
+    const char *path = folder_path(treeNode, &length);
+    out_write(path, length);
 }
 
 TreeNode *cd(TreeNode *currentNode, char *path)
@@ -136,736 +467,1518 @@ TreeNode *cd(TreeNode *currentNode, char *path)
     if (!strcmp(path, NO_ARG))
         return currentNode;
 
-    // if we can't go to a node, we save the current node in which we are
-    TreeNode *copyCurrentNode = currentNode;
-
-    // we split the path in order to get the path of the node we want to go to
-    char *stripPath = strtok(path, "/");
-    int found = 0;
-    while (stripPath != NULL)
+    // if we can't go to a folder, we stay in the current node
+    PathLookup lookup;
+    if (resolve_path(currentNode, path, &lookup) < 0 || lookup.node == NULL ||
+        lookup.node->type != FOLDER_NODE)
     {
-        // we check if the node we want to go to is a parent node
-        if (!strcmp(stripPath, PARENT_DIR))
-        {
-            // if we are in the root node, we don't do that here
-            if (currentNode->parent == NULL)
-            {
-                printf("cd: no such file or directory: %s", path);
-                return copyCurrentNode;
-            }
-            else
-                currentNode = currentNode->parent;
-        }
+        if (lookup.error == RESOLVE_LOOP)
+            out_printf("cd: too many levels of symbolic links: %s", path);
         else
-        {
-            found = 0;
-            // we search for the content from the current node
-            FolderContent *folderContent = currentNode->content;
-            ListNode *listNode = folderContent->children->head;
-            while (listNode != NULL)
-            {
-                // if we find the node we want to go to, we store it
-                if (strcmp(listNode->info->name, stripPath) == 0)
-                {
-                    currentNode = listNode->info;
-                    found = 1;
-                    break;
-                }
-                listNode = listNode->next;
-            }
-            // if we didn't find the node we want to go to
-            // we print an error message
-            if (!found)
-            {
-                printf("cd: no such file or directory: %s", path);
-                return copyCurrentNode;
-            }
-        }
-        // we get the next path
-        stripPath = strtok(NULL, "/");
+            out_printf("cd: no such file or directory: %s", path);
+        return currentNode;
     }
     // we return the node we want to go to
-    return currentNode;
+    return lookup.node;
 }
 
 void tree(TreeNode *currentNode, char *arg)
 {
     // if the arg is empty, print the current folder's content
     // else print the content of the arg folder
-    char *stripPath = strtok(arg, "/");
-    int found = 0;
-    while (stripPath != NULL)
+    PathLookup lookup;
+    if (resolve_path(currentNode, arg, &lookup) < 0 || lookup.node == NULL ||
+        lookup.node->type != FOLDER_NODE)
     {
-        // we check if the node we want to go to is a parent node
-        if (!strcmp(stripPath, PARENT_DIR))
-        {
-            // if we are in the root node, we don't go to the parent node
-            if (currentNode->parent == NULL)
-                break;
-            else
-                currentNode = currentNode->parent;
-        }
+        out_printf("%s [error opening dir]\n\n0 directories, 0 files\n", arg);
+        return;
+    }
+
+    size_t noDirectories = 0;
+    size_t noFiles = 0;
+
+    // every node is printed once, indented by its depth
+    TreeWalk walk;
+    TreeNode *node;
+    walk_start(&walk, lookup.node);
+    while ((node = walk_next(&walk)) != NULL)
+    {
+        if (walk.leaving)
+            continue;
+        out_pad(walk.level * TREE_CMD_INDENT_SIZE);
+        out_puts(node->name);
+        // a symlink shows where it points, and counts as a file
+        if (node->type == SYMLINK_NODE)
+            out_printf(" -> %s", ((FileContent *)node->content)->target);
+        out_write("\n", 1);
+        if (node->type == FOLDER_NODE)
+            noDirectories++;
         else
+            noFiles++;
+    }
+    walk_end(&walk);
+    out_printf("\n%zu directories, %zu files\n", noDirectories, noFiles);
+}
+
+// what the path holds, read off the folder's stats without walking it
+static int path_stats(TreeNode *currentNode, const char *command, char *arg,
+                      TreeStats *stats)
+{
+    PathLookup lookup;
+    if (resolve_path(currentNode, arg, &lookup) < 0 || lookup.node == NULL)
+    {
+        out_printf("%s: cannot access '%s': %s\n", command, arg,
+                   lookup_reason(&lookup));
+        return -1;
+    }
+
+    // a folder counts what it holds, not itself
+    node_stats(lookup.node, stats);
+    if (lookup.node->type == FOLDER_NODE)
+        stats->folders--;
+    return 0;
+}
+
+void du(TreeNode *currentNode, char *arg)
+{
+    TreeStats stats;
+
+    if (path_stats(currentNode, "du", arg, &stats) == 0)
+        out_printf("%llu\t%s\n", (unsigned long long)stats.bytes,
+                   strcmp(arg, NO_ARG) ? arg : ".");
+}
+
+void countTree(TreeNode *currentNode, char *arg)
+{
+    TreeStats stats;
+
+    if (path_stats(currentNode, "count", arg, &stats) == 0)
+        out_printf("%llu directories, %llu files\n",
+                   (unsigned long long)stats.folders,
+                   (unsigned long long)stats.files);
+}
+
+void statPath(TreeNode *currentNode, char *path)
+{
+    static const char *types[] = {"regular file", "directory",
+                                  "symbolic link"};
+    PathLookup lookup;
+
+    // like lstat, a symlink is shown itself
+    if (!strcmp(path, NO_ARG))
+    {
+        out_puts("stat: missing operand\n");
+        return;
+    }
+    if (resolve_entry(currentNode, path, &lookup) < 0 || lookup.node == NULL)
+    {
+        out_printf("stat: cannot stat '%s': %s\n", path,
+                   lookup_reason(&lookup));
+        return;
+    }
+
+    TreeNode *treeNode = lookup.node;
+    InodeTable *table = &node_mem(treeNode)->inodes;
+    uint32_t ino = node_ino(treeNode);
+    char mode[11];
+    char modify[48];
+    char change[48];
+    mode_string(table->mode[ino], mode);
+    time_string(table->mtime[ino], 1, modify, sizeof(modify));
+    time_string(table->ctime[ino], 1, change, sizeof(change));
+
+    out_printf("  File: %s", path);
+    if (treeNode->type == SYMLINK_NODE)
+        out_printf(" -> %s", ((FileContent *)treeNode->content)->target);
+    out_printf("\n  Size: %llu\tType: %s\n"
+               " Inode: %u\tLinks: %u\n"
+               "Access: (%04o/%s)\n"
+               "Modify: %s\n"
+               "Change: %s\n",
+               (unsigned long long)table->size[ino], types[treeNode->type],
+               ino, node_links(treeNode),
+               table->mode[ino] & MODE_PERMISSIONS, mode, modify, change);
+}
+
+void changeMode(TreeNode *currentNode, char *mode, char *path)
+{
+    PathLookup lookup;
+
+    if (!strcmp(path, NO_ARG))
+    {
+        out_printf("chmod: missing operand after '%s'\n", mode);
+        return;
+    }
+    // only the permission bits, in octal
+    char *end;
+    unsigned long bits = strtoul(mode, &end, 8);
+    if (*mode < '0' || *mode > '7' || *end != '\0' ||
+        bits > MODE_PERMISSIONS)
+    {
+        out_printf("chmod: invalid mode: '%s'\n", mode);
+        return;
+    }
+    // a symlink changes where it leads
+    if (resolve_path(currentNode, path, &lookup) < 0 || lookup.node == NULL)
+    {
+        out_printf("chmod: cannot access '%s': %s\n", path,
+                   lookup_reason(&lookup));
+        return;
+    }
+
+    TreeMem *mem = node_mem(lookup.node);
+    uint16_t *nodeMode = &mem->inodes.mode[node_ino(lookup.node)];
+    txn_mode(lookup.node, *nodeMode & MODE_PERMISSIONS);
+    *nodeMode = (*nodeMode & MODE_TYPE) | (uint16_t)bits;
+    inode_touch(mem, lookup.node, 0);
+}
+
+// how find and grep print the nodes under the path they start from
+typedef struct PathPrefix {
+    TreeNode* start;
+    // the path as it was given, without its trailing slashes
+    const char* path;
+    size_t pathLength;
+    // the length of the start folder's full path
+    size_t startLength;
+} PathPrefix;
+
+// a printed path, and what grep matched in it
+typedef struct FoundPath {
+    char* path;
+    GrepMatch* match;
+} FoundPath;
+
+// what find matched so far
+typedef struct FindSearch {
+    PathPrefix prefix;
+    FoundPath* found;
+    size_t count;
+    size_t capacity;
+} FindSearch;
+
+static void prefix_init(PathPrefix *prefix, TreeNode *start, const char *path)
+{
+    prefix->start = start;
+    prefix->path = path;
+    prefix->pathLength = strlen(path);
+    while (prefix->pathLength > 1 && path[prefix->pathLength - 1] == '/')
+        prefix->pathLength--;
+    prefix->startLength = 0;
+    if (start->type == FOLDER_NODE)
+        folder_path(start, &prefix->startLength);
+}
+
+// the path of a node under the start, read off its folder's cached path
+static char *prefix_path(PathPrefix *prefix, TreeNode *treeNode)
+{
+    const char *path = "";
+    size_t length = 0;
+    size_t nameLength = 0;
+    // a path of / already ends in the slash
+    int slash = prefix->pathLength != 0 &&
+                prefix->path[prefix->pathLength - 1] == '/';
+    if (treeNode != prefix->start)
+    {
+        path = folder_path(treeNode->parent, &length) + prefix->startLength;
+        length -= prefix->startLength;
+        nameLength = strlen(treeNode->name);
+        // without a path given, the paths start right under the start
+        if ((prefix->pathLength == 0 || slash) && length != 0)
         {
-            found = 0;
-            // we search for the content from the current node
-            FolderContent *folderContent = currentNode->content;
-            ListNode *listNode = folderContent->children->head;
-            while (listNode != NULL)
-            {
-                // if we find the node we want to go to, we store it
-                if (strcmp(listNode->info->name, stripPath) == 0)
-                {
-                    currentNode = listNode->info;
-                    found = 1;
-                    break;
-                }
-                listNode = listNode->next;
-            }
-            // if we didn't find the node we want to go to
-            if (!found)
-            {
-                printf("%s [error opening dir]\n\n0 directories, 0 files\n",
-                       arg);
-                return;
-            }
+            path++;
+            length--;
         }
-        // we get the next path
-        stripPath = strtok(NULL, "/");
     }
 
-    // we check if the source node is a file
-    if (currentNode->type == FILE_NODE)
+    char *result = malloc(prefix->pathLength + length + nameLength + 2);
+    DIE(!result, "malloc");
+    size_t size = prefix->pathLength;
+    memcpy(result, prefix->path, size);
+    memcpy(result + size, path, length);
+    size += length;
+    if (treeNode != prefix->start)
     {
-        printf("%s [error opening dir]\n\n0 directories, 0 files\n", arg);
+        if (size != 0 && (length != 0 || !slash))
+            result[size++] = '/';
+        memcpy(result + size, treeNode->name, nameLength);
+        size += nameLength;
+    }
+    result[size] = '\0';
+    return result;
+}
+
+static int compare_found(const void *a, const void *b)
+{
+    return strcmp(((const FoundPath *)a)->path, ((const FoundPath *)b)->path);
+}
+
+static void add_match(void *arg, TreeNode *treeNode)
+{
+    FindSearch *search = arg;
+    TreeNode *start = search->prefix.start;
+
+    if (treeNode == start || !is_ancestor(start, treeNode))
         return;
+
+    if (search->count == search->capacity)
+    {
+        search->capacity = search->capacity ? search->capacity * 2 : 64;
+        search->found = realloc(search->found,
+                                search->capacity * sizeof(FoundPath));
+        DIE(!search->found, "realloc");
     }
+    FoundPath *found = &search->found[search->count++];
+    found->path = prefix_path(&search->prefix, treeNode);
+    found->match = NULL;
+}
 
-    TreeNode *parrent = currentNode->parent;
-    FolderContent *folderContent;
-    ListNode *listNode;
+// like find and grep, "." is where we are
+static TreeNode *search_start(TreeNode *currentNode, const char *command,
+                              char *path)
+{
+    PathLookup lookup;
 
-    int noDirectories = 0;
-    int noFiles = 0;
-    int i = 0;
-    int back = 0;
+    if (!strcmp(path, "."))
+        return currentNode;
+    if (resolve_path(currentNode, path, &lookup) < 0 || lookup.node == NULL)
+    {
+        out_printf("%s: '%s': No such file or directory\n", command, path);
+        return NULL;
+    }
+    return lookup.node;
+}
 
-    char *name;
-    // iterate through the current node's content
-    while (currentNode != parrent)
+void findNodes(TreeNode *currentNode, char *path, char *pattern)
+{
+    TreeNode *start = search_start(currentNode, "find", path);
+    if (start == NULL)
+        return;
+
+    // no pattern matches everything
+    if (!strcmp(pattern, NO_ARG))
+        pattern = "*";
+
+    FindSearch search;
+    prefix_init(&search.prefix, start, strcmp(path, NO_ARG) ? path : ".");
+    search.found = NULL;
+    search.count = search.capacity = 0;
+
+    // a file is only matched against itself
+    if (start->type != FOLDER_NODE)
     {
-        folderContent = currentNode->content;
-        listNode = folderContent->children->head;
-        // when we return in parent folder
-        if (back)
+        if (fnmatch(pattern, start->name, 0) == 0)
         {
-            while (strcmp(listNode->info->name, name) != 0 && listNode != NULL)
-                listNode = listNode->next;
-            if (listNode != NULL)
-                listNode = listNode->next;
-            back = 0;
+            out_write(search.prefix.path, search.prefix.pathLength);
+            out_write("\n", 1);
         }
-        // we search in a folder all the files and folders
-        while (listNode != NULL)
+        return;
+    }
+
+    TreeNode *root = start;
+    while (root->parent != NULL)
+        root = root->parent;
+    TreeMem *mem = node_mem(root);
+    // the first search pays for the index, the tree keeps it up to date
+    index_build(mem, root);
+    index_find(mem, pattern, add_match, &search);
+
+    // the index keeps equal names in no particular order, the paths are
+    // sorted so a search always prints the same
+    if (search.count > 1)
+        qsort(search.found, search.count, sizeof(FoundPath), compare_found);
+    for (size_t i = 0; i < search.count; i++)
+    {
+        out_puts(search.found[i].path);
+        out_write("\n", 1);
+        free(search.found[i].path);
+    }
+    free(search.found);
+}
+
+void grepFiles(TreeNode *currentNode, char *pattern, char *path, int indexed)
+{
+    if (!strcmp(pattern, NO_ARG))
+    {
+        out_printf("grep: missing pattern\n");
+        return;
+    }
+    TreeNode *start = search_start(currentNode, "grep", path);
+    if (start == NULL)
+        return;
+
+    GrepMatch *matches;
+    size_t count = grep_search(start, pattern, indexed, &matches);
+
+    // the threads matched the files in any order, they are printed sorted
+    PathPrefix prefix;
+    prefix_init(&prefix, start, path);
+    FoundPath *found = malloc((count ? count : 1) * sizeof(FoundPath));
+    DIE(!found, "malloc");
+    for (size_t i = 0; i < count; i++)
+    {
+        found[i].path = prefix_path(&prefix, matches[i].file);
+        found[i].match = &matches[i];
+    }
+    if (count > 1)
+        qsort(found, count, sizeof(FoundPath), compare_found);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        GrepMatch *match = found[i].match;
+        const char *line = match->lines;
+        const char *end = match->lines + match->length;
+        while (line < end)
         {
-            // if the node is a folder, we print the folder's name
-            // we increment the number of directories
-            // and we go to the folder
-            if (listNode->info->type == FOLDER_NODE)
-            {
-                printf("%*s%s\n", i * TREE_CMD_INDENT_SIZE, "",
-                       listNode->info->name);
-                noDirectories++;
-                i++;
-                currentNode = listNode->info;
+            const char *stop = memchr(line, '\n', end - line);
+            out_puts(found[i].path);
+            out_write(":", 1);
+            out_write(line, stop - line + 1);
+            line = stop + 1;
+        }
+        free(match->lines);
+        free(found[i].path);
+    }
+    free(found);
+    free(matches);
+}
 
-                break;
-            }
-            // if the node is a file, we print the file's name
-            // we increment the number of files
-            else
+// a file top kept, by its value in the column scanned
+typedef struct TopFile {
+    uint64_t key;
+    uint32_t ino;
+    TreeNode* name;
+} TopFile;
+
+// the smaller value first, and the later file on a tie
+static int top_less(const TopFile *a, const TopFile *b)
+{
+    return a->key != b->key ? a->key < b->key : a->ino > b->ino;
+}
+
+static void top_sift(TopFile *heap, size_t count, size_t i)
+{
+    for (;;)
+    {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        if (left < count && top_less(&heap[left], &heap[smallest]))
+            smallest = left;
+        if (left + 1 < count && top_less(&heap[left + 1], &heap[smallest]))
+            smallest = left + 1;
+        if (smallest == i)
+            return;
+        TopFile swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+static int compare_top(const void *a, const void *b)
+{
+    return top_less(b, a) ? -1 : top_less(a, b);
+}
+
+void topFiles(TreeNode *currentNode, char *field, char *count, char *path)
+{
+    // the times are never negative, they sort the same as unsigned
+    const uint64_t *keys;
+    TreeMem *mem = node_mem(currentNode);
+    if (!strcmp(field, "size"))
+        keys = mem->inodes.size;
+    else if (!strcmp(field, "mtime"))
+        keys = (const uint64_t *)mem->inodes.mtime;
+    else if (!strcmp(field, "ctime"))
+        keys = (const uint64_t *)mem->inodes.ctime;
+    else
+    {
+        out_printf("top: invalid field '%s'\n", field);
+        return;
+    }
+    size_t limit = TOP_DEFAULT_COUNT;
+    if (*count != '\0' && parse_size("top", "count", count, &limit) < 0)
+        return;
+    TreeNode *start = search_start(currentNode, "top", path);
+    if (start == NULL)
+        return;
+    if (start->type != FOLDER_NODE)
+    {
+        out_printf("top: '%s': Not a directory\n", path);
+        return;
+    }
+
+    // the scan reads the type column and the one asked for, a file's
+    // names are only looked at once it made it into the heap
+    InodeTable *table = &mem->inodes;
+    const uint16_t *mode = table->mode;
+    size_t capacity = limit < table->count ? limit : table->count;
+    TopFile *heap = malloc((capacity ? capacity : 1) * sizeof(TopFile));
+    DIE(!heap, "malloc");
+    size_t used = 0;
+    for (uint32_t ino = 1; ino < table->count && limit > 0; ino++)
+    {
+        if ((mode[ino] & MODE_TYPE) != MODE_FILE)
+            continue;
+        TopFile file = {keys[ino], ino, NULL};
+        if (used == limit && !top_less(&heap[0], &file))
+            continue;
+        file.name = inode_name(mem, ino, start);
+        if (file.name == NULL)
+            continue;
+        if (used < limit)
+        {
+            // a new leaf climbs to its place
+            size_t i = used++;
+            while (i > 0 && top_less(&file, &heap[(i - 1) / 2]))
             {
-                printf("%*s%s\n", i * TREE_CMD_INDENT_SIZE, "",
-                       listNode->info->name);
-                noFiles++;
+                heap[i] = heap[(i - 1) / 2];
+                i = (i - 1) / 2;
             }
-            listNode = listNode->next;
+            heap[i] = file;
+        }
+        else
+        {
+            heap[0] = file;
+            top_sift(heap, used, 0);
         }
+    }
 
-        // if we are at the end of a folders content
-        // we return to the parent folder
-        if (listNode == NULL)
+    if (used > 1)
+        qsort(heap, used, sizeof(TopFile), compare_top);
+    PathPrefix prefix;
+    prefix_init(&prefix, start, path);
+    for (size_t i = 0; i < used; i++)
+    {
+        char *name = prefix_path(&prefix, heap[i].name);
+        if (keys == table->size)
+            out_printf("%llu\t%s\n", (unsigned long long)heap[i].key, name);
+        else
         {
-            name = currentNode->name;
-            back = 1;
-            currentNode = currentNode->parent;
-            i--;
+            char time[48];
+            time_string((int64_t)heap[i].key, 1, time, sizeof(time));
+            out_printf("%s\t%s\n", time, name);
         }
+        free(name);
     }
-    printf("\n%d directories, %d files\n", noDirectories, noFiles);
+    free(heap);
+}
+
+void mkdir(TreeNode *currentNode, char *folderName)
+{
+    PathLookup lookup;
+
+    // we need the folder that will hold the new one, a symlink of that
+    // name is in the way
+    if (resolve_entry(currentNode, folderName, &lookup) < 0)
+    {
+        out_printf("mkdir: cannot create directory '%s': "
+                   "No such file or directory\n", folderName);
+        return;
+    }
+
+    // if the folder already exists, we print an error message
+    if (lookup.node != NULL)
+    {
+        out_printf("mkdir: cannot create directory '%s': File exists\n",
+                   folderName);
+        return;
+    }
+
+    // if the folder doesn't exist, we create it
+    create_node(lookup.parent,
+                copy_name(lookup.parent, lookup.last, lookup.last_len),
+                FOLDER_NODE);
+}
+
+void rmrec(TreeNode *currentNode, char *resourceName)
+{
+    PathLookup lookup;
+
+    // check if the resource exists, a symlink is removed, not followed
+    if (resolve_entry(currentNode, resourceName, &lookup) < 0 ||
+        lookup.node == NULL)
+    {
+        out_printf("rmrec: failed to remove '%s': No such file or directory\n",
+                   resourceName);
+        return;
+    }
+
+    // we can't remove the folder we are in, or one of its parents
+    if (is_ancestor(lookup.node, currentNode))
+    {
+        out_printf("rmrec: failed to remove '%s': Device or resource busy\n",
+                   resourceName);
+        return;
+    }
+
+    // we remove the resource and all its content
+    remove_node(lookup.node);
+}
+
+void rm(TreeNode *currentNode, char *fileName)
+{
+    PathLookup lookup;
+
+    // check if the file exists, a symlink is removed, not followed
+    if (resolve_entry(currentNode, fileName, &lookup) < 0 ||
+        lookup.node == NULL)
+    {
+        out_printf("rm: failed to remove '%s': No such file or directory\n",
+                   fileName);
+        return;
+    }
+
+    // if the file is a folder, we print an error message
+    if (lookup.node->type == FOLDER_NODE)
+    {
+        out_printf("rm: cannot remove '%s': Is a directory\n", fileName);
+        return;
+    }
+
+    // if the resource is a file, we remove it
+    remove_node(lookup.node);
+}
+
+void rmdir(TreeNode *currentNode, char *folderName)
+{
+    PathLookup lookup;
+
+    // verify if the folder exists
+    if (resolve_entry(currentNode, folderName, &lookup) < 0 ||
+        lookup.node == NULL)
+    {
+        out_printf("rmdir: failed to remove '%s': No such file or directory\n",
+                   folderName);
+        return;
+    }
+    TreeNode *treeNode = lookup.node;
+    // if the folder is a file, we print an error message
+    if (treeNode->type != FOLDER_NODE)
+    {
+        out_printf("rmdir: failed to remove '%s': Not a directory\n",
+                   folderName);
+        return;
+    }
+    // if the folder is not empty, we print an error message
+    if (((FolderContent *)treeNode->content)->size != 0)
+    {
+        out_printf("rmdir: failed to remove '%s': Directory not empty\n",
+                   folderName);
+        return;
+    }
+    // we can't remove the folder we are in
+    if (treeNode == currentNode)
+    {
+        out_printf("rmdir: failed to remove '%s': Device or resource busy\n",
+                   folderName);
+        return;
+    }
+    // if the folder is empty, we remove it and free the memory
+    remove_node(treeNode);
 }
 
-void mkdir(TreeNode *currentNode, char *folderName)
+void touch(TreeNode *currentNode, char *fileName, char *fileContent)
 {
-    // check if the folder already exists
-    TreeNode *treeNode = fileExist(currentNode, folderName);
+    PathLookup lookup;
 
-    // if the folder already exists, we print an error message
-    if (treeNode != NULL)
+    // we need the folder that will hold the file
+    if (resolve_path(currentNode, fileName, &lookup) < 0)
     {
-        printf("mkdir: cannot create directory '%s': File exists\n",
-               folderName);
+        out_printf("touch: cannot touch '%s': No such file or directory\n",
+                   fileName);
         return;
     }
 
-    // if the folder doesn't exist, we create it
-    treeNode = (TreeNode *)malloc(sizeof(TreeNode));
-    DIE(!treeNode, "malloc");
+    // a file that exists only gets its times stamped
+    if (lookup.node != NULL)
+    {
+        inode_touch(node_mem(lookup.node), lookup.node, 1);
+        return;
+    }
 
-    // set the folder's props
-    treeNode->parent = currentNode;
-    treeNode->name = folderName;
-    treeNode->type = FOLDER_NODE;
-    // allocate memory for the folder's content
-    treeNode->content = (FolderContent *)malloc(sizeof(FolderContent));
-    DIE(!treeNode->content, "malloc");
+    // create file
+    TreeNode *treeNode = create_node(lookup.parent,
+                                     copy_name(lookup.parent, lookup.last,
+                                               lookup.last_len),
+                                     FILE_NODE);
 
-    // set the folder's content list
-    ((FolderContent *)treeNode->content)->children = ll_create();
+    // set file's content, if content exists
+    if (strcmp(fileContent, NO_ARG) != 0)
+    {
+        FileData *data = data_create(fileContent, strlen(fileContent));
+        set_data(treeNode, data);
+        data_release(data);
+    }
+}
 
-    // add the folder to the current node's content list
-    ll_add_node(((FolderContent *)currentNode->content)->children, treeNode);
-    // let it be free, we just copied it
-    free(treeNode);
+// copies the children of a folder in a folder that already exists,
+// merging them with the ones there
+static void merge_folder(TreeNode *sourceNode, TreeNode *destinationNode)
+{
+    // we go last to first, so the new children keep their order
+    TreeNode *child = ((FolderContent *)sourceNode->content)->head;
+    while (child != NULL && child->next != NULL)
+        child = child->next;
+    for (; child != NULL; child = child->prev)
+    {
+        TreeNode *existing = fileExist(destinationNode, child->name);
+        if (existing == NULL)
+            copy_subtree(child, destinationNode,
+                         name_hold(node_mem(child), child->name));
+        else if (existing->type == FOLDER_NODE && child->type != FOLDER_NODE)
+            out_printf("cp: cannot overwrite directory '%s' with "
+                       "non-directory\n", child->name);
+        else if (existing->type != FOLDER_NODE && child->type == FOLDER_NODE)
+            out_printf("cp: cannot overwrite non-directory '%s' with "
+                       "directory '%s'\n", child->name, child->name);
+        else if (existing->type == FOLDER_NODE)
+            merge_folder(child, existing);
+        else if (existing->type == FILE_NODE && child->type == FILE_NODE)
+            // the copy shares the source's content
+            set_data(existing, ((FileContent *)child->content)->data);
+        else
+        {
+            // a symlink is replaced, not written through
+            remove_node(existing);
+            copy_subtree(child, destinationNode,
+                         name_hold(node_mem(child), child->name));
+        }
+    }
 }
 
-void rmrec(TreeNode *currentNode, char *resourceName)
+static void copy_folder(TreeNode *currentNode, TreeNode *sourceNode,
+                        char *source, char *destination)
 {
-    // check if the resource exists
-    TreeNode *treeNode = fileExist(currentNode, resourceName);
+    PathLookup lookup;
 
-    // if the resource doesn't exist, we print an error message
-    if (treeNode == NULL)
+    // verify if we can acces the destination folder
+    if (resolve_path(currentNode, destination, &lookup) < 0)
+    {
+        out_printf("cp: failed to access '%s': Not a directory\n", destination);
+        return;
+    }
+
+    // like for files, the copy goes inside a destination folder, or else
+    // the destination names it
+    TreeNode *destinationFolder = lookup.parent;
+    TreeNode *destinationNode = lookup.node;
+    int inside = 0;
+    if (destinationNode != NULL && destinationNode->type == FOLDER_NODE)
+    {
+        destinationFolder = destinationNode;
+        destinationNode = fileExist(destinationFolder, sourceNode->name);
+        inside = 1;
+    }
+
+    if (destinationNode == sourceNode)
+    {
+        out_printf("cp: '%s' and '%s' are the same file\n", source,
+                   destination);
+        return;
+    }
+    // the copy would end up inside the folder being copied
+    if (is_ancestor(sourceNode, destinationFolder))
+    {
+        out_printf("cp: cannot copy a directory, '%s', into itself, '%s'\n",
+                   source, destination);
+        return;
+    }
+    if (destinationNode != NULL && destinationNode->type != FOLDER_NODE)
     {
-        printf("rmrec: failed to remove '%s': No such file or directory\n",
-               resourceName);
+        out_printf("cp: cannot overwrite non-directory '%s' with directory "
+                   "'%s'\n", destination, source);
         return;
     }
 
-    // we remove the file from the current node's content list
-    FolderContent *folderContent = currentNode->content;
-    ListNode *removed = ll_remove_node(folderContent->children, resourceName);
-    // if the resource is a folder, we remove it
-    freeNode(removed->info);
-    free(removed);
+    // a new folder is copied whole, big ones by several threads
+    if (destinationNode == NULL)
+        copy_subtree(sourceNode, destinationFolder,
+                     inside ? name_hold(node_mem(sourceNode), sourceNode->name)
+                            : copy_name(destinationFolder, lookup.last,
+                                        lookup.last_len));
+    else
+        merge_folder(sourceNode, destinationNode);
 }
 
-void rm(TreeNode *currentNode, char *fileName)
+// like resolve_entry, but a symlink to a folder leads into it, where
+// commands put what they move or link
+static int resolve_destination(TreeNode *currentNode, const char *path,
+                               PathLookup *lookup)
 {
-    // check if the file exists
-    TreeNode *treeNode = fileExist(currentNode, fileName);
+    PathLookup followed;
+
+    if (resolve_entry(currentNode, path, lookup) < 0)
+        return -1;
+    if (lookup->node != NULL && lookup->node->type == SYMLINK_NODE &&
+        resolve_path(currentNode, path, &followed) == 0 &&
+        followed.node != NULL && followed.node->type == FOLDER_NODE)
+        *lookup = followed;
+    return 0;
+}
 
-    // if the file doesn't exist, we print an error message
-    if (treeNode == NULL)
+void cp(TreeNode *currentNode, char *source, char *destination, int recursive)
+{
+    PathLookup sourceLookup, destinationLookup;
+
+    // check if the source exists and get the source node
+    if (resolve_path(currentNode, source, &sourceLookup) < 0 ||
+        sourceLookup.node == NULL)
     {
-        printf("rm: failed to remove '%s': No such file or directory\n",
-               fileName);
+        out_printf("cp: cannot stat '%s': No such file or directory\n", source);
         return;
     }
+    TreeNode *sourceNode = sourceLookup.node;
 
-    // if the file is a folder, we print an error message
-    if (treeNode->type == FOLDER_NODE)
+    // folders are only copied with -r
+    if (sourceNode->type == FOLDER_NODE)
     {
-        printf("rm: cannot remove '%s': Is a directory\n", fileName);
+        if (recursive)
+            copy_folder(currentNode, sourceNode, source, destination);
+        else
+            out_printf("cp: -r not specified; omitting directory '%s'\n",
+                       source);
         return;
     }
 
-    // if the resource is a file, we remove it
-    FolderContent *folderContent = currentNode->content;
-    ListNode *removed = ll_remove_node(folderContent->children, fileName);
-    free(treeNode->content);
-    free(treeNode);
-    free(removed);
-}
-
-void rmdir(TreeNode *currentNode, char *folderName)
-{
-    // verify if the folder exists
-    TreeNode *treeNode = fileExist(currentNode, folderName);
-    // if the folder doesn't exist, we print an error message
-    if (treeNode == NULL)
+    // verify if we can acces the destination folder
+    if (resolve_path(currentNode, destination, &destinationLookup) < 0)
     {
-        printf("rmdir: failed to remove '%s': No such file or directory\n",
-               folderName);
+        out_printf("cp: failed to access '%s': Not a directory\n", destination);
         return;
     }
-    // if the folder is not empty, we print an error message
-    if (treeNode->type == FOLDER_NODE)
+
+    // if the destination is a folder, we copy the file inside it
+    // else the destination names the copy
+    TreeNode *destinationFolder = destinationLookup.parent;
+    TreeNode *destinationNode = destinationLookup.node;
+    char *name = NULL;
+    if (destinationNode != NULL && destinationNode->type == FOLDER_NODE)
     {
-        FolderContent *folderContent = treeNode->content;
-        if (folderContent->children->head != NULL)
+        // a symlink of that name in the folder is written through too
+        if (resolve_path(destinationNode, sourceNode->name,
+                         &destinationLookup) < 0)
         {
-            printf("rmdir: failed to remove '%s': Directory not empty\n",
-                   folderName);
+            out_printf("cp: failed to access '%s': %s\n", destination,
+                       lookup_reason(&destinationLookup));
             return;
         }
+        destinationFolder = destinationLookup.parent;
+        destinationNode = destinationLookup.node;
     }
-    // if the folder is a file, we print an error message
-    else
+    if (destinationNode == NULL)
+        name = copy_name(destinationFolder, destinationLookup.last,
+                         destinationLookup.last_len);
+
+    // another name of the source is the same file as well
+    if (destinationNode != NULL &&
+        destinationNode->content == sourceNode->content)
     {
-        printf("rmdir: failed to remove '%s': Not a directory\n", folderName);
+        out_printf("cp: '%s' and '%s' are the same file\n", source,
+                   destination);
         return;
     }
-    // if the folder is empty, we remove it and free the memory
-    FolderContent *folderContent = currentNode->content;
-    ListNode *removed = ll_remove_node(folderContent->children, folderName);
-    free(treeNode->content);
-    free(treeNode);
-    free(removed);
+    if (destinationNode != NULL && destinationNode->type == FOLDER_NODE)
+    {
+        out_printf("cp: cannot overwrite directory '%s' with non-directory\n",
+                   destination);
+        return;
+    }
+
+    // if the file doesn't exist, we create a new one
+    if (destinationNode == NULL)
+        destinationNode = create_node(destinationFolder, name, FILE_NODE);
+
+    // and it shares the source content, no bytes are copied
+    set_data(destinationNode, ((FileContent *)sourceNode->content)->data);
 }
 
-void touch(TreeNode *currentNode, char *fileName, char *fileContent)
+void mv(TreeNode *currentNode, char *source, char *destination)
 {
-    // verify if file exists
-    TreeNode *treeNode = fileExist(currentNode, fileName);
-    if (treeNode != NULL)
-        return;
+    PathLookup sourceLookup, destinationLookup;
 
-    // create file
-    treeNode = (TreeNode *)malloc(sizeof(TreeNode));
-    DIE(!treeNode, "malloc");
+    // check if the source exists and get the source node, a symlink is
+    // moved itself
+    if (resolve_entry(currentNode, source, &sourceLookup) < 0 ||
+        sourceLookup.node == NULL)
+    {
+        out_printf("mv: cannot stat '%s': No such file or directory\n", source);
+        return;
+    }
+    TreeNode *sourceNode = sourceLookup.node;
+    if (sourceNode->parent == NULL)
+    {
+        out_printf("mv: cannot move '%s': Device or resource busy\n", source);
+        return;
+    }
 
-    // set file's props
-    treeNode->parent = currentNode;
-    treeNode->name = fileName;
-    treeNode->type = FILE_NODE;
-    treeNode->content = (FileContent *)malloc(sizeof(FileContent));
-    DIE(!treeNode->content, "malloc");
+    // verify if we can acces the destination folder
+    if (resolve_destination(currentNode, destination, &destinationLookup) < 0)
+    {
+        out_printf("mv: failed to access '%s': Not a directory\n", destination);
+        return;
+    }
 
-    FileContent *nodeContent = treeNode->content;
-    // set file's content, if content exists
-    if (strcmp(fileContent, NO_ARG) == 0)
-        nodeContent->text = NULL;
+    // if the destination is a folder, we move the source inside it
+    // else the destination gives the new name of the source
+    TreeNode *destinationFolder = destinationLookup.parent;
+    TreeNode *destinationNode = destinationLookup.node;
+    int rename = 0;
+    if (destinationNode != NULL && destinationNode->type == FOLDER_NODE)
+    {
+        destinationFolder = destinationNode;
+        destinationNode = fileExist(destinationFolder, sourceNode->name);
+    }
     else
+        rename = 1;
+
+    // two names of a file are left as they are
+    if (destinationNode != NULL &&
+        destinationNode->content == sourceNode->content)
+        return;
+    // a folder can't be moved inside itself
+    if (is_ancestor(sourceNode, destinationFolder))
     {
-        // allocate memory for the file's content
-        nodeContent->text = fileContent;
+        out_printf("mv: cannot move '%s' to a subdirectory of itself, '%s'\n",
+                   source, destination);
+        return;
     }
-    // add the file to the current node's content list
-    ll_add_node(((FolderContent *)currentNode->content)->children, treeNode);
-    // let it be free, we just copied it
-    free(treeNode);
-}
 
-void cp(TreeNode *currentNode, char *source, char *destination)
-{
-    TreeNode *destinationNode = currentNode;
-    TreeNode *sourceNode = currentNode;
-    // check if the source exists and get the source node
-    char *stripSourcePath = strtok(source, "/");
-    while (stripSourcePath != NULL)
+    if (destinationNode != NULL)
     {
-        // we check if the node we want to go to is a parent node
-        if (!strcmp(stripSourcePath, PARENT_DIR))
+        if (destinationNode->type == FOLDER_NODE)
         {
-            // if we are in the root node, we don't go to the parent node
-            if (sourceNode->parent == NULL)
-                break;
-            else
-                sourceNode = sourceNode->parent;
+            out_printf("mv: cannot overwrite directory '%s'\n", destination);
+            return;
         }
-        else
+        if (sourceNode->type == FOLDER_NODE)
         {
-            // we search for the content from the current node
-            FolderContent *folderContent = sourceNode->content;
-            ListNode *listNode = folderContent->children->head;
-            while (listNode != NULL)
-            {
-                // if we find the node we want to go to, we store it
-                if (strcmp(listNode->info->name, stripSourcePath) == 0)
-                {
-                    sourceNode = listNode->info;
-                    break;
-                }
-                listNode = listNode->next;
-            }
+            out_printf("mv: cannot overwrite non-directory '%s' with "
+                       "directory '%s'\n", destination, source);
+            return;
+        }
+
+        // a file with a single name takes over the source content, and
+        // the source is removed
+        if (sourceNode->type == FILE_NODE &&
+            destinationNode->type == FILE_NODE &&
+            sourceNode->linkNext == NULL && destinationNode->linkNext == NULL)
+        {
+            set_data(destinationNode,
+                     ((FileContent *)sourceNode->content)->data);
+            remove_node(sourceNode);
+            return;
         }
-        // we get the next path
-        stripSourcePath = strtok(NULL, "/");
+        // any other name is replaced by the source itself, the rest of
+        // its file stays with its other names
+        remove_node(destinationNode);
     }
 
-    // we check if the source node is a folder
+    // we unlink the source from its folder, and from its stats
+    TreeNode *sourceFolder = sourceNode->parent;
+    TreeStats stats;
+    node_stats(sourceNode, &stats);
+    stats_update(sourceNode->parent, NULL, &stats);
+    txn_moved(sourceNode);
+    folder_unlink(sourceNode->parent->content, sourceNode);
+    TreeMem *mem = node_mem(destinationFolder);
+    if (rename)
+    {
+        char *oldName = sourceNode->name;
+        index_remove(mem, sourceNode);
+        sourceNode->name = copy_name(destinationFolder,
+                                     destinationLookup.last,
+                                     destinationLookup.last_len);
+        index_add(mem, sourceNode);
+        name_release(mem, oldName);
+    }
+    // and we link it to the destination folder
+    sourceNode->parent = destinationFolder;
+    folder_link(destinationFolder->content, sourceNode);
+    stats_update(destinationFolder, &stats, NULL);
+    inode_touch(mem, sourceNode, 0);
+    inode_touch(mem, sourceFolder, 1);
+    inode_touch(mem, destinationFolder, 1);
+    // the paths cached under a moved folder changed with it
     if (sourceNode->type == FOLDER_NODE)
+        path_invalidate(sourceNode);
+}
+
+void ln(TreeNode *currentNode, char *target, char *linkName, int symbolic)
+{
+    const char *kind = symbolic ? "symbolic" : "hard";
+    PathLookup lookup;
+
+    if (!strcmp(target, NO_ARG))
     {
-        printf("cp: -r not specified; omitting directory '%s'\n", source);
+        out_puts("ln: missing file operand\n");
+        return;
+    }
+    if (!strcmp(linkName, NO_ARG))
+    {
+        out_printf("ln: missing destination file operand after '%s'\n",
+                   target);
         return;
     }
 
-    // copy destination path
-    char *copyDestination = malloc(strlen(destination) + 1);
-    DIE(!copyDestination, "malloc");
-    memcpy(copyDestination, destination, strlen(destination) + 1);
-    // verify if we can acces the destination folder
-    char *stripDestinationPath = strtok(destination, "/");
-    char *fileDestinationName;
-    int found = 0;
-    while (stripDestinationPath != NULL)
+    // a hard link names the file itself, a symlink only keeps the path,
+    // which may lead nowhere
+    TreeNode *targetNode = NULL;
+    if (!symbolic)
     {
-        // we check if the node we want to go to is a parent node
-        if (!strcmp(stripDestinationPath, PARENT_DIR))
+        if (resolve_path(currentNode, target, &lookup) < 0 ||
+            lookup.node == NULL)
         {
-            // if we are in the root node, we don't go to the parent node
-            if (destinationNode->parent == NULL)
-            {
-                printf("cp: failed to access '%s': Not a directory\n",
-                       copyDestination);
-                free(copyDestination);
-                return;
-            }
-            else
-                destinationNode = destinationNode->parent;
-            stripDestinationPath = strtok(NULL, "/");
+            out_printf("ln: failed to access '%s': %s\n", target,
+                       lookup_reason(&lookup));
+            return;
         }
-        else
+        targetNode = lookup.node;
+        if (targetNode->type == FOLDER_NODE)
         {
-            found = 0;
-            // we search for the content from the current node
-            FolderContent *folderContent = destinationNode->content;
-            ListNode *listNode = folderContent->children->head;
-            while (listNode != NULL)
-            {
-                // if we find the node we want to go to, we store it
-                if (strcmp(listNode->info->name, stripDestinationPath) == 0)
-                {
-                    destinationNode = listNode->info;
-                    found = 1;
-                    break;
-                }
-                listNode = listNode->next;
-            }
-            fileDestinationName = stripDestinationPath;
-            // we get the next path
-            stripDestinationPath = strtok(NULL, "/");
-            // if we didn't find the node we want to go to
-            // we print an error message
-            if (!found && stripDestinationPath != NULL)
-            {
-                printf("cp: failed to access '%s': Not a directory\n",
-                       copyDestination);
-                free(copyDestination);
-                return;
-            }
+            out_printf("ln: '%s': hard link not allowed for directory\n",
+                       target);
+            return;
         }
     }
-    free(copyDestination);
-    // if the file exists, we update it with the source content
-    // else we create a new file
 
-    // verify if destination node is a folder
-    if (destinationNode->type == FOLDER_NODE)
+    if (resolve_destination(currentNode, linkName, &lookup) < 0)
+    {
+        out_printf("ln: failed to create %s link '%s': %s\n", kind, linkName,
+                   lookup_reason(&lookup));
+        return;
+    }
+
+    // in a folder, the link gets the target's name
+    TreeNode *folderNode = lookup.parent;
+    TreeNode *existing = lookup.node;
+    const char *name = lookup.last;
+    size_t length = lookup.last_len;
+    if (existing != NULL && existing->type == FOLDER_NODE)
     {
-        TreeNode *file = fileExist(destinationNode, sourceNode->name);
-        if (file)
+        folderNode = existing;
+        if (symbolic)
         {
-            // update the file
-            FileContent *destinationContent = destinationNode->content;
-            FileContent *sourceContent = sourceNode->content;
-            free(destinationContent->text);
-            destinationContent->text = malloc(strlen(sourceContent->text) + 1);
-            DIE(!destinationContent->text, "malloc");
-            memcpy(destinationContent->text, sourceContent->text,
-                   strlen(sourceContent->text) + 1);
-            return;
+            length = strlen(target);
+            while (length > 0 && target[length - 1] == '/')
+                length--;
+            name = target + length;
+            while (name > target && name[-1] != '/')
+                name--;
+            length = target + length - name;
         }
         else
         {
-            // create a new file
-            FileContent *fileContent = sourceNode->content;
-            // if the source file has content, we copy it
-            if (fileContent->text == NULL)
-                touch(destinationNode, strdup(sourceNode->name),
-                      strdup(NO_ARG));
-            else
-                touch(destinationNode, strdup(sourceNode->name),
-                      strdup(fileContent->text));
-            return;
+            name = targetNode->name;
+            length = strlen(name);
         }
+        existing = length ? folder_lookup(folderNode->content, name, length)
+                          : folderNode;
     }
-    if (!found)
+    if (existing != NULL)
     {
-        // destination node is a not existing file
-        // we copy the file
-        FileContent *fileContent = sourceNode->content;
-        if (fileContent->text == NULL)
-            touch(destinationNode, strdup(fileDestinationName), strdup(NO_ARG));
-        else
-            touch(destinationNode, strdup(fileDestinationName),
-                  strdup(fileContent->text));
+        out_printf("ln: failed to create %s link '%s': File exists\n", kind,
+                   linkName);
         return;
     }
+
+    TreeMem *mem = node_mem(folderNode);
+    TreeNode *linkNode = alloc_node(folderNode,
+                                    copy_name(folderNode, name, length),
+                                    symbolic ? SYMLINK_NODE : FILE_NODE);
+    if (symbolic)
+        file_init(mem, linkNode, pool_alloc(&mem->files), NULL,
+                  copy_name(folderNode, target, strlen(target)));
     else
     {
-        // update the file
-        FileContent *destinationContent = destinationNode->content;
-        FileContent *sourceContent = sourceNode->content;
-        // clear destination content
-        free(destinationContent->text);
-        destinationContent->text = malloc(strlen(sourceContent->text) + 1);
-        DIE(!destinationContent->text, "malloc");
-        // copy the source content
-        memcpy(destinationContent->text, sourceContent->text,
-               strlen(sourceContent->text) + 1);
-        return;
+        // no content is copied, the file gets one more name
+        link_add(mem, linkNode, targetNode);
+        inode_touch(mem, targetNode, 0);
     }
+    add_node(linkNode);
 }
 
-void mv(TreeNode *currentNode, char *source, char *destination)
+// parses an offset or a length argument
+int parse_size(const char *command, const char *what, const char *arg,
+               size_t *size)
 {
-    TreeNode *destinationNode = currentNode;
-    TreeNode *sourceNode = currentNode;
+    char *end;
 
-    // check if the source exists and get the source node
-    char *stripSourcePath = strtok(source, "/");
-    while (stripSourcePath != NULL)
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (*arg == '\0' || *arg == '-' || *end != '\0' || errno != 0 ||
+        value > SIZE_MAX / 2)
     {
-        // we check if the node we want to go to is a parent node
-        if (!strcmp(stripSourcePath, PARENT_DIR))
+        out_printf("%s: invalid %s '%s'\n", command, what, arg);
+        return -1;
+    }
+    *size = (size_t)value;
+    return 0;
+}
+
+// a cursor is the key of the last child of a page: a type or a size, a
+// slash, which no name holds, and the name
+static int parse_cursor(enum ChildSort sort, char *cursor,
+                        enum TreeNodeType *type, size_t *size, char **name)
+{
+    *type = FILE_NODE;
+    *size = 0;
+    *name = cursor;
+    if (sort == SORT_NAME)
+        return 0;
+
+    char *slash = strchr(cursor, '/');
+    if (slash == NULL || slash[1] == '\0')
+        return -1;
+    *name = slash + 1;
+    if (sort == SORT_TYPE)
+    {
+        if (slash - cursor != 1 || (*cursor != 'd' && *cursor != 'f'))
+            return -1;
+        *type = *cursor == 'd' ? FOLDER_NODE : FILE_NODE;
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(cursor, &end, 10);
+    if (end != slash || *cursor == '-' || errno != 0)
+        return -1;
+    *size = (size_t)value;
+    return 0;
+}
+
+void listChildren(TreeNode *currentNode, char *path, char *sort, char *limit,
+                  char *after, int details)
+{
+    enum ChildSort by;
+    if (!strcmp(sort, NO_ARG) || !strcmp(sort, "name"))
+        by = SORT_NAME;
+    else if (!strcmp(sort, "type"))
+        by = SORT_TYPE;
+    else if (!strcmp(sort, "size"))
+        by = SORT_SIZE;
+    else
+    {
+        out_printf("ls: invalid argument '%s' for '--sort'\n", sort);
+        return;
+    }
+
+    // without a limit the whole folder is one page
+    size_t count = SIZE_MAX;
+    if (*limit != '\0' && parse_size("ls", "limit", limit, &count) < 0)
+        return;
+    enum TreeNodeType type = FILE_NODE;
+    size_t size = 0;
+    char *name = NULL;
+    if (*after != '\0' && parse_cursor(by, after, &type, &size, &name) < 0)
+    {
+        out_printf("ls: invalid cursor '%s'\n", after);
+        return;
+    }
+
+    TreeNode *folderNode = currentNode;
+    if (strcmp(path, NO_ARG))
+    {
+        PathLookup lookup;
+        if (resolve_path(currentNode, path, &lookup) < 0 ||
+            lookup.node == NULL)
         {
-            // if we are in the root node, we don't go to the parent node
-            if (sourceNode->parent == NULL)
-                break;
-            else
-                sourceNode = sourceNode->parent;
+            out_printf("ls: cannot access '%s': %s\n", path,
+                       lookup_reason(&lookup));
+            return;
         }
-        else
+        // a file lists the same, sorted or not
+        if (lookup.node->type != FOLDER_NODE)
         {
-            // we search for the content from the current node
-            FolderContent *folderContent = sourceNode->content;
-            ListNode *listNode = folderContent->children->head;
-            while (listNode != NULL)
-            {
-                // if we find the node we want to go to, we store it
-                if (strcmp(listNode->info->name, stripSourcePath) == 0)
-                {
-                    sourceNode = listNode->info;
-                    break;
-                }
-                listNode = listNode->next;
-            }
+            ls(currentNode, path, details);
+            return;
         }
-        // we get the next path
-        stripSourcePath = strtok(NULL, "/");
+        folderNode = lookup.node;
     }
 
-    // copy destination path
-    char *copyDestination = malloc(strlen(destination) + 1);
-    DIE(!copyDestination, "malloc");
-    memcpy(copyDestination, destination, strlen(destination) + 1);
-    // verify if we can acces the destination folder
-    char *stripDestinationPath = strtok(destination, "/");
-    int found = 0;
-    while (stripDestinationPath != NULL)
+    // the page starts right after the cursor, found in the skip list
+    ChildOrder *order = order_get(folderNode->content, by);
+    OrderEntry *entry = *after != '\0' ?
+                        order_after(order, type, size, name) :
+                        order->head[0];
+    OrderEntry *last = NULL;
+    for (size_t i = 0; i < count && entry != NULL; i++)
     {
-        // we check if the node we want to go to is a parent node
-        if (!strcmp(stripDestinationPath, PARENT_DIR))
-        {
-            // if we are in the root node, we don't go to the parent node
-            if (destinationNode->parent == NULL)
-            {
-                printf("mv: failed to access '%s': Not a directory\n",
-                       copyDestination);
-                free(copyDestination);
-                return;
-            }
-            else
-                destinationNode = destinationNode->parent;
-            stripDestinationPath = strtok(NULL, "/");
-        }
+        if (details)
+            print_details(entry->node);
         else
         {
-            found = 0;
-            // we search for the content from the current node
-            FolderContent *folderContent = destinationNode->content;
-            ListNode *listNode = folderContent->children->head;
-            while (listNode != NULL)
-            {
-                // if we find the node we want to go to, we store it
-                if (strcmp(listNode->info->name, stripDestinationPath) == 0)
-                {
-                    destinationNode = listNode->info;
-                    found = 1;
-                    break;
-                }
-                listNode = listNode->next;
-            }
-            stripDestinationPath = strtok(NULL, "/");
-            // if we didn't find the node we want to go to
-            // we print an error message
-            if (!found && stripDestinationPath != NULL)
-            {
-                printf("mv: failed to access '%s': Not a directory\n",
-                       copyDestination);
-                free(copyDestination);
-                return;
-            }
+            out_puts(entry->node->name);
+            out_write("\n", 1);
         }
-        // we get the next path
+        last = entry;
+        entry = entry->forward[0];
+    }
+
+    // what the next page starts after, if there is one
+    if (entry == NULL || last == NULL)
+        return;
+    if (by == SORT_TYPE)
+        out_printf("next: %c/%s\n",
+                   last->node->type == FOLDER_NODE ? 'd' : 'f',
+                   last->node->name);
+    else if (by == SORT_SIZE)
+        out_printf("next: %zu/%s\n", last->size, last->node->name);
+    else
+        out_printf("next: %s\n", last->node->name);
+}
 
-        // verify if destination node is null
+// finds the file a command works on, creating it if asked to
+static TreeNode *open_file(TreeNode *currentNode, const char *command,
+                           char *fileName, int create)
+{
+    PathLookup lookup;
+
+    if (resolve_path(currentNode, fileName, &lookup) < 0 ||
+        (lookup.node == NULL && !create))
+    {
+        out_printf("%s: cannot open '%s': %s\n", command, fileName,
+                   lookup_reason(&lookup));
+        return NULL;
     }
-    free(copyDestination);
-    // verify if destination node is a folder
-    if (destinationNode->type == FOLDER_NODE)
+    if (lookup.node == NULL)
+        return create_node(lookup.parent,
+                           copy_name(lookup.parent, lookup.last,
+                                     lookup.last_len),
+                           FILE_NODE);
+    if (lookup.node->type == FOLDER_NODE)
     {
-        TreeNode *file = fileExist(destinationNode, sourceNode->name);
-        // if the file exists, we delete it
-        if (file)
-        {
-            freeNode(file);
-            FolderContent *destContent = destinationNode->parent->content;
-            ListNode *removed = ll_remove_node(destContent->children,
-                                               sourceNode->name);
-            free(removed);
-        }
-        // we link the source node to the destination node
-        FolderContent *folderContent = sourceNode->parent->content;
-        ListNode *new = ll_remove_node(folderContent->children,
-                                       sourceNode->name);
+        out_printf("%s: cannot open '%s': Is a directory\n", command,
+                   fileName);
+        return NULL;
+    }
+    return lookup.node;
+}
 
-        FolderContent *destinationContent = destinationNode->content;
+// whether offset + length bytes fit in a file, says so if they don't
+static int size_fits(const char *command, char *fileName, size_t offset,
+                     size_t length)
+{
+    if (offset <= FILE_MAX_SIZE && length <= FILE_MAX_SIZE - offset)
+        return 1;
+    out_printf("%s: %s: File too large\n", command, fileName);
+    return 0;
+}
 
-        ListNode *temp = destinationContent->children->head;
-        destinationContent->children->head = new;
-        new->next = temp;
-        sourceNode->parent = destinationNode;
+void appendFile(TreeNode *currentNode, char *fileName, char *text)
+{
+    TreeNode *treeNode = open_file(currentNode, "append", fileName, 1);
+    if (treeNode == NULL)
         return;
-    }
-    if (!found)
-    {
-        // remove from the source folder
-        FolderContent *folderContent = sourceNode->parent->content;
-        ListNode *new = ll_remove_node(folderContent->children,
-                                       sourceNode->name);
 
-        FolderContent *destinationContent = destinationNode->parent->content;
-        // link it to the destination folder
-        ListNode *temp = destinationContent->children->head;
-        destinationContent->children->head = new;
-        new->next = temp;
-        sourceNode->parent = destinationNode;
+    // only the last chunk is rebuilt, the others stay as they are
+    FileContent *content = treeNode->content;
+    size_t oldSize = data_size(content->data);
+    if (!size_fits("append", fileName, oldSize, strlen(text)))
         return;
-    }
-    else
-    {
-        // update the file
-        FileContent *destinationContent = destinationNode->content;
-        FileContent *sourceContent = sourceNode->content;
-        // clear destination content
-        free(destinationContent->text);
-        destinationContent->text = malloc(strlen(sourceContent->text) + 1);
-        DIE(!destinationContent->text, "malloc");
-        // copy the source content
-        memcpy(destinationContent->text, sourceContent->text,
-               strlen(sourceContent->text) + 1);
-        // remove from the source folder
-        FolderContent *folderContent = sourceNode->parent->content;
-        ListNode *new = ll_remove_node(folderContent->children,
-                                       sourceNode->name);
-        freeNode(sourceNode);
-        free(new);
+    file_changing(treeNode);
+    data_write(&content->data, oldSize, text, strlen(text));
+    file_resized(treeNode, oldSize);
+}
+
+void readFile(TreeNode *currentNode, char *fileName, char *offset,
+              char *length)
+{
+    size_t start = 0, count = SIZE_MAX;
+
+    // without an offset we read from the start, without a length to the end
+    if ((*offset != '\0' &&
+         parse_size("read", "offset", offset, &start) < 0) ||
+        (*length != '\0' &&
+         parse_size("read", "length", length, &count) < 0) ||
+        !size_fits("read", fileName, start, *length != '\0' ? count : 0))
+        return;
+    TreeNode *treeNode = open_file(currentNode, "read", fileName, 0);
+    if (treeNode == NULL)
+        return;
+
+    // like pread, a read past the end gets what is there
+    FileData *data = ((FileContent *)treeNode->content)->data;
+    if (data != NULL)
+        print_data(data, start, count);
+    out_puts("\n");
+}
+
+void writeFile(TreeNode *currentNode, char *fileName, char *offset,
+               char *text)
+{
+    size_t start;
+
+    if (parse_size("write", "offset", offset, &start) < 0 ||
+        !size_fits("write", fileName, start, strlen(text)))
+        return;
+    TreeNode *treeNode = open_file(currentNode, "write", fileName, 1);
+    if (treeNode == NULL)
+        return;
+
+    // the file's content is copied first if other files share it, then
+    // only the chunks the text lands on are rebuilt
+    FileContent *content = treeNode->content;
+    size_t oldSize = data_size(content->data);
+    file_changing(treeNode);
+    data_write(&content->data, start, text, strlen(text));
+    file_resized(treeNode, oldSize);
+}
+
+void compress(TreeNode *root, char *size, char *idle)
+{
+    size_t minSize, idleCommands;
+
+    if (parse_size("compress", "size", size, &minSize) < 0 ||
+        parse_size("compress", "idle", idle, &idleCommands) < 0)
         return;
+
+    // the new thresholds apply right away to the whole tree
+    data_tier(minSize, idleCommands);
+    packTree(root);
+}
+
+void packTree(TreeNode *folderNode)
+{
+    TreeWalk walk;
+    TreeNode *node;
+
+    walk_start(&walk, folderNode);
+    while ((node = walk_next(&walk)) != NULL)
+    {
+        if (node->type == FILE_NODE)
+            data_sweep(((FileContent *)node->content)->data);
     }
+    walk_end(&walk);
 }
 
 TreeNode *fileExist(TreeNode *currentNode, char *fileName)
 {
-    // we search for the file from the current node
-    FolderContent *folderContent = (FolderContent *)currentNode->content;
-    ListNode *listNode = folderContent->children->head;
-    while (listNode != NULL)
+    // we search for the file in the current node's child index
+    return folder_find(currentNode->content, fileName);
+}
+
+// marks a slot whose child was removed, so probing continues past it
+static TreeNode ci_tombstone;
+#define CI_TOMBSTONE (&ci_tombstone)
+
+unsigned int name_hash(const char *name, size_t len)
+{
+    // FNV-1a over the name
+    unsigned int hash = 2166136261u;
+    while (len--)
     {
-        if (strcmp(listNode->info->name, fileName) == 0)
-            return listNode->info;
-        listNode = listNode->next;
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
     }
-    return NULL;
+    return hash;
 }
 
-List *
-ll_create()
+static int name_equals(const char *name, const char *other, size_t len)
 {
-    List *list;
+    return strncmp(name, other, len) == 0 && name[len] == '\0';
+}
 
-    list = (List *)malloc(sizeof(List));
-    DIE(!list, "malloc");
+static void ci_place(ChildIndex *index, TreeNode *node)
+{
+    unsigned int mask = index->capacity - 1;
+    unsigned int i = name_hash(node->name, strlen(node->name)) & mask;
+
+    // linear probing until we find a free or a tombstone slot
+    while (index->slots[i] != NULL && index->slots[i] != CI_TOMBSTONE)
+        i = (i + 1) & mask;
+    if (index->slots[i] == NULL)
+        index->used++;
+    __atomic_store_n(&index->slots[i], node, __ATOMIC_RELEASE);
+}
 
-    list->head = NULL;
+static void ci_rebuild(FolderContent *folder, unsigned int capacity)
+{
+    // the table is rebuilt from the children list, this also drops
+    // all the tombstones left behind by removals
+    ChildIndex *index = calloc(1, sizeof(ChildIndex) +
+                                  capacity * sizeof(TreeNode *));
+    DIE(!index, "calloc");
+    index->capacity = capacity;
+
+    TreeNode *child = folder->head;
+    while (child != NULL)
+    {
+        ci_place(index, child);
+        child = child->next;
+    }
 
-    return list;
+    // lock-free readers may still probe the old table
+    ChildIndex *old = folder->index;
+    __atomic_store_n(&folder->index, index, __ATOMIC_RELEASE);
+    if (old != NULL)
+        epoch_free(old);
 }
 
-void ll_add_node(List *list, const void *new_data)
+// finds the slot of the named child, and the child it held when we saw it
+static TreeNode **ci_slot(ChildIndex *index, const char *name, size_t len,
+                          TreeNode **found)
 {
-    ListNode *new_node, *curr;
+    unsigned int mask = index->capacity - 1;
+    unsigned int i = name_hash(name, len) & mask;
+    TreeNode *node;
 
-    if (list == NULL)
-        return;
+    while ((node = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE)) !=
+           NULL)
+    {
+        if (node != CI_TOMBSTONE &&
+            name_equals(__atomic_load_n(&node->name, __ATOMIC_ACQUIRE), name,
+                        len))
+        {
+            *found = node;
+            return &index->slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    return NULL;
+}
 
-    curr = list->head;
+FolderContent *folder_create(TreeMem *mem, TreeNode *treeNode)
+{
+    FolderContent *folder = pool_alloc(&mem->folders);
 
-    new_node = malloc(sizeof(ListNode));
-    DIE(!new_node, "malloc");
-    new_node->info = (TreeNode *)malloc(sizeof(TreeNode));
-    DIE(!new_node->info, "malloc");
-    memcpy(new_node->info, new_data, sizeof(TreeNode));
-    list->head = new_node;
-    new_node->next = curr;
+    folder_init(folder, mem, treeNode);
+    return folder;
 }
 
-ListNode *
-ll_remove_node(List *list, const void *data)
+void folder_init(FolderContent *folder, TreeMem *mem, TreeNode *treeNode)
 {
-    ListNode *curr, *prev;
+    folder->mem = mem;
+    folder->ino = inode_alloc(mem, treeNode, MODE_FOLDER | FOLDER_MODE, 0);
+    folder->head = NULL;
+    folder->size = 0;
+    folder->index = NULL;
+    pthread_rwlock_init(&folder->lock, NULL);
+    folder->removed = 0;
+    folder->path = NULL;
+    memset(&folder->stats, 0, sizeof(folder->stats));
+    folder->orders = NULL;
+    // a new folder is in none of the snapshots taken so far
+    folder->saved = snap_generation();
+    folder->digest = 0;
+    folder->changed = snap_generation();
+}
 
-    if (list == NULL)
-        return NULL;
+// releases what the folder holds outside the tree's pools
+void folder_destroy(FolderContent *folder)
+{
+    // the children are freed by the caller
+    free(folder->index);
+    free(folder->path);
+    order_destroy(folder);
+    pthread_rwlock_destroy(&folder->lock);
+}
 
-    if (list->head == NULL)
-        return NULL;
+void folder_free(FolderContent *folder)
+{
+    inode_free(folder->mem, folder->ino);
+    folder_destroy(folder);
+    pool_free(&folder->mem->folders, folder);
+}
+
+/*
+ * Lookups only need the folder to stay allocated, not locked: links are
+ * published with release stores and read with acquire loads, and a
+ * removed child keeps its next link, so a scan standing on it goes on.
+ */
+TreeNode *folder_lookup(FolderContent *folder, const char *name, size_t len)
+{
+    ChildIndex *index = __atomic_load_n(&folder->index, __ATOMIC_ACQUIRE);
 
-    curr = list->head;
-    prev = NULL;
-    while (curr != NULL)
+    // small folders are not indexed, we just scan them
+    if (index == NULL)
     {
-        if (strcmp(curr->info->name, data) == 0)
+        TreeNode *child = __atomic_load_n(&folder->head, __ATOMIC_ACQUIRE);
+        while (child != NULL)
         {
-            if (prev == NULL)
-                list->head = curr->next;
-            else
-                prev->next = curr->next;
-            return curr;
+            if (name_equals(__atomic_load_n(&child->name, __ATOMIC_ACQUIRE),
+                            name, len))
+                return child;
+            child = __atomic_load_n(&child->next, __ATOMIC_ACQUIRE);
         }
-        prev = curr;
-        curr = curr->next;
+        return NULL;
     }
 
-    return NULL;
+    // the slot may be emptied meanwhile, we return what we matched
+    TreeNode *child;
+    return ci_slot(index, name, len, &child) ? child : NULL;
+}
+
+TreeNode *folder_find(FolderContent *folder, const char *name)
+{
+    return folder_lookup(folder, name, strlen(name));
 }
 
-void ll_free(List **list)
+void folder_link(FolderContent *folder, TreeNode *node)
 {
-    ListNode *curr, *next;
+    // new nodes are always prepended
+    folder_insert(folder, node, NULL);
+}
 
-    if (list == NULL || *list == NULL)
+// links a node after prev, or first without one
+void folder_insert(FolderContent *folder, TreeNode *node, TreeNode *prev)
+{
+    TreeNode **link = prev != NULL ? &prev->next : &folder->head;
+
+    snap_save(folder);
+    node->prev = prev;
+    // a moved node may still have readers standing on it
+    __atomic_store_n(&node->next, *link, __ATOMIC_RELEASE);
+    if (*link != NULL)
+        (*link)->prev = node;
+    __atomic_store_n(link, node, __ATOMIC_RELEASE);
+    folder->size++;
+    order_link(folder, node);
+
+    ChildIndex *index = folder->index;
+    if (index == NULL)
+    {
+        // the folder just outgrew a linear scan, we start indexing it
+        if (folder->size > CHILD_INDEX_THRESHOLD)
+            ci_rebuild(folder, CHILD_INDEX_MIN_CAPACITY);
         return;
+    }
 
-    curr = (*list)->head;
-    while (curr != NULL)
+    // keep the load factor (tombstones included) under 3/4
+    if ((index->used + 1) * 4 > index->capacity * 3)
     {
-        next = curr->next;
-        free(curr);
-        curr = next;
+        unsigned int capacity = index->capacity;
+        while (folder->size * 2 > capacity)
+            capacity *= 2;
+        ci_rebuild(folder, capacity);
     }
-    free(*list);
-    *list = NULL;
+    else
+        ci_place(index, node);
+}
+
+void folder_unlink(FolderContent *folder, TreeNode *node)
+{
+    snap_save(folder);
+    if (folder->index != NULL)
+    {
+        TreeNode *found;
+        TreeNode **slot = ci_slot(folder->index, node->name,
+                                  strlen(node->name), &found);
+        __atomic_store_n(slot, CI_TOMBSTONE, __ATOMIC_RELEASE);
+    }
+
+    // the node keeps its own next link, for the scans standing on it
+    if (node->prev == NULL)
+        __atomic_store_n(&folder->head, node->next, __ATOMIC_RELEASE);
+    else
+        __atomic_store_n(&node->prev->next, node->next, __ATOMIC_RELEASE);
+    if (node->next != NULL)
+        node->next->prev = node->prev;
+    node->prev = NULL;
+    folder->size--;
+    order_unlink(folder, node);
+
+    // the node left its folder, cached lookups may point to it
+    dc_invalidate();
 }
@@ -1,49 +1,424 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
 #define TREE_CMD_INDENT_SIZE 4
 #define NO_ARG ""
 #define PARENT_DIR ".."
+#define CHILD_INDEX_THRESHOLD 8
+#define CHILD_INDEX_MIN_CAPACITY 16
+#define DENTRY_CACHE_SIZE (1 << 16)
+#define POOL_SLAB_SIZE (1 << 16)
+#define ARENA_CLASSES 6
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define JOURNAL_BUFFER_SIZE (1 << 16)
+#define JOURNAL_BUFFER_LIMIT (64 << 20)
+#define JOURNAL_CHECKPOINT_SIZE (64 << 20)
+#define EPOCH_MAX_READERS 256
+#define EPOCH_RECLAIM_BATCH 64
+#define WORK_MAX_THREADS 64
+#define PARALLEL_SUBTREE_SIZE 4096
+#define CONTENT_CHUNK_SIZE 4096
+#define FILE_MAX_SIZE ((size_t)1 << 30)
+#define WALK_INLINE_DEPTH 32
+#define TRIGRAM_SIGNATURE_BITS 4096
+#define GREP_PARALLEL_BYTES (1 << 20)
+#define ORDER_MAX_HEIGHT 16
+#define SYMLINK_MAX_FOLLOWS 40
+#define FILE_MODE 0644
+#define FOLDER_MODE 0755
+#define SYMLINK_MODE 0777
+// the type bits kept with the permission bits, as stat gives them
+#define MODE_TYPE 0170000
+#define MODE_FILE 0100000
+#define MODE_FOLDER 0040000
+#define MODE_SYMLINK 0120000
+#define MODE_PERMISSIONS 0777
+#define TOP_DEFAULT_COUNT 10
 
+typedef struct Blob Blob;
+typedef struct BlobStats BlobStats;
+typedef struct FileData FileData;
 typedef struct FileContent FileContent;
 typedef struct FolderContent FolderContent;
 typedef struct TreeNode TreeNode;
 typedef struct FileTree FileTree;
-typedef struct ListNode ListNode;
-typedef struct List List;
+typedef struct ChildIndex ChildIndex;
+typedef struct TreeStats TreeStats;
+typedef struct NameTrie NameTrie;
+typedef struct NameIndex NameIndex;
+typedef struct GrepMatch GrepMatch;
+typedef struct OrderEntry OrderEntry;
+typedef struct ChildOrder ChildOrder;
+typedef struct Snapshot Snapshot;
+typedef struct SnapEntry SnapEntry;
+typedef struct SnapView SnapView;
+typedef struct PathLookup PathLookup;
+typedef struct Slab Slab;
+typedef struct Pool Pool;
+typedef struct StringArena StringArena;
+typedef struct InodeTable InodeTable;
+typedef struct TreeMem TreeMem;
+typedef struct Mapping Mapping;
+typedef struct WalkFrame WalkFrame;
+typedef struct TreeWalk TreeWalk;
+typedef struct SharedTree SharedTree;
+typedef struct Worker Worker;
 
 enum TreeNodeType {
     FILE_NODE,
-    FOLDER_NODE
+    FOLDER_NODE,
+    SYMLINK_NODE
+};
+
+// the orders ls can list a folder in
+enum ChildSort {
+    SORT_NAME,
+    SORT_TYPE,
+    SORT_SIZE
+};
+
+// immutable, reference counted file content, see blob.c
+struct Blob {
+    unsigned int refs;
+    size_t length;
+    // the length of the compressed bytes, 0 if they are stored plain
+    size_t packed;
+    // right after the blob, or inside an image mapping
+    const char* data;
+    // the store's key, and its chain link
+    uint64_t hash[2];
+    Blob* next;
+    // the trigrams of its bytes, NULL until grep -t needs them, see grep.c
+    uint64_t* trigrams;
+};
+
+// what the blob store holds, against what the files reference
+struct BlobStats {
+    size_t blobs;
+    uint64_t storedBytes;
+    uint64_t references;
+    uint64_t referencedBytes;
+    // the packed blobs, what they take and what they hold
+    size_t packedBlobs;
+    uint64_t packedBytes;
+    uint64_t unpackedBytes;
+    // the codec's calls so far, and the time they took
+    uint64_t packs;
+    uint64_t packNanos;
+    uint64_t unpacks;
+    uint64_t unpackNanos;
+};
+
+/*
+ * A file's bytes, in chunks of CONTENT_CHUNK_SIZE bytes, see filedata.c.
+ * Files copied from each other share it.
+ */
+struct FileData {
+    unsigned int refs;
+    // 0 if it came with an image, then it is never resized nor freed
+    size_t capacity;
+    size_t count;
+    // 1 once all its chunks went through blob_pack
+    unsigned int packed;
+    size_t size;
+    // the command clock of its last read or write
+    unsigned long used;
+    // the digest of its bytes, 0 until diff asks for it, see diff.c
+    uint64_t digest;
+    Blob* chunks[];
 };
 
+/*
+ * A file, or a symlink, whatever its names: the names a file got from ln
+ * are nodes pointing to the same content, see inode.c.
+ */
 struct FileContent {
-    char* text;
+    // NULL for a file without content, and for a symlink
+    FileData* data;
+    // the path a symlink points to, interned with the names, NULL for a
+    // file
+    char* target;
+    uint32_t ino;
+    // the nodes naming it, in the tree or kept out of it
+    unsigned int links;
+    // set for good once it gets a second name, snapshots may still see
+    // it shared after that
+    unsigned int linked;
+};
+
+// what a folder holds, all the way down, see stats.c
+struct TreeStats {
+    uint64_t files;
+    uint64_t folders;
+    uint64_t bytes;
+};
+
+/*
+ * Open addressing index over a folder's children, keyed by name.
+ * It is only built once the folder grows past CHILD_INDEX_THRESHOLD
+ * entries, smaller folders are scanned linearly. A bigger table
+ * replaces it as a whole, so its capacity always matches its slots.
+ */
+struct ChildIndex {
+    unsigned int capacity;
+    unsigned int used;
+    TreeNode* slots[];
+};
+
+/*
+ * Fixed size object allocator. Objects are bumped out of big slabs and
+ * freed objects are kept on a free list, slabs are only given back to
+ * the system when the whole pool is destroyed.
+ */
+struct Pool {
+    size_t objectSize;
+    void* freeList;
+    // the last free object, so free lists can be spliced
+    void* freeTail;
+    char* next;
+    char* end;
+    Slab* slabs;
+};
+
+// interned, reference counted strings, used for node names and symlink
+// targets, see mem.c
+struct StringArena {
+    pthread_mutex_t lock;
+    char** strings;
+    unsigned int capacity;
+    unsigned int count;
+    // a pool per size class, from 16 bytes up, doubling
+    Pool sizes[ARENA_CLASSES];
+};
+
+// a file mapped in memory, like a loaded image
+struct Mapping {
+    void* data;
+    size_t size;
+    Mapping* next;
+};
+
+// a child in one of its folder's sorted orders, see order.c
+struct OrderEntry {
+    TreeNode* node;
+    // the file size it was placed by
+    size_t size;
+    unsigned int height;
+    OrderEntry* forward[];
+};
+
+struct ChildOrder {
+    enum ChildSort sort;
+    unsigned int seed;
+    size_t count;
+    ChildOrder* next;
+    OrderEntry* head[ORDER_MAX_HEIGHT];
+};
+
+// the lines of a file grep matched, each one ending with a newline
+struct GrepMatch {
+    TreeNode* file;
+    char* lines;
+    size_t length;
+};
+
+// an edge of the name index, and the nodes whose name ends with it
+struct NameTrie {
+    // inside the interned name the edge holds, which starts with the
+    // whole path down to it
+    const char* label;
+    char* owner;
+    size_t length;
+    NameTrie* child;
+    NameTrie* sibling;
+    TreeNode* nodes;
+};
+
+struct NameIndex {
+    TreeMem* mem;
+    pthread_mutex_t lock;
+    NameTrie root;
+    Pool tries;
+};
+
+/*
+ * The tree's files and folders by inode number, see inode.c. What stat
+ * shows of them is kept out of the nodes, one array per field, so a scan
+ * of a field reads that field and nothing else.
+ */
+struct InodeTable {
+    pthread_mutex_t lock;
+    uint32_t capacity;
+    // the numbers given so far, 0 is never given
+    uint32_t count;
+    // a node naming each one
+    TreeNode** nodes;
+    // the type and permission bits, 0 for a number not given
+    uint16_t* mode;
+    uint64_t* size;
+    // in nanoseconds since the epoch: the last change to the content, and
+    // the last change to the content or to the rest
+    int64_t* mtime;
+    int64_t* ctime;
+    // the numbers given back, given again first
+    uint32_t* free;
+    uint32_t freeCount;
+    uint32_t freeCapacity;
+};
+
+// everything a tree's nodes are allocated from
+struct TreeMem {
+    Pool nodes;
+    Pool files;
+    Pool folders;
+    StringArena names;
+    // what a loaded image needed allocated, in a few big blocks
+    Slab* bulk;
+    Mapping* mappings;
+    // built by the first search, NULL until then, see index.c
+    NameIndex* index;
+    InodeTable inodes;
 };
 
 struct FolderContent {
-    List* children;
+    TreeMem* mem;
+    uint32_t ino;
+    TreeNode* head;
+    unsigned int size;
+    ChildIndex* index;
+    // taken by the writers of the children and their files' texts,
+    // see shared.c
+    pthread_rwlock_t lock;
+    // set once a shared tree removed the folder
+    int removed;
+    // the folder's full path, NULL until asked for, see path.c
+    char* path;
+    size_t pathLength;
+    // where the path under the root starts in it
+    size_t pathStart;
+    TreeStats stats;
+    // the sorted orders ls asked for, NULL until then
+    ChildOrder* orders;
+    // the newest snapshot the children are saved for, see snap.c
+    uint64_t saved;
+    // the digest of everything inside, 0 until diff asks for it, and the
+    // snapshot generation the inside last changed in, see diff.c
+    uint64_t digest;
+    uint64_t changed;
 };
 
+/*
+ * A node is linked in its parent's children list through its own
+ * next/prev links, so it keeps its address for its whole lifetime.
+ */
 struct TreeNode {
     TreeNode* parent;
     char* name;
     enum TreeNodeType type;
     void* content;
+    TreeNode* next;
+    TreeNode* prev;
+    // the other nodes with the same name, once the tree has a name index
+    TreeNode* nameNext;
+    TreeNode** nameLink;
+    // the next name of the same file, in a ring, NULL for a file with one
+    // name
+    TreeNode* linkNext;
+};
+
+enum ResolveError {
+    RESOLVE_OK,
+    RESOLVE_NOT_FOUND,
+    RESOLVE_NOT_DIR,
+    RESOLVE_ABOVE_ROOT,
+    RESOLVE_LOOP
+};
+
+/*
+ * Result of resolve_path. node is the resolved node, or NULL if only
+ * the last component of the path is missing; parent is the folder that
+ * holds (or would hold) it and last points to that component inside
+ * the resolved path (it is not NUL terminated).
+ */
+struct PathLookup {
+    TreeNode* node;
+    TreeNode* parent;
+    const char* last;
+    size_t last_len;
+    enum ResolveError error;
+};
+
+// a folder a walk is inside of, and the child it visits next
+struct WalkFrame {
+    TreeNode* folder;
+    TreeNode* next;
+};
+
+// an iterative depth first walk of a subtree, see walk.c
+struct TreeWalk {
+    WalkFrame* frames;
+    size_t depth;
+    size_t capacity;
+    // the depth of the node walk_next returned, 0 for the start's children
+    size_t level;
+    // 1 if that node is a folder the walk is done with
+    int leaving;
+    // the folder walk_next just returned, its children come next
+    TreeNode* entered;
+    WalkFrame inlineFrames[WALK_INLINE_DEPTH];
 };
 
 struct FileTree {
     TreeNode* root;
+    TreeMem* mem;
+    // the last journal record applied to the tree
+    uint64_t sequence;
 };
 
-struct ListNode {
-    TreeNode* info;
-    ListNode* next;
+// a node as a snapshot sees it: its name then, and a file's content then
+struct SnapEntry {
+    TreeNode* node;
+    char* name;
+    FileData* data;
+};
+
+// where we stand inside a snapshot, the folders from its root down
+struct SnapView {
+    Snapshot* snapshot;
+    SnapEntry* path;
+    size_t depth;
+    size_t capacity;
 };
 
-struct List {
-    ListNode* head;
+/*
+ * A tree several threads can work on at once, through the shared_
+ * functions. Paths given to them always start from the root.
+ */
+struct SharedTree {
+    FileTree tree;
+    // held by the commands that move or remove folders, so the folders
+    // a command found stay where they are
+    pthread_mutex_t renameLock;
+    // odd while mv relinks a node, lock-free walks retry if it moved on
+    unsigned int renameSeq;
+    // guards the tree's pools and its name arena
+    pthread_mutex_t memLock;
+    // serializes carrying the folders' stats up to the root
+    pthread_mutex_t statsLock;
 };
 
+typedef void (*EpochRelease)(void* context, void* object);
+typedef void (*SharedVisit)(void* arg, TreeNode* node, int depth);
+typedef void (*IndexVisit)(void* arg, TreeNode* node);
+typedef void (*WorkTask)(Worker* worker, void* context, void* item);
+
+typedef void (*JournalReplay)(void* arg, uint64_t sequence, int64_t time,
+                              char* cwd, char** tokens, int tokenCount);
+
+
 
-void ls(TreeNode* currentNode, char* arg);
+void ls(TreeNode* currentNode, char* arg, int details);
 void pwd(TreeNode* treeNode);
 TreeNode* cd(TreeNode* currentNode, char* path);
 void tree(TreeNode* currentNode, char* arg);
@@ -52,16 +427,218 @@ void rm(TreeNode* currentNode, char* fileName);
 void rmdir(TreeNode* currentNode, char* folderName);
 void rmrec(TreeNode* currentNode, char* resourceName);
 void touch(TreeNode* currentNode, char* fileName, char* fileContent);
-void cp(TreeNode* currentNode, char* source, char* destination);
+void cp(TreeNode* currentNode, char* source, char* destination,
+        int recursive);
 void mv(TreeNode* currentNode, char* source, char* destination);
-FileTree createFileTree();
+void ln(TreeNode* currentNode, char* target, char* linkName, int symbolic);
+void appendFile(TreeNode* currentNode, char* fileName, char* text);
+void readFile(TreeNode* currentNode, char* fileName, char* offset,
+              char* length);
+void writeFile(TreeNode* currentNode, char* fileName, char* offset,
+               char* text);
+void compress(TreeNode* root, char* size, char* idle);
+void du(TreeNode* currentNode, char* arg);
+void countTree(TreeNode* currentNode, char* arg);
+void listChildren(TreeNode* currentNode, char* path, char* sort,
+                  char* limit, char* after, int details);
+void statPath(TreeNode* currentNode, char* path);
+void changeMode(TreeNode* currentNode, char* mode, char* path);
+void topFiles(TreeNode* currentNode, char* field, char* count, char* path);
+void findNodes(TreeNode* currentNode, char* path, char* pattern);
+void grepFiles(TreeNode* currentNode, char* pattern, char* path,
+               int indexed);
+void takeSnapshot(TreeNode* root, char* name);
+void listSnapshots();
+void dropSnapshot(SnapView* view, char* name);
+int enterSnapshot(SnapView* view, char* path);
+void leaveSnapshot(SnapView* view);
+void snapshotLs(SnapView* view, char* arg);
+void snapshotPwd(SnapView* view);
+void snapshotCd(SnapView* view, char* path);
+void snapshotTree(SnapView* view, char* arg);
+void snapshotRead(SnapView* view, char* fileName, char* offset,
+                  char* length);
+void diffTrees(TreeNode* root, char* from, char* to);
+void packTree(TreeNode* folderNode);
+void print_data(FileData* data, size_t offset, size_t length);
+int parse_size(const char* command, const char* what, const char* arg,
+               size_t* size);
+FileTree createFileTree(char* rootFolderName);
 void freeTree(FileTree fileTree);
 void freeNode(TreeNode *treeNode);
+void freeNodeIn(TreeMem* mem, TreeNode* treeNode);
+int saveTree(FileTree fileTree, const char* path);
+int loadTree(const char* path, FileTree* fileTree);
+size_t nodePath(TreeNode* treeNode, char* buffer, size_t size);
 TreeNode *fileExist(TreeNode *currentNode, char *fileName);
-List* ll_create();
-void ll_add_node(List* list, const void* new_data);
-ListNode* ll_remove_node(List* list, const void* data);
-void ll_free(List **list);
+int is_ancestor(TreeNode* node, TreeNode* descendant);
+void file_resized(TreeNode* fileNode, size_t oldSize);
+FolderContent* folder_create(TreeMem* mem, TreeNode* treeNode);
+void folder_init(FolderContent* folder, TreeMem* mem, TreeNode* treeNode);
+unsigned int name_hash(const char* name, size_t len);
+TreeNode* folder_lookup(FolderContent* folder, const char* name, size_t len);
+TreeNode* folder_find(FolderContent* folder, const char* name);
+void folder_link(FolderContent* folder, TreeNode* node);
+void folder_insert(FolderContent* folder, TreeNode* node, TreeNode* prev);
+void folder_unlink(FolderContent* folder, TreeNode* node);
+void folder_destroy(FolderContent* folder);
+void folder_free(FolderContent* folder);
+void pool_init(Pool* pool, size_t objectSize);
+void* pool_alloc(Pool* pool);
+void* pool_alloc_many(Pool* pool, size_t count);
+void pool_free(Pool* pool, void* object);
+void pool_merge(Pool* pool, Pool* other);
+void pool_destroy(Pool* pool);
+void arena_init(StringArena* arena);
+char* arena_intern(StringArena* arena, const char* string, size_t len);
+void arena_destroy(StringArena* arena);
+char* name_hold(TreeMem* mem, char* name);
+void name_release(TreeMem* mem, char* name);
+TreeMem* mem_create();
+void mem_destroy(TreeMem* mem);
+void* mem_alloc_bulk(TreeMem* mem, size_t size);
+void mem_add_mapping(TreeMem* mem, void* data, size_t size);
+void inode_init(InodeTable* table);
+void inode_destroy(InodeTable* table);
+void inode_tick();
+int64_t inode_time();
+void inode_set_time(int64_t time);
+uint32_t inode_alloc(TreeMem* mem, TreeNode* treeNode, unsigned int mode,
+                     uint64_t size);
+void inode_reserve(TreeMem* mem, uint32_t count);
+void inode_free(TreeMem* mem, uint32_t ino);
+TreeNode* inode_find(TreeMem* mem, uint32_t ino);
+TreeNode* inode_name(TreeMem* mem, uint32_t ino, TreeNode* start);
+uint32_t node_ino(TreeNode* treeNode);
+void inode_touch(TreeMem* mem, TreeNode* treeNode, int modified);
+void inode_resize(TreeMem* mem, TreeNode* fileNode, uint64_t size);
+void file_init(TreeMem* mem, TreeNode* treeNode, FileContent* file,
+               FileData* data, char* target);
+void link_add(TreeMem* mem, TreeNode* treeNode, TreeNode* existing);
+unsigned int link_remove(TreeMem* mem, TreeNode* treeNode);
+Blob* blob_create(const char* data, size_t length);
+void blob_map(Blob* blob, const char* data, size_t length);
+Blob* blob_hold(Blob* blob);
+void blob_release(Blob* blob);
+void blob_stats(BlobStats* stats);
+Blob* blob_pack(Blob* blob);
+const char* blob_bytes(Blob* blob, char* buffer);
+const uint64_t* blob_trigrams(Blob* blob);
+uint64_t blob_digest(Blob* blob);
+void blob_index_trigrams();
+size_t lz_compress(const char* source, size_t length, char* destination,
+                   size_t capacity);
+long lz_decompress(const char* source, size_t length, char* destination,
+                   size_t capacity);
+FileData* data_create(const char* bytes, size_t length);
+FileData* data_hold(FileData* data);
+void data_release(FileData* data);
+size_t data_size(FileData* data);
+const char* data_bytes(FileData* data, size_t offset, char* buffer,
+                       size_t* length);
+void data_write(FileData** slot, size_t offset, const char* bytes,
+                size_t length);
+void data_tier(size_t size, unsigned long idle);
+int data_tick();
+void data_sweep(FileData* data);
+void out_write(const char* data, size_t len);
+void out_puts(const char* string);
+void out_printf(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+void out_flush();
+void out_mute(int muted);
+void out_pad(size_t width);
+void walk_start(TreeWalk* walk, TreeNode* folderNode);
+TreeNode* walk_next(TreeWalk* walk);
+void walk_skip(TreeWalk* walk);
+void walk_end(TreeWalk* walk);
+int journal_open(const char* path, uint64_t sequence);
+int journal_is_open();
+int journal_failed();
+uint64_t journal_append(int64_t time, const char* cwd, char** tokens,
+                        int tokenCount);
+int journal_flush();
+uint64_t journal_size();
+int journal_truncate();
+int journal_close();
+int journal_replay(const char* path, uint64_t after, JournalReplay replay,
+                   void* arg);
+void shared_init(SharedTree* shared, FileTree fileTree);
+void shared_destroy(SharedTree* shared);
+int shared_stat(SharedTree* shared, const char* path);
+int shared_ls(SharedTree* shared, const char* path, SharedVisit visit,
+              void* arg);
+int shared_tree(SharedTree* shared, const char* path, SharedVisit visit,
+                void* arg);
+int shared_mkdir(SharedTree* shared, const char* path);
+int shared_touch(SharedTree* shared, const char* path, const char* text);
+int shared_rm(SharedTree* shared, const char* path);
+int shared_rmdir(SharedTree* shared, const char* path);
+int shared_rmrec(SharedTree* shared, const char* path);
+int shared_cp(SharedTree* shared, const char* source,
+              const char* destination);
+int shared_mv(SharedTree* shared, const char* source,
+              const char* destination);
+void epoch_enter();
+void epoch_exit();
+void epoch_retire(EpochRelease release, void* context, void* object);
+void epoch_free(void* object);
+void epoch_barrier();
+int work_threads();
+void work_push(Worker* worker, void* item);
+void work_run(WorkTask task, void* item, void** contexts, int count);
+int subtree_threads(TreeNode* treeNode);
+TreeNode* subtree_copy(TreeNode* source, TreeNode* parent, char* name,
+                       int threads);
+void subtree_free(TreeNode* folderNode, int threads);
+const char* folder_path(TreeNode* folderNode, size_t* length);
+void path_invalidate(TreeNode* folderNode);
+ChildOrder* order_get(FolderContent* folder, enum ChildSort sort);
+OrderEntry* order_after(ChildOrder* order, enum TreeNodeType type,
+                        size_t size, const char* name);
+void order_link(FolderContent* folder, TreeNode* treeNode);
+void order_unlink(FolderContent* folder, TreeNode* treeNode);
+void order_resize(TreeNode* fileNode, size_t oldSize, size_t newSize);
+void order_destroy(FolderContent* folder);
+void index_build(TreeMem* mem, TreeNode* root);
+void index_add(TreeMem* mem, TreeNode* treeNode);
+void index_remove(TreeMem* mem, TreeNode* treeNode);
+void index_find(TreeMem* mem, const char* pattern, IndexVisit visit,
+                void* arg);
+void index_destroy(NameIndex* index);
+const char* scan_find(const char* haystack, size_t length, const char* needle,
+                      size_t needleLength);
+void trigram_sign(const char* bytes, size_t length, uint64_t* signature);
+size_t grep_search(TreeNode* start, const char* pattern, int indexed,
+                   GrepMatch** matches);
+void node_stats(TreeNode* treeNode, TreeStats* stats);
+void stats_update(TreeNode* folderNode, const TreeStats* added,
+                  const TreeStats* removed);
+void stats_resize(TreeNode* fileNode, size_t oldSize, size_t newSize);
+int resolve_path(TreeNode* start, const char* path, PathLookup* lookup);
+int resolve_entry(TreeNode* start, const char* path, PathLookup* lookup);
+TreeNode* dc_lookup(TreeNode* parent, const char* name, size_t len);
+void dc_invalidate();
+int txn_active();
+void txn_begin(TreeNode* root);
+void txn_created(TreeNode* treeNode);
+int txn_remove(TreeNode* treeNode);
+void txn_moved(TreeNode* treeNode);
+void txn_data(TreeNode* fileNode);
+void txn_mode(TreeNode* treeNode, unsigned int mode);
+void txn_touched(TreeMem* mem, TreeNode* treeNode);
+void txn_commit();
+TreeNode* txn_abort(TreeNode* currentNode);
+uint64_t snap_generation();
+void snap_save(FolderContent* folder);
+int snap_retain(TreeNode* treeNode);
+TreeNode* snap_parent(TreeNode* treeNode);
+void snap_drop_all();
+Snapshot* snap_named(const char* name);
+int snap_unchanged(Snapshot* snapshot, TreeNode* folderNode);
+size_t snap_children(Snapshot* snapshot, TreeNode* folderNode,
+                     SnapEntry** entries, size_t* capacity);
+void digest_touch(TreeNode* folderNode);
 
 #define DIE(assertion, call_description)				\
 	do {								\
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "tree.h"
+
+typedef struct UndoEntry UndoEntry;
+
+/*
+ * A transaction keeps an undo log of what its commands did to the tree.
+ * Nothing it removes is freed and no content it replaces is let go until
+ * it commits, so undoing a step puts back the very nodes and contents,
+ * and abort runs the log backwards to the tree the transaction started
+ * from. Every step is undone on the tree as it was right after it, so a
+ * node goes back to its folder next to the same neighbour, and listings
+ * come out in the same order as before. The times an inode had before
+ * the transaction first stamped it are logged too, and put back once
+ * every step is undone, since an aborted transaction is not journaled
+ * and a replay never sees what it touched.
+ */
+
+enum UndoType {
+    UNDO_CREATE,
+    UNDO_REMOVE,
+    UNDO_MOVE,
+    UNDO_DATA,
+    UNDO_MODE,
+    UNDO_TIMES
+};
+
+struct UndoEntry {
+    enum UndoType type;
+    TreeNode* node;
+    // where a removed or moved node was, and its name there
+    TreeNode* parent;
+    TreeNode* prev;
+    char* name;
+    // the content a written file had
+    FileData* data;
+    // the permission bits a node had
+    unsigned int mode;
+    // the times an inode had
+    uint32_t ino;
+    int64_t mtime;
+    int64_t ctime;
+};
+
+static struct {
+    int active;
+    TreeMem* mem;
+    // whether the name index was there when the transaction began
+    int indexed;
+    UndoEntry* log;
+    size_t count;
+    size_t capacity;
+    // the contents made and the ones written so far, their undo needs
+    // nothing more, whichever name of the file changes them, and the
+    // inodes whose times are logged
+    void** seen;
+    size_t seenCount;
+    size_t seenCapacity;
+} txn;
+
+static unsigned int seen_slot(void *content, size_t capacity)
+{
+    uintptr_t key = (uintptr_t)content >> 4;
+    return (unsigned int)(key * 2654435761u) & (capacity - 1);
+}
+
+// adds the content to the seen ones, 0 if it was already there
+static int seen_add(void *content)
+{
+    // under half full, so probes stay short
+    if ((txn.seenCount + 1) * 2 > txn.seenCapacity)
+    {
+        void **old = txn.seen;
+        size_t oldCapacity = txn.seenCapacity;
+        txn.seenCapacity = oldCapacity ? oldCapacity * 2 : 64;
+        txn.seen = calloc(txn.seenCapacity, sizeof(void *));
+        DIE(!txn.seen, "calloc");
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (old[i] == NULL)
+                continue;
+            unsigned int slot = seen_slot(old[i], txn.seenCapacity);
+            while (txn.seen[slot] != NULL)
+                slot = (slot + 1) & (txn.seenCapacity - 1);
+            txn.seen[slot] = old[i];
+        }
+        free(old);
+    }
+
+    unsigned int slot = seen_slot(content, txn.seenCapacity);
+    while (txn.seen[slot] != NULL)
+    {
+        if (txn.seen[slot] == content)
+            return 0;
+        slot = (slot + 1) & (txn.seenCapacity - 1);
+    }
+    txn.seen[slot] = content;
+    txn.seenCount++;
+    return 1;
+}
+
+static UndoEntry *log_add(enum UndoType type, TreeNode *treeNode)
+{
+    if (txn.count == txn.capacity)
+    {
+        txn.capacity = txn.capacity ? txn.capacity * 2 : 64;
+        txn.log = realloc(txn.log, txn.capacity * sizeof(UndoEntry));
+        DIE(!txn.log, "realloc");
+    }
+    UndoEntry *entry = &txn.log[txn.count++];
+    entry->type = type;
+    entry->node = treeNode;
+    entry->parent = treeNode->parent;
+    entry->prev = treeNode->prev;
+    entry->name = treeNode->name;
+    entry->data = NULL;
+    return entry;
+}
+
+static void txn_end()
+{
+    // the names moved nodes had are let go, by now they are back on their
+    // nodes or nobody's
+    for (size_t i = 0; i < txn.count; i++)
+    {
+        if (txn.log[i].type == UNDO_MOVE)
+            name_release(txn.mem, txn.log[i].name);
+    }
+    free(txn.log);
+    free(txn.seen);
+    memset(&txn, 0, sizeof(txn));
+}
+
+int txn_active()
+{
+    return txn.active;
+}
+
+void txn_begin(TreeNode *root)
+{
+    txn.active = 1;
+    txn.mem = ((FolderContent *)root->content)->mem;
+    txn.indexed = txn.mem->index != NULL;
+}
+
+void txn_created(TreeNode *treeNode)
+{
+    if (!txn.active)
+        return;
+    log_add(UNDO_CREATE, treeNode);
+    // a new file's content has nothing to go back to, but a new name of
+    // a file shares the content it already had
+    if (treeNode->linkNext == NULL)
+        seen_add(treeNode->content);
+}
+
+int txn_remove(TreeNode *treeNode)
+{
+    if (!txn.active)
+        return 0;
+
+    // the node waits out of the tree, where searches don't reach it
+    log_add(UNDO_REMOVE, treeNode);
+    folder_unlink(treeNode->parent->content, treeNode);
+    treeNode->parent = NULL;
+    return 1;
+}
+
+void txn_moved(TreeNode *treeNode)
+{
+    // the node may be renamed, its name is kept for the undo
+    if (txn.active)
+        name_hold(txn.mem, log_add(UNDO_MOVE, treeNode)->name);
+}
+
+void txn_data(TreeNode *fileNode)
+{
+    // the content is held once, before the first write changes it, then
+    // later writes copy it instead of changing it in place
+    if (!txn.active || !seen_add(fileNode->content))
+        return;
+    UndoEntry *entry = log_add(UNDO_DATA, fileNode);
+    entry->data = data_hold(((FileContent *)fileNode->content)->data);
+}
+
+void txn_mode(TreeNode *treeNode, unsigned int mode)
+{
+    if (txn.active)
+        log_add(UNDO_MODE, treeNode)->mode = mode;
+}
+
+void txn_touched(TreeMem *mem, TreeNode *treeNode)
+{
+    if (!txn.active || mem != txn.mem)
+        return;
+    // inode numbers are seen shifted past the alignment of contents, and
+    // odd, so they never meet one
+    uint32_t ino = node_ino(treeNode);
+    if (!seen_add((void *)(((uintptr_t)ino << 4) | 1)))
+        return;
+    UndoEntry *entry = log_add(UNDO_TIMES, treeNode);
+    entry->ino = ino;
+    entry->mtime = mem->inodes.mtime[ino];
+    entry->ctime = mem->inodes.ctime[ino];
+}
+
+void txn_commit()
+{
+    for (size_t i = 0; i < txn.count; i++)
+    {
+        UndoEntry *entry = &txn.log[i];
+        if (entry->type == UNDO_REMOVE)
+        {
+            // the node finds its memory through the folder it was in
+            entry->node->parent = entry->parent;
+            if (!snap_retain(entry->node))
+                freeNode(entry->node);
+        }
+        else if (entry->type == UNDO_DATA)
+            data_release(entry->data);
+    }
+    txn_end();
+}
+
+// puts a node back in a folder, right after the node it followed
+static void undo_link(UndoEntry *entry)
+{
+    TreeStats stats;
+
+    entry->node->parent = entry->parent;
+    folder_insert(entry->parent->content, entry->node, entry->prev);
+    node_stats(entry->node, &stats);
+    stats_update(entry->parent, &stats, NULL);
+    inode_touch(txn.mem, entry->parent, 1);
+}
+
+static void undo_unlink(TreeNode *treeNode)
+{
+    TreeStats stats;
+
+    node_stats(treeNode, &stats);
+    stats_update(treeNode->parent, NULL, &stats);
+    inode_touch(txn.mem, treeNode->parent, 1);
+    folder_unlink(treeNode->parent->content, treeNode);
+}
+
+TreeNode *txn_abort(TreeNode *currentNode)
+{
+    for (size_t i = txn.count; i-- > 0;)
+    {
+        UndoEntry *entry = &txn.log[i];
+        TreeNode *treeNode = entry->node;
+        if (entry->type == UNDO_CREATE)
+        {
+            // a folder we stand in goes away, we step out of it
+            if (is_ancestor(treeNode, currentNode))
+                currentNode = treeNode->parent;
+            undo_unlink(treeNode);
+            freeNode(treeNode);
+        }
+        else if (entry->type == UNDO_REMOVE)
+            undo_link(entry);
+        else if (entry->type == UNDO_MOVE)
+        {
+            undo_unlink(treeNode);
+            if (treeNode->name != entry->name)
+            {
+                char *name = treeNode->name;
+                index_remove(txn.mem, treeNode);
+                treeNode->name = name_hold(txn.mem, entry->name);
+                index_add(txn.mem, treeNode);
+                name_release(txn.mem, name);
+            }
+            undo_link(entry);
+            if (treeNode->type == FOLDER_NODE)
+                path_invalidate(treeNode);
+        }
+        else if (entry->type == UNDO_TIMES)
+            continue;
+        else if (entry->type == UNDO_MODE)
+        {
+            uint16_t *mode = &txn.mem->inodes.mode[node_ino(treeNode)];
+            *mode = (*mode & MODE_TYPE) | entry->mode;
+            inode_touch(txn.mem, treeNode, 0);
+        }
+        else
+        {
+            FileContent *content = treeNode->content;
+            size_t oldSize = data_size(content->data);
+            // our reference goes back to the file, and its size to all
+            // its names
+            data_release(content->data);
+            content->data = entry->data;
+            file_resized(treeNode, oldSize);
+        }
+    }
+
+    // undoing the steps stamped what they touched, the times go back
+    // last; an inode made meanwhile is free again, and gets new times
+    // when it is given out
+    for (size_t i = 0; i < txn.count; i++)
+    {
+        UndoEntry *entry = &txn.log[i];
+        if (entry->type != UNDO_TIMES)
+            continue;
+        txn.mem->inodes.mtime[entry->ino] = entry->mtime;
+        txn.mem->inodes.ctime[entry->ino] = entry->ctime;
+    }
+
+    // an index built meanwhile missed the nodes that were out of the
+    // tree, it is built again on the next search
+    if (!txn.indexed && txn.mem->index != NULL)
+    {
+        index_destroy(txn.mem->index);
+        txn.mem->index = NULL;
+    }
+    txn_end();
+    return currentNode;
+}
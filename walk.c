@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "tree.h"
+
+/*
+ * A depth first walk of a subtree, in the order the folders keep their
+ * children. Every folder it is inside of has a frame holding the child
+ * that comes next, so the walk takes memory for its depth only and never
+ * looks at a node again once it moved past it. That also means the node
+ * just returned may be freed: a file right away, a folder when the walk
+ * leaves it.
+ */
+
+void walk_start(TreeWalk *walk, TreeNode *folderNode)
+{
+    walk->frames = walk->inlineFrames;
+    walk->depth = 0;
+    walk->capacity = WALK_INLINE_DEPTH;
+    walk->level = 0;
+    walk->leaving = 0;
+    // the start folder is entered like any other one
+    walk->entered = folderNode;
+}
+
+static void walk_push(TreeWalk *walk, TreeNode *folderNode)
+{
+    if (walk->depth == walk->capacity)
+    {
+        size_t capacity = walk->capacity * 2;
+        WalkFrame *frames = malloc(capacity * sizeof(WalkFrame));
+        DIE(!frames, "malloc");
+        memcpy(frames, walk->frames, walk->depth * sizeof(WalkFrame));
+        if (walk->frames != walk->inlineFrames)
+            free(walk->frames);
+        walk->frames = frames;
+        walk->capacity = capacity;
+    }
+
+    WalkFrame *frame = &walk->frames[walk->depth++];
+    frame->folder = folderNode;
+    frame->next = ((FolderContent *)folderNode->content)->head;
+}
+
+TreeNode *walk_next(TreeWalk *walk)
+{
+    // the children of the folder we just entered are only read now, so
+    // the caller could lock it first
+    if (walk->entered != NULL)
+    {
+        walk_push(walk, walk->entered);
+        walk->entered = NULL;
+    }
+
+    while (walk->depth > 0)
+    {
+        WalkFrame *frame = &walk->frames[walk->depth - 1];
+        TreeNode *node = frame->next;
+        if (node != NULL)
+        {
+            frame->next = node->next;
+            walk->level = walk->depth - 1;
+            walk->leaving = 0;
+            if (node->type == FOLDER_NODE)
+                walk->entered = node;
+            return node;
+        }
+
+        // the folder is done, we leave it, but the start is not returned
+        walk->depth--;
+        if (walk->depth > 0)
+        {
+            walk->level = walk->depth - 1;
+            walk->leaving = 1;
+            return frame->folder;
+        }
+    }
+    return NULL;
+}
+
+void walk_skip(TreeWalk *walk)
+{
+    // the folder is neither entered nor left
+    walk->entered = NULL;
+}
+
+void walk_end(TreeWalk *walk)
+{
+    if (walk->frames != walk->inlineFrames)
+        free(walk->frames);
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+#include "tree.h"
+
+typedef struct WorkDeque WorkDeque;
+typedef struct WorkRun WorkRun;
+
+/*
+ * A work stealing pool: every thread keeps the items it pushes in its own
+ * deque and takes them back newest first, so it stays deep in the subtree
+ * it is working on, while idle threads steal the oldest items of the
+ * others, which are the biggest pieces of work left.
+ */
+struct WorkDeque {
+    pthread_mutex_t lock;
+    void** items;
+    size_t capacity;
+    // items live in [head, tail), modulo capacity
+    size_t head;
+    size_t tail;
+};
+
+struct Worker {
+    WorkRun* run;
+    WorkDeque deque;
+    void* context;
+    unsigned int seed;
+    pthread_t thread;
+};
+
+struct WorkRun {
+    WorkTask task;
+    Worker* workers;
+    int count;
+    // items pushed and not done yet, the run ends when it drops to 0
+    long pending;
+};
+
+static void deque_push(WorkDeque *deque, void *item)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail - deque->head == deque->capacity)
+    {
+        // we unroll the ring in a bigger array
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        void **items = malloc(capacity * sizeof(void *));
+        DIE(!items, "malloc");
+        for (size_t i = deque->head; i < deque->tail; i++)
+            items[i - deque->head] = deque->items[i % deque->capacity];
+        free(deque->items);
+        deque->items = items;
+        deque->tail -= deque->head;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->items[deque->tail++ % deque->capacity] = item;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// the owner takes the newest item, thieves the oldest one
+static void *deque_take(WorkDeque *deque, int steal)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head != deque->tail)
+    {
+        if (steal)
+            item = deque->items[deque->head++ % deque->capacity];
+        else
+            item = deque->items[--deque->tail % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return item;
+}
+
+static void *steal(Worker *worker)
+{
+    WorkRun *run = worker->run;
+    int start = rand_r(&worker->seed) % run->count;
+
+    for (int i = 0; i < run->count; i++)
+    {
+        Worker *victim = &run->workers[(start + i) % run->count];
+        if (victim == worker)
+            continue;
+        void *item = deque_take(&victim->deque, 1);
+        if (item != NULL)
+            return item;
+    }
+    return NULL;
+}
+
+static void *work_loop(void *arg)
+{
+    Worker *worker = arg;
+    WorkRun *run = worker->run;
+
+    while (1)
+    {
+        void *item = deque_take(&worker->deque, 0);
+        if (item == NULL)
+            item = steal(worker);
+        if (item != NULL)
+        {
+            run->task(worker, worker->context, item);
+            __atomic_sub_fetch(&run->pending, 1, __ATOMIC_ACQ_REL);
+            continue;
+        }
+
+        // nothing to take, but the running items may still push more
+        if (__atomic_load_n(&run->pending, __ATOMIC_ACQUIRE) == 0)
+            break;
+        sched_yield();
+    }
+    return NULL;
+}
+
+int work_threads()
+{
+    int count = get_nprocs();
+
+    if (count < 1)
+        count = 1;
+    return count < WORK_MAX_THREADS ? count : WORK_MAX_THREADS;
+}
+
+void work_push(Worker *worker, void *item)
+{
+    __atomic_add_fetch(&worker->run->pending, 1, __ATOMIC_ACQ_REL);
+    deque_push(&worker->deque, item);
+}
+
+void work_run(WorkTask task, void *item, void **contexts, int count)
+{
+    WorkRun run;
+
+    run.task = task;
+    run.count = count;
+    run.pending = 1;
+    run.workers = calloc(count, sizeof(Worker));
+    DIE(!run.workers, "calloc");
+    for (int i = 0; i < count; i++)
+    {
+        Worker *worker = &run.workers[i];
+        worker->run = &run;
+        worker->context = contexts[i];
+        worker->seed = i + 1;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+    }
+
+    // the calling thread is the first worker and starts with the item
+    deque_push(&run.workers[0].deque, item);
+    for (int i = 1; i < count; i++)
+    {
+        errno = pthread_create(&run.workers[i].thread, NULL, work_loop,
+                               &run.workers[i]);
+        DIE(errno != 0, "pthread_create");
+    }
+    work_loop(&run.workers[0]);
+    for (int i = 1; i < count; i++)
+        pthread_join(run.workers[i].thread, NULL);
+
+    for (int i = 0; i < count; i++)
+    {
+        pthread_mutex_destroy(&run.workers[i].deque.lock);
+        free(run.workers[i].deque.items);
+    }
+    free(run.workers);
+}